@@ -0,0 +1,207 @@
+/*
+ * Throughput of the checkpoint stream against the raw copy of the image.
+ *
+ * usage: ckpt_bench [size in MiB] [touched heap in %] [dedup]
+ *
+ * The synthetic image follows the enclave layout: a small code/data part,
+ * a heap of which only a part was ever touched, and zero pages for the rest.
+ * Throughput is given in GB/s of the logical (full) image size.
+ *
+ * dedup: the target holds the code pages already (its own ELF load), and
+ * the stream refers to them by hash.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "checkpoint.h"
+#include "mytime.h"
+
+#define PS CKPT_PAGE_SIZE
+#define ROUNDS 3
+
+static char* map(unsigned long size)
+{
+	char *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if(p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+#define CODE_PAGES(npages) ((npages) / 100 + 1)
+
+static void fill_image(char *image, unsigned long npages, int touched)
+{
+	unsigned long i, code_pages, heap_pages;
+	unsigned long seed = 1;
+	unsigned long *w;
+
+	//code/data: not very compressible
+	code_pages = CODE_PAGES(npages);
+	for(i = 0; i < code_pages * PS; ++i)
+	{
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		image[i] = (char)((seed >> 33) % 64 + 32);
+	}
+
+	//touched heap: objects with small counters and pointers
+	heap_pages = (npages - code_pages) * touched / 100;
+	w = (unsigned long*)(image + code_pages * PS);
+	for(i = 0; i < heap_pages * PS / 8; ++i)
+	{
+		if(i % 8 == 0)
+			w[i] = 0x40000000UL + (i * 64) % 0x10000000UL;
+		else if(i % 8 == 1)
+			w[i] = i % 1000;
+	}
+}
+
+static double gbs(unsigned long bytes, unsigned long us)
+{
+	return us ? (double)bytes / us / 1000.0 : 0;
+}
+
+static int bench_dedup(char *image, unsigned long npages, struct ckpt_buf *b, long full)
+{
+	unsigned long code_pages = CODE_PAGES(npages);
+	struct ckpt_pageset target, source;
+	struct ckpt_opts opts;
+	struct ckpt_stat stat;
+	unsigned char *adv;
+	unsigned long nadv, start, t_adv, t_w, t_r;
+	char *elf, *out;
+	long len;
+
+	//target: its own copy of the code
+	elf = map(code_pages * PS);
+	memcpy(elf, image, code_pages * PS);
+	start = get_time();
+	assert(ckpt_pageset_init(&target, code_pages) == 0);
+	assert(ckpt_pageset_add_region(&target, elf, code_pages) >= 0);
+	adv = malloc(target.num * CKPT_HASH_LEN);
+	nadv = ckpt_pageset_export(&target, adv);
+
+	//source: what the target advertised
+	assert(ckpt_pageset_init(&source, nadv) == 0);
+	assert(ckpt_pageset_import(&source, adv, nadv) == 0);
+	t_adv = get_time() - start;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.have = &source;
+	opts.dedup_first = 0;
+	opts.dedup_npages = code_pages;
+
+	b->size = b->pos + full;
+	b->pos = 0;
+	start = get_time();
+	len = ckpt_write_opts(image, npages, ckpt_buf_sink, b, &stat, &opts);
+	t_w = get_time() - start;
+	assert(len > 0);
+
+	out = map(npages * PS);
+	b->size = len;
+	b->pos = 0;
+	start = get_time();
+	opts.have = &target;
+	if(ckpt_read_opts(out, npages, ckpt_buf_source, b, 1, &opts) != len ||
+			memcmp(out, image, npages * PS) != 0)
+	{
+		printf("dedup: restored image differs\n");
+		return 1;
+	}
+	t_r = get_time() - start;
+
+	printf("dedup: %lu code pages, %lu advertised (%lu bytes, %lu us)\n",
+			code_pages, nadv, nadv * CKPT_HASH_LEN, t_adv);
+	printf("dedup: %lu ref pages, stream %ld bytes (-%ld), write %lu us, read %lu us\n",
+			stat.ref_pages, len, full - len, t_w, t_r);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = 256UL << 20;
+	int touched = 10;
+	unsigned long npages;
+	char *image, *copy, *out;
+	struct ckpt_buf b;
+	struct ckpt_stat stat;
+	unsigned long start, t, best_raw = -1UL, best_w = -1UL, best_r = -1UL;
+	long len = 0;
+	int i;
+
+	if(argc > 1)
+		size = strtoul(argv[1], NULL, 0) << 20;
+	if(argc > 2)
+		touched = atoi(argv[2]);
+	npages = size / PS;
+
+	image = map(size);
+	fill_image(image, npages, touched);
+
+	//worst case: everything raw
+	b.size = size + (npages / CKPT_CHUNK_PAGES + 1) * 2 * sizeof(struct ckpt_record) +
+		npages * sizeof(struct ckpt_record) + sizeof(struct ckpt_header);
+	b.buf = map(b.size);
+
+	for(i = 0; i < ROUNDS; ++i)
+	{
+		copy = map(size);
+		//the stream buffer is reused, already faulted in: so is the copy
+		memset(copy, 0, size);
+		start = get_time();
+		memcpy(copy, image, size);
+		t = get_time() - start;
+		if(t < best_raw)
+			best_raw = t;
+		munmap(copy, size);
+
+		b.pos = 0;
+		start = get_time();
+		len = ckpt_write(image, npages, ckpt_buf_sink, &b, &stat);
+		t = get_time() - start;
+		if(len < 0)
+		{
+			printf("ckpt_write failed\n");
+			return 1;
+		}
+		if(t < best_w)
+			best_w = t;
+
+		out = map(size);
+		b.size = len;
+		b.pos = 0;
+		start = get_time();
+		if(ckpt_read(out, npages, ckpt_buf_source, &b, 1) != len)
+		{
+			printf("ckpt_read failed\n");
+			return 1;
+		}
+		t = get_time() - start;
+		if(t < best_r)
+			best_r = t;
+		if(memcmp(out, image, size) != 0)
+		{
+			printf("restored image differs\n");
+			return 1;
+		}
+		munmap(out, size);
+	}
+
+	printf("image: %lu MiB, heap touched %d%%\n", size >> 20, touched);
+	printf("pages: %lu zero, %lu lz4, %lu raw\n", stat.zero_pages, stat.lz4_pages, stat.raw_pages);
+	printf("stream: %ld bytes (%.2f%% of the image)\n", len, 100.0 * len / size);
+	printf("raw copy:    %8lu us  %6.2f GB/s\n", best_raw, gbs(size, best_raw));
+	printf("ckpt write:  %8lu us  %6.2f GB/s\n", best_w, gbs(size, best_w));
+	printf("ckpt read:   %8lu us  %6.2f GB/s\n", best_r, gbs(size, best_r));
+
+	if(argc > 3 && strcmp(argv[3], "dedup") == 0)
+		return bench_dedup(image, npages, &b, len);
+	return 0;
+}
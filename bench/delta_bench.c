@@ -0,0 +1,164 @@
+/*
+ * Ping-pong migration with delta checkpoints.
+ *
+ * usage: delta_bench [size in MiB] [rounds] [dirtied heap pages in %]
+ *
+ * Two ends keep the image of the last checkpoint. Between two migrations the
+ * running end dirties a part of the heap, then checkpoints against the last
+ * one; the other end applies the delta on its retained image. Round 0 is a
+ * full checkpoint. Bytes moved are reported per round.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "checkpoint.h"
+#include "mytime.h"
+
+#define PS CKPT_PAGE_SIZE
+
+struct end {
+	char *image;
+	struct ckpt_delta delta;
+};
+
+static char* map(unsigned long size)
+{
+	char *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if(p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static unsigned long seed = 1;
+
+static inline unsigned long rnd()
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 17;
+}
+
+//code, and a heap that is half used
+static void fill_image(char *image, unsigned long npages)
+{
+	unsigned long i, code_pages = npages / 100 + 1;
+	unsigned long *w;
+
+	for(i = 0; i < code_pages * PS; ++i)
+		image[i] = (char)(rnd() % 64 + 32);
+
+	w = (unsigned long*)(image + code_pages * PS);
+	for(i = 0; i < (npages - code_pages) / 2 * PS / 8; ++i)
+	{
+		if(i % 8 == 0)
+			w[i] = 0x40000000UL + (i * 64) % 0x10000000UL;
+		else if(i % 8 == 1)
+			w[i] = i % 1000;
+	}
+}
+
+//the app runs: a few words on random heap pages
+static void dirty(char *image, unsigned long npages, int percent)
+{
+	unsigned long code_pages = npages / 100 + 1;
+	unsigned long heap = npages - code_pages;
+	unsigned long i, page;
+
+	for(i = 0; i < heap * percent / 100; ++i)
+	{
+		page = code_pages + rnd() % heap;
+		((unsigned long*)(image + page * PS))[rnd() % (PS / 8)] = rnd();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = 256UL << 20;
+	int rounds = 10, percent = 2;
+	unsigned long npages, start, t, total = 0, full = 0;
+	struct end ends[2], *from, *to;
+	struct ckpt_opts wopts, ropts;
+	struct ckpt_stat stat;
+	struct ckpt_buf b;
+	long len;
+	int r;
+
+	if(argc > 1)
+		size = strtoul(argv[1], NULL, 0) << 20;
+	if(argc > 2)
+		rounds = atoi(argv[2]);
+	if(argc > 3)
+		percent = atoi(argv[3]);
+	npages = size / PS;
+
+	for(r = 0; r < 2; ++r)
+	{
+		ends[r].image = map(size);
+		if(ckpt_delta_init(&ends[r].delta, npages) != 0)
+			return 1;
+	}
+	fill_image(ends[0].image, npages);
+
+	//worst case: everything raw
+	b.size = size + (npages / CKPT_CHUNK_PAGES + 1) * 2 * sizeof(struct ckpt_record) +
+		npages * sizeof(struct ckpt_record) + sizeof(struct ckpt_header);
+	b.buf = map(b.size);
+
+	printf("image: %lu MiB, %d%% of the heap pages dirtied per round\n", size >> 20, percent);
+	printf("round  direction  bytes       sent pages  same pages  write us  read us\n");
+
+	for(r = 0; r <= rounds; ++r)
+	{
+		from = &ends[r % 2];
+		to = &ends[(r + 1) % 2];
+		if(r > 0)
+			dirty(from->image, npages, percent);
+
+		memset(&wopts, 0, sizeof(wopts));
+		wopts.delta = &from->delta;
+		b.pos = 0;
+		b.size = size + size / 8;
+		start = get_time();
+		len = ckpt_write_opts(from->image, npages, ckpt_buf_sink, &b, &stat, &wopts);
+		t = get_time() - start;
+		if(len < 0)
+		{
+			printf("ckpt_write failed\n");
+			return 1;
+		}
+
+		memset(&ropts, 0, sizeof(ropts));
+		ropts.delta = &to->delta;
+		b.size = len;
+		b.pos = 0;
+		start = get_time();
+		//round 0 lands on a fresh mapping
+		if(ckpt_read_opts(to->image, npages, ckpt_buf_source, &b, r == 0, &ropts) != len)
+		{
+			printf("ckpt_read failed\n");
+			return 1;
+		}
+		if(memcmp(to->image, from->image, size) != 0)
+		{
+			printf("round %d: images differ\n", r);
+			return 1;
+		}
+
+		printf("%5d  %-9s  %-10ld  %-10lu  %-10lu  %-8lu  %lu\n", r, r % 2 ? "IN" : "OUT", len,
+				npages - stat.same_pages, stat.same_pages, t, get_time() - start);
+		if(r == 0)
+			full = len;
+		else
+			total += len;
+	}
+
+	if(rounds > 0)
+		printf("average delta: %lu bytes per round (full checkpoint: %lu bytes)\n",
+				total / rounds, full);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * memcached GET load over loopback (text protocol).
+ *
+ * usage: mc_get [port (11211)] [connections (8)] [seconds (5)] [pipeline (1)]
+ *
+ * Sets one 32-byte key, then every connection keeps pipeline GETs of it in
+ * flight for the given time. Prints the completed GETs per second.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "mytime.h"
+
+#define MAX_CONNS 256
+#define KEY "switchless"
+#define VALUE "0123456789abcdef0123456789abcdef"
+
+static const char get_req[] = "get " KEY "\r\n";
+//VALUE <key> <flags> <bytes>\r\n<data>\r\nEND\r\n
+static const char end[] = "END\r\n";
+
+struct conn {
+	int fd;
+	int inflight;
+	int match; //bytes of end matched so far
+};
+
+static int connect_to(int port)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static int send_gets(struct conn *c, int n)
+{
+	char buf[sizeof(get_req) * 64];
+	int i, len = 0;
+
+	for(i = 0; i < n; ++i)
+	{
+		memcpy(buf + len, get_req, sizeof(get_req) - 1);
+		len += sizeof(get_req) - 1;
+	}
+	if(write(c->fd, buf, len) != len)
+		return -1;
+	c->inflight += n;
+	return 0;
+}
+
+//responses completed in what was read
+static int count_ends(struct conn *c, const char *buf, int len)
+{
+	int i, done = 0;
+
+	for(i = 0; i < len; ++i)
+	{
+		if(buf[i] == end[c->match])
+			c->match += 1;
+		else
+			c->match = (buf[i] == end[0]);
+		if(c->match == sizeof(end) - 1)
+		{
+			c->match = 0;
+			done += 1;
+		}
+	}
+	return done;
+}
+
+int main(int argc, char **argv)
+{
+	static struct conn conns[MAX_CONNS];
+	static struct pollfd pfd[MAX_CONNS];
+	char buf[65536], set[128];
+	unsigned long start, now, gets = 0, seconds;
+	int port, nconn, pipeline, i, n, len;
+
+	port = argc > 1 ? atoi(argv[1]) : 11211;
+	nconn = argc > 2 ? atoi(argv[2]) : 8;
+	seconds = argc > 3 ? strtoul(argv[3], NULL, 0) : 5;
+	pipeline = argc > 4 ? atoi(argv[4]) : 1;
+	if(nconn < 1 || nconn > MAX_CONNS || pipeline < 1 || pipeline > 64)
+	{
+		printf("usage: %s [port] [connections (1-%d)] [seconds] [pipeline (1-64)]\n",
+				argv[0], MAX_CONNS);
+		return 1;
+	}
+
+	for(i = 0; i < nconn; ++i)
+	{
+		conns[i].fd = connect_to(port);
+		if(conns[i].fd < 0)
+		{
+			perror("connect");
+			return 1;
+		}
+		pfd[i].fd = conns[i].fd;
+		pfd[i].events = POLLIN;
+	}
+
+	len = snprintf(set, sizeof(set), "set " KEY " 0 0 %d\r\n" VALUE "\r\n",
+			(int)sizeof(VALUE) - 1);
+	if(write(conns[0].fd, set, len) != len || read(conns[0].fd, buf, sizeof(buf)) <= 0 ||
+			strncmp(buf, "STORED", 6) != 0)
+	{
+		printf("set failed\n");
+		return 1;
+	}
+
+	for(i = 0; i < nconn; ++i)
+		send_gets(&conns[i], pipeline);
+	start = get_time();
+	now = start;
+	while(now - start < seconds * 1000000)
+	{
+		if(poll(pfd, nconn, 100) < 0)
+			break;
+		for(i = 0; i < nconn; ++i)
+		{
+			if(!(pfd[i].revents & POLLIN))
+				continue;
+			len = read(conns[i].fd, buf, sizeof(buf));
+			if(len <= 0)
+			{
+				printf("connection %d closed\n", i);
+				return 1;
+			}
+			n = count_ends(&conns[i], buf, len);
+			conns[i].inflight -= n;
+			gets += n;
+			if(n > 0 && send_gets(&conns[i], n) != 0)
+				return 1;
+		}
+		now = get_time();
+	}
+
+	printf("%lu gets in %.2f s: %.0f gets/s\n", gets, (now - start) / 1e6,
+			gets * 1e6 / (now - start));
+	return 0;
+}
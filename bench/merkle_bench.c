@@ -0,0 +1,143 @@
+/*
+ * Build and verify throughput of the Merkle index of a dump.
+ *
+ * usage: merkle_bench [threads] [size in MiB ...]
+ *
+ * The image is cut into three extents of uneven size, so that pieces and
+ * chunks at the extent ends are partial, as in a real dump. Default sizes:
+ * 64 MiB and 1 GiB.
+ *   build:  hash every chunk and fold the tree (the sender)
+ *   check:  fold the received leaves and compare the root (the receiver, once)
+ *   verify: hash every chunk against its leaf (the receiver, per chunk)
+ *   proof:  verify a single chunk hash with its proof, per leaf
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "merkle.h"
+#include "mytime.h"
+
+#define PS 0x1000
+
+static char* map(unsigned long size)
+{
+	char *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if(p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static double gbs(unsigned long bytes, unsigned long us)
+{
+	return us ? (double)bytes / us / 1000 : 0;
+}
+
+static int run(unsigned long size, int threads)
+{
+	struct dump_extent ext[3];
+	struct merkle send, recv;
+	struct merkle_pos pos;
+	unsigned char proof[MERKLE_MAX_PROOF * MERKLE_HASH_LEN];
+	unsigned long i, start, t_build, t_check, t_verify, t_proof = 0;
+	unsigned long *w;
+	char *image;
+	int np, ret = 0;
+
+	image = map(size);
+	w = (unsigned long*)image;
+	for(i = 0; i < size / 8; ++i)
+		w[i] = i * 0x9e3779b97f4a7c15UL;
+
+	//code, data and a stack-like tail, with holes between them
+	ext[0].offset = 0;
+	ext[0].len = size / 8 + 3 * PS;
+	ext[1].offset = size / 4;
+	ext[1].len = size / 2 + 5 * PS;
+	ext[2].offset = size - size / 16 + PS;
+	ext[2].len = size / 16 - PS;
+
+	if(merkle_init(&send, ext, 3, NULL) != 0 || merkle_init(&recv, ext, 3, NULL) != 0)
+	{
+		printf("merkle_init failed\n");
+		return 1;
+	}
+
+	start = get_time();
+	merkle_hash_image(&send, image, threads);
+	t_build = get_time() - start;
+
+	//what goes over the wire: the leaves, and the root apart
+	memcpy(recv.leaves, send.leaves, send.nleaves * MERKLE_HASH_LEN);
+
+	start = get_time();
+	if(merkle_check(&recv, send.root) != 0)
+	{
+		printf("root mismatch\n");
+		ret = 1;
+	}
+	t_check = get_time() - start;
+
+	start = get_time();
+	if(merkle_verify_image(&recv, image, threads) != 0)
+		ret = 1;
+	t_verify = get_time() - start;
+
+	for(i = 0; i < recv.nleaves; ++i)
+	{
+		np = merkle_proof(&recv, i, proof, &pos);
+		start = get_time();
+		if(np < 0 || merkle_verify_proof(send.root, recv.leaves + i * MERKLE_HASH_LEN, proof, np,
+					&pos) != 0)
+		{
+			printf("proof of leaf %lu does not verify\n", i);
+			ret = 1;
+			break;
+		}
+		t_proof += get_time() - start;
+	}
+
+	//a flipped byte must be caught (and reported by the verify)
+	image[ext[1].offset + ext[1].len / 2] ^= 1;
+	if(merkle_verify_chunk(&recv, send.nleaves / 2, image + recv.chunks[send.nleaves / 2].offset) == 0 &&
+			merkle_verify_image(&recv, image, threads) == 0)
+	{
+		printf("tampered image verifies\n");
+		ret = 1;
+	}
+
+	i = ext[0].len + ext[1].len + ext[2].len;
+	printf("%5lu MiB  %7lu  %6lu  %7.2f GB/s  %8lu us  %7.2f GB/s  %.1f us\n", size >> 20,
+			recv.nleaves, recv.npieces, gbs(i, t_build), t_check, gbs(i, t_verify),
+			(double)t_proof / recv.nleaves);
+
+	merkle_free(&send);
+	merkle_free(&recv);
+	munmap(image, size);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long sizes[16] = { 64, 1024 };
+	int threads = 4, n = 2, i, ret = 0;
+
+	if(argc > 1)
+		threads = atoi(argv[1]);
+	if(argc > 2)
+	{
+		for(n = 0; n + 2 < argc && n < 16; ++n)
+			sizes[n] = strtoul(argv[n + 2], NULL, 0);
+	}
+
+	printf("%d threads\n", threads);
+	printf("image      leaves   pieces  build         check        verify        proof/leaf\n");
+	for(i = 0; i < n; ++i)
+		ret |= run(sizes[i] << 20, threads);
+	return ret;
+}
@@ -0,0 +1,173 @@
+#!/bin/sh
+#
+# Migration benchmark: the apps of enclave/test_cases, built for each enclave
+# layout and run with each thread count, are migrated out (SIGUSR1) and back
+# in (SIGUSR2) on a schedule. It runs in native mode (user --native): no SGX
+# is needed, the numbers are those of the runtime, not of EADD/EINIT.
+#
+# usage: bench/migrate_bench.sh [out dir (/tmp/migrate_bench)]
+#
+#   LAYOUTS  linker scripts of enclave/ ("linker.lds.64M linker.lds.1G linker.lds")
+#   APPS     test cases ("test_migrate multi-thread eval_memcpy_rounds");
+#            heap_reuse checks that a block malloc cut from a freed chunk survives
+#   THREADS  app threads ("1 2 4 8"); above the TCS of the layout is skipped
+#   ROUNDS   migrate-out + migrate-in per run (2)
+#   WINDOW   seconds of throughput before the first and after the last migration (2)
+#   TIMEOUT  seconds a step may take (120)
+#   CC       the enclave compiler, passed to make -C enclave
+#
+# out dir/results.csv and results.json: one row per migration, with the phases
+# of the timeline (MIGRATE_TIMELINE), the checkpoint bytes and the throughput
+# of the app (progress lines per second) before and after the migrations.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+OUT=${1:-/tmp/migrate_bench}
+LAYOUTS=${LAYOUTS:-"linker.lds.64M linker.lds.1G linker.lds"}
+APPS=${APPS:-"test_migrate multi-thread eval_memcpy_rounds"}
+THREADS=${THREADS:-"1 2 4 8"}
+ROUNDS=${ROUNDS:-2}
+WINDOW=${WINDOW:-2}
+TIMEOUT=${TIMEOUT:-120}
+PHASES="signal quiescence dump rebuild rewrite einit resume"
+
+USER_BIN=$ROOT/user
+[ -x "$USER_BIN" ] || { echo "build sdk first: $USER_BIN"; exit 1; }
+mkdir -p "$OUT" || exit 1
+CSV=$OUT/results.csv
+
+# the line an app prints for each unit of work, and its arguments
+pattern() {
+	case $1 in
+	test_migrate) echo "^value is" ;;
+	multi-thread) echo "^Hello! Enclave thread" ;;
+	eval_memcpy_rounds) echo "copied" ;;
+	heap_reuse) echo "^pattern ok" ;;
+	esac
+}
+
+app_args() {
+	case $1 in
+	test_migrate) echo "" ;;
+	multi-thread) echo "$2 0" ;;
+	eval_memcpy_rounds) echo "$2 0x1000000 0" ;;
+	heap_reuse) echo "" ;;
+	esac
+}
+
+# app threads the layout leaves room for: the main thread and the migration thread
+max_threads() {
+	ssa=$(sed -n 's/^TCS_SSA = \(0x[0-9a-fA-F]*\);.*/\1/p' "$ROOT/enclave/$1")
+	echo $(( ssa / 3 - 2 ))
+}
+
+progress() {
+	[ -f "$1" ] || { echo 0; return; }
+	grep -c "$2" "$1"
+}
+
+migrations() {
+	sed -n 's/^"migrations": \([0-9]*\),/\1/p' "$1" 2>/dev/null
+}
+
+# wait until the command prints at least $2 (up to TIMEOUT seconds), or the app dies
+wait_until() {
+	n=0
+	v=$(eval "$1")
+	while [ "${v:-0}" -lt "$2" ]; do
+		kill -0 "$PID" 2>/dev/null || return 1
+		n=$((n + 1))
+		[ $n -gt $((TIMEOUT * 10)) ] && return 1
+		sleep 0.1
+		v=$(eval "$1")
+	done
+	return 0
+}
+
+# progress lines per second over WINDOW
+rate() {
+	a=$(progress "$1" "$2")
+	sleep "$WINDOW"
+	b=$(progress "$1" "$2")
+	echo $(( (b - a) / WINDOW ))
+}
+
+echo "layout,app,threads,seq,dir,bytes,total_us$(for p in $PHASES; do printf ",%s_us" $p; done),ops_before,ops_after" > "$CSV"
+
+for lds in $LAYOUTS; do
+	layout=${lds#linker.lds}
+	layout=${layout#.}
+	[ -z "$layout" ] && layout=default
+	max=$(max_threads "$lds")
+
+	for app in $APPS; do
+		dir=$OUT/$layout-$app
+		mkdir -p "$dir"
+		if ! make -s -C "$ROOT/enclave" APP="test_cases/$app.c" lds="$lds" ${CC:+CC=$CC} > "$dir/build.log" 2>&1; then
+			echo "$layout $app: build failed, see $dir/build.log"
+			continue
+		fi
+		cp "$ROOT/enclave/enclave" "$dir/enclave"
+		# read_config takes the linker.lds next to the enclave
+		cp "$ROOT/enclave/$lds" "$dir/linker.lds"
+		pat=$(pattern "$app")
+
+		for t in $THREADS; do
+			case $app in test_migrate|heap_reuse) [ "$t" != 1 ] && continue ;; esac
+			if [ "$t" -gt "$max" ]; then
+				echo "$layout $app: $t threads, the layout has room for $max"
+				continue
+			fi
+			log=$dir/$t.log
+			tl=$dir/$t.json
+			rm -f "$tl"
+
+			MIGRATE_TIMELINE=$tl stdbuf -oL "$USER_BIN" --native "$dir/enclave" $(app_args "$app" "$t") > "$log" 2>&1 &
+			PID=$!
+
+			ok=1
+			wait_until "progress $log '$pat'" 1 || ok=0
+			[ $ok = 1 ] && before=$(rate "$log" "$pat")
+			r=0
+			while [ $ok = 1 ] && [ $r -lt "$ROUNDS" ]; do
+				kill -USR1 $PID
+				wait_until "migrations $tl" $((2 * r + 1)) || ok=0
+				[ $ok = 1 ] && kill -USR2 $PID
+				[ $ok = 1 ] && { wait_until "migrations $tl" $((2 * r + 2)) || ok=0; }
+				r=$((r + 1))
+			done
+			[ $ok = 1 ] && after=$(rate "$log" "$pat")
+			kill $PID 2>/dev/null
+			wait $PID 2>/dev/null
+
+			if [ $ok = 0 ]; then
+				echo "$layout $app $t threads: failed, see $log"
+				continue
+			fi
+			# one record per line in the timeline
+			grep '^  {"seq"' "$tl" | sed 's/[{}" ]//g; s/,$//' | awk -F, -v pre="$layout,$app,$t" \
+				-v phases="$PHASES" -v tail="$before,$after" '{
+				for(i = 1; i <= NF; ++i) { split($i, kv, ":"); v[kv[1]] = kv[2] }
+				line = pre "," v["seq"] "," v["dir"] "," v["bytes"] "," v["total_us"]
+				n = split(phases, p, " ")
+				for(i = 1; i <= n; ++i) line = line "," v[p[i] "_us"]
+				print line "," tail
+			}' >> "$CSV"
+			echo "$layout $app $t threads: $before -> $after ops/s"
+		done
+	done
+done
+
+# the same rows as JSON
+awk -F, 'NR == 1 { n = split($0, key, ","); print "["; next }
+	{
+		if(row++) printf(",\n")
+		printf("  {")
+		for(i = 1; i <= n; ++i) {
+			q = ($i ~ /^[0-9]+$/) ? "" : "\""
+			printf("%s\"%s\": %s%s%s", i > 1 ? ", " : "", key[i], q, $i, q)
+		}
+		printf("}")
+	}
+	END { print "\n]" }' "$CSV" > "$OUT/results.json"
+
+echo "results: $CSV $OUT/results.json"
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# memcached GET throughput with switchless ocalls off (SWITCHLESS_WORKERS=0)
+# and with host worker pools of several sizes.
+#
+# usage: bench/switchless_bench.sh <memcached enclave> [out dir (/tmp/switchless_bench)]
+#
+#   WORKERS     switchless workers to compare ("0 1 2 4"); 0 is every syscall an ocall
+#   MC_THREADS  memcached threads (-t, 2)
+#   CONNS       client connections (16)
+#   DURATION    seconds of load per run (5)
+#   PIPELINE    GETs in flight per connection (1)
+#   PORT        (11311)
+#   NATIVE      1: user --native with MIGRATE_DIRECT=0 (the ocall path without SGX)
+#
+# The linker.lds of the enclave must sit next to it (see read_config). The
+# workers need cores of their own: user caps them at the cpus minus one.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+ENCLAVE=$1
+OUT=${2:-/tmp/switchless_bench}
+WORKERS=${WORKERS:-"0 1 2 4"}
+MC_THREADS=${MC_THREADS:-2}
+CONNS=${CONNS:-16}
+DURATION=${DURATION:-5}
+PIPELINE=${PIPELINE:-1}
+PORT=${PORT:-11311}
+NATIVE=${NATIVE:-0}
+
+[ -n "$ENCLAVE" ] && [ -f "$ENCLAVE" ] || { echo "usage: $0 <memcached enclave> [out dir]"; exit 1; }
+[ -x "$ROOT/user" ] || { echo "build sdk first: $ROOT/user"; exit 1; }
+[ -x "$ROOT/bench/mc_get" ] || { echo "build bench first: $ROOT/bench/mc_get"; exit 1; }
+mkdir -p "$OUT" || exit 1
+CSV=$OUT/results.csv
+echo "workers,mc_threads,conns,pipeline,gets_per_s" > "$CSV"
+
+MODE=""
+[ "$NATIVE" = 1 ] && MODE=--native
+
+for w in $WORKERS; do
+	log=$OUT/memcached-$w.log
+	SWITCHLESS_WORKERS=$w MIGRATE_DIRECT=0 stdbuf -oL "$ROOT/user" $MODE "$ENCLAVE" \
+		-p "$PORT" -U 0 -t "$MC_THREADS" -u root > "$log" 2>&1 &
+	PID=$!
+
+	# up once a client gets its SET through
+	n=0
+	until "$ROOT/bench/mc_get" "$PORT" 1 0 > /dev/null 2>&1; do
+		n=$((n + 1))
+		if [ $n -gt 600 ] || ! kill -0 $PID 2>/dev/null; then
+			echo "$w workers: memcached did not come up, see $log"
+			kill -9 $PID 2>/dev/null
+			continue 2
+		fi
+		sleep 0.1
+	done
+
+	res=$("$ROOT/bench/mc_get" "$PORT" "$CONNS" "$DURATION" "$PIPELINE")
+	kill -9 $PID 2>/dev/null
+	wait $PID 2>/dev/null
+	rate=$(echo "$res" | sed -n 's/.*: \([0-9]*\) gets\/s/\1/p')
+	echo "$w workers: $res"
+	echo "$w,$MC_THREADS,$CONNS,$PIPELINE,${rate:-0}" >> "$CSV"
+done
+
+echo "results: $CSV"
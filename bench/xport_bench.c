@@ -0,0 +1,218 @@
+/*
+ * Checkpoint transport over loopback.
+ *
+ * usage: xport_bench [size in MiB] [chunk in KiB] [streams] [queue depth]
+ *
+ * raw:    the image sent zero-copy, twice over the same connections
+ * serial: checkpoint into memory, send it, then rebuild the image from it
+ * piped:  the checkpoint is written into the transport while the target
+ *         rebuilds from what has arrived (ckpt_write -> xport_sink ->
+ *         xport_source -> ckpt_read)
+ * "first" is when the first chunk landed on the target.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "checkpoint.h"
+#include "transport.h"
+#include "mytime.h"
+
+#define PS CKPT_PAGE_SIZE
+
+struct target {
+	struct xport_recv *r;
+	char *dest;
+	unsigned long cap;
+	char *image; //rebuild into this, from the source
+	unsigned long npages;
+	int pipe;
+	unsigned long start;
+	unsigned long first; //us after start
+	unsigned long chunks;
+	long len;
+	long read;
+};
+
+static char* map(unsigned long size)
+{
+	char *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if(p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static unsigned long seed = 1;
+
+static inline unsigned long rnd()
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 17;
+}
+
+//code, and a heap that is half used
+static void fill_image(char *image, unsigned long npages)
+{
+	unsigned long i, code_pages = npages / 100 + 1;
+	unsigned long *w;
+
+	for(i = 0; i < code_pages * PS; ++i)
+		image[i] = (char)(rnd() % 64 + 32);
+
+	w = (unsigned long*)(image + code_pages * PS);
+	for(i = 0; i < (npages - code_pages) / 2 * PS / 8; ++i)
+	{
+		if(i % 8 == 0)
+			w[i] = 0x40000000UL + (i * 64) % 0x10000000UL;
+		else if(i % 8 == 1)
+			w[i] = i % 1000;
+	}
+}
+
+static void on_chunk(void *ctx, unsigned long offset, char *data, unsigned long len)
+{
+	struct target *t = ctx;
+
+	if(__sync_fetch_and_add(&t->chunks, 1) == 0)
+		t->first = get_time() - t->start;
+}
+
+static void* target_thread(void *arg)
+{
+	struct target *t = arg;
+
+	t->chunks = 0;
+	t->first = 0;
+	t->read = 0;
+	if(xport_recv_start(t->r, t->dest, t->cap, on_chunk, t) != 0)
+	{
+		t->len = -1;
+		return NULL;
+	}
+	if(t->pipe)
+		t->read = ckpt_read_opts(t->image, t->npages, xport_source, t->r, 1, NULL);
+	t->len = xport_recv_wait(t->r);
+	return NULL;
+}
+
+static void start_target(struct target *t, pthread_t *tid, int pipe)
+{
+	t->pipe = pipe;
+	t->start = get_time();
+	pthread_create(tid, NULL, target_thread, t);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = 256UL << 20, chunk = XPORT_CHUNK;
+	int streams = 4, depth = XPORT_DEPTH, i;
+	unsigned long npages, start, t_write, t_send, t_read;
+	struct target t;
+	struct xport *x;
+	struct ckpt_buf b;
+	pthread_t tid;
+	char *image, *rebuilt;
+	long len;
+
+	if(argc > 1)
+		size = strtoul(argv[1], NULL, 0) << 20;
+	if(argc > 2)
+		chunk = strtoul(argv[2], NULL, 0) << 10;
+	if(argc > 3)
+		streams = atoi(argv[3]);
+	if(argc > 4)
+		depth = atoi(argv[4]);
+	npages = size / PS;
+
+	image = map(size);
+	fill_image(image, npages);
+
+	memset(&t, 0, sizeof(t));
+	t.r = xport_listen(0);
+	if(t.r == NULL)
+		return 1;
+	//the HELLOs wait in the backlog until accepted
+	x = xport_connect("127.0.0.1", t.r->port, streams, chunk, depth);
+	if(x == NULL || xport_accept(t.r) != 0)
+	{
+		printf("cannot connect\n");
+		return 1;
+	}
+	//worst case of a checkpoint: everything raw
+	t.cap = size + (npages / CKPT_CHUNK_PAGES + 1) * 2 * sizeof(struct ckpt_record) +
+		npages * sizeof(struct ckpt_record) + sizeof(struct ckpt_header);
+	t.dest = map(t.cap);
+	t.npages = npages;
+
+	printf("image: %lu MiB, chunk: %lu KiB, %d streams, queue depth %d\n", size >> 20,
+			chunk >> 10, streams, depth);
+
+	for(i = 0; i < 2; ++i)
+	{
+		start_target(&t, &tid, 0);
+		if(xport_send(x, 0, image, size) != 0 || xport_end(x) != 0)
+			printf("raw transfer failed\n");
+		pthread_join(tid, NULL);
+		t_send = get_time() - t.start;
+		if(t.len != (long)size || memcmp(t.dest, image, size) != 0)
+		{
+			printf("raw: the target got something else\n");
+			return 1;
+		}
+		printf("raw %d:   %8lu us  %6.2f GB/s  first %lu us\n", i, t_send,
+				t_send ? (double)size / t_send / 1000 : 0, t.first);
+	}
+
+	//serial: each step waits for the previous one
+	b.buf = map(t.cap);
+	b.size = t.cap;
+	b.pos = 0;
+	rebuilt = map(size);
+	start = get_time();
+	len = ckpt_write(image, npages, ckpt_buf_sink, &b, NULL);
+	t_write = get_time() - start;
+	start_target(&t, &tid, 0);
+	if(len < 0 || xport_send(x, 0, b.buf, len) != 0 || xport_end(x) != 0)
+		printf("serial transfer failed\n");
+	pthread_join(tid, NULL);
+	t_send = get_time() - t.start;
+	b.buf = t.dest;
+	b.size = t.len;
+	b.pos = 0;
+	start = get_time();
+	if(ckpt_read(rebuilt, npages, ckpt_buf_source, &b, 1) != len || memcmp(rebuilt, image, size))
+	{
+		printf("serial: the rebuilt image differs\n");
+		return 1;
+	}
+	t_read = get_time() - start;
+	printf("serial:  %8lu us  (write %lu + send %lu + read %lu), %ld bytes\n",
+			t_write + t_send + t_read, t_write, t_send, t_read, len);
+
+	//piped
+	munmap(rebuilt, size);
+	rebuilt = map(size);
+	t.image = rebuilt;
+	start_target(&t, &tid, 1);
+	len = ckpt_write(image, npages, xport_sink, x, NULL);
+	if(len < 0 || xport_end(x) != 0)
+		printf("piped transfer failed\n");
+	pthread_join(tid, NULL);
+	t_send = get_time() - t.start;
+	if(t.read != len || t.len != len || memcmp(rebuilt, image, size) != 0)
+	{
+		printf("piped: the rebuilt image differs\n");
+		return 1;
+	}
+	printf("piped:   %8lu us  first %lu us, %lu frames\n", t_send, t.first, t.chunks);
+
+	xport_close(x);
+	xport_recv_close(t.r);
+	return 0;
+}
@@ -38,6 +38,16 @@ unsigned long *__tls_previous_stack(void)
 	return &(__tls_self()->_previous_stack);
 }
 
+unsigned long *__tls_safepoint(void)
+{
+	return (unsigned long*)((char*)__tls_self() + TLS_SAFEPOINT);
+}
+
+unsigned long *__tls_batch(void)
+{
+	return (unsigned long*)((char*)__tls_self() + TLS_BATCH);
+}
+
 pthread_t pthread_self(void)
 {
 	return (pthread_t)__tls_self()->_pthread_id;
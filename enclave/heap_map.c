@@ -0,0 +1,184 @@
+#include "string.h"
+#include "heap_map.h"
+
+#define PS 0x1000
+
+/*
+ * Dead ranges (holes) of the brk heap, as reported by musl malloc:
+ * free() reclaims the middle of a large free chunk, and a chunk taken out
+ * of a bin may be written again. Everything in [heap_start, __brk) that is
+ * not a hole is live.
+ *
+ * Forgetting a hole is always safe (the range is just copied), so a full
+ * table drops holes instead of failing.
+ */
+
+struct hole {
+	unsigned long start;
+	unsigned long end;
+};
+
+static struct hole holes[MAX_HEAP_HOLES];
+static volatile int hole_num = 0;
+static volatile int hole_lock = 0;
+//bounds of all the holes: fast path for __heap_reuse
+static unsigned long hole_lo = -1UL, hole_hi = 0;
+
+static inline void lock_holes()
+{
+	while(__sync_lock_test_and_set(&hole_lock, 1))
+	{
+		while(hole_lock)
+			__asm__ __volatile__("pause");
+	}
+}
+
+static inline void unlock_holes()
+{
+	__sync_lock_release(&hole_lock);
+}
+
+static void del_hole(int i)
+{
+	holes[i] = holes[hole_num - 1];
+	hole_num -= 1;
+}
+
+void __heap_reclaim(void *p, size_t len)
+{
+	unsigned long start = (unsigned long)p;
+	unsigned long end = start + len;
+	int i;
+
+	if(len < PS)
+		return;
+
+	lock_holes();
+
+	for(i = 0; i < hole_num; ++i)
+	{
+		//merge with a neighbour
+		if(holes[i].end == start || holes[i].start == end)
+		{
+			if(holes[i].start < start)
+				start = holes[i].start;
+			if(holes[i].end > end)
+				end = holes[i].end;
+			del_hole(i);
+			break;
+		}
+	}
+
+	if(hole_num < MAX_HEAP_HOLES)
+	{
+		holes[hole_num].start = start;
+		holes[hole_num].end = end;
+		hole_num += 1;
+		if(start < hole_lo)
+			hole_lo = start;
+		if(end > hole_hi)
+			hole_hi = end;
+	}
+
+	unlock_holes();
+}
+
+void __heap_reuse(void *p, size_t len)
+{
+	unsigned long start = (unsigned long)p;
+	unsigned long end = start + len;
+	int i;
+
+	if(hole_num == 0 || end <= hole_lo || start >= hole_hi)
+		return;
+
+	lock_holes();
+
+	for(i = 0; i < hole_num; ++i)
+	{
+		if(end <= holes[i].start || start >= holes[i].end)
+			continue;
+
+		if(start <= holes[i].start && end >= holes[i].end)
+		{
+			del_hole(i--);
+			continue;
+		}
+
+		if(start <= holes[i].start)
+			holes[i].start = (end + PS - 1) & ~(PS - 1UL);
+		else if(end >= holes[i].end)
+			holes[i].end = start & ~(PS - 1UL);
+		else if(hole_num < MAX_HEAP_HOLES)
+		{
+			//split
+			holes[hole_num].start = (end + PS - 1) & ~(PS - 1UL);
+			holes[hole_num].end = holes[i].end;
+			if(holes[hole_num].start < holes[hole_num].end)
+				hole_num += 1;
+			holes[i].end = start & ~(PS - 1UL);
+		}
+		else if(start - holes[i].start > holes[i].end - end)
+			holes[i].end = start & ~(PS - 1UL); //no room: keep the larger part
+		else
+			holes[i].start = (end + PS - 1) & ~(PS - 1UL);
+
+		if(holes[i].start >= holes[i].end)
+			del_hole(i--);
+	}
+
+	if(hole_num == 0)
+	{
+		hole_lo = -1UL;
+		hole_hi = 0;
+	}
+
+	unlock_holes();
+}
+
+//all the app threads are stopped
+int heap_extents(unsigned long start, unsigned long end, unsigned long base,
+		struct dump_extent *ext, int max)
+{
+	struct hole sorted[MAX_HEAP_HOLES];
+	struct hole h;
+	unsigned long cur;
+	int n, i, j, cnt;
+
+	//a thread was stopped while updating the table: do not trust it
+	if(hole_lock)
+		n = 0;
+	else
+		n = hole_num;
+	memcpy(sorted, holes, n * sizeof(struct hole));
+
+	for(i = 1; i < n; ++i)
+	{
+		h = sorted[i];
+		for(j = i; j > 0 && sorted[j-1].start > h.start; --j)
+			sorted[j] = sorted[j-1];
+		sorted[j] = h;
+	}
+
+	cnt = 0;
+	cur = start;
+	for(i = 0; i < n && cnt < max - 1; ++i)
+	{
+		if(sorted[i].end <= cur || sorted[i].start >= end)
+			continue;
+		if(sorted[i].start > cur)
+		{
+			ext[cnt].offset = cur - base;
+			ext[cnt].len = sorted[i].start - cur;
+			cnt += 1;
+		}
+		cur = sorted[i].end;
+	}
+	if(cur < end)
+	{
+		ext[cnt].offset = cur - base;
+		ext[cnt].len = end - cur;
+		cnt += 1;
+	}
+	return cnt;
+}
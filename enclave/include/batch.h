@@ -0,0 +1,34 @@
+#ifndef __BATCH_H_
+#define __BATCH_H_
+
+/*
+ * Batched syscalls: between sgx_batch_begin() and sgx_batch_end() a thread
+ * queues epoll_ctl, close, write and writev in the enclave with
+ * sgx_batch_add() (its TLS word at TLS_BATCH points to the queue). A queued
+ * call has no result until it ran: sgx_batch_flush(), sgx_batch_end() or any
+ * other syscall of the thread run the queue in order with one SGXBATCH ocall;
+ * then sgx_batch_result() gives what each call of that run returned, and
+ * sgx_batch_end() counts the queued calls that failed. libc's own epoll_ctl,
+ * close and writev are made at once, with their real result.
+ *
+ * The ocall stages BATCH_MAX sgx_batch_call at +0x1000 of the outside buffer
+ * and their data right after; ptr[1] is the count, ptr[2] the first call.
+ * A queued writev is the write of its gathered bytes.
+ */
+#define BATCH_MAX 32
+#define BATCH_DATA 0x8000
+
+struct sgx_batch_call {
+	long n;
+	long args[6];
+	long ret; //-errno on failure
+};
+
+//enclave: ocall_syscall_wrapper.c
+int sgx_batch_begin();
+long sgx_batch_add(long n, long a1, long a2, long a3, long a4);
+int sgx_batch_flush();
+int sgx_batch_end();
+long sgx_batch_result(int i, int *err);
+
+#endif
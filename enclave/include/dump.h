@@ -0,0 +1,115 @@
+#ifndef __DUMP_H_
+#define __DUMP_H_
+
+//the dump is cut into pieces, handed out to the workers round-robin
+#define DUMP_PIECE_SIZE 0x400000
+#define MAX_DUMP_WORKERS 8
+#define MAX_DUMP_EXTENTS 512
+
+/*
+ * Sealing: every extent is cut into SEAL_CHUNK pieces from its start, each
+ * one encrypted in place with AES-128-GCM. The IV is the migration seq
+ * followed by the offset of the chunk; its tag goes to tags[offset / 4K].
+ */
+#define SEAL_CHUNK 0x10000
+#define SEAL_KEY_LEN 16
+#define SEAL_MAC_KEY_LEN 32
+#define SEAL_IV_LEN 12
+#define SEAL_TAG_LEN 16
+#define SEAL_TAG_SLOT 0x1000
+
+static inline void seal_iv(unsigned char *iv, unsigned seq, unsigned long offset)
+{
+	int i;
+
+	for(i = 0; i < 4; ++i)
+		iv[i] = (unsigned char)(seq >> (8 * i));
+	for(i = 0; i < 8; ++i)
+		iv[4 + i] = (unsigned char)(offset >> (8 * i));
+}
+
+/*
+ * Merkle index of the dump, over the same chunks as the seal:
+ *   leaf  = SHA-256(0x00 | offset | len | plaintext), offset and len 8 bytes LE
+ *   node  = SHA-256(0x01 | left | right)
+ * The leaves of a DUMP_PIECE_SIZE piece are folded into a piece root, and the
+ * piece roots, in dump order, into the root. A fold pairs neighbours level by
+ * level; an odd last node moves up unchanged.
+ *   root_mac = HMAC-SHA256(MAC key, seq, 4 bytes LE | root)
+ * The piece roots are kept in the enclave: with merkle on, a dump of more than
+ * MAX_MERKLE_PIECES pieces fails (DUMP_TOO_BIG) unless the host leaves the
+ * tree out (MIGRATE_MERKLE=0).
+ *
+ * Keys: drawn with RDRAND in the enclave for every dump, on the stack of
+ * worker 0 (the migration TCS, not dumped); never handed in by the host and
+ * never out in the clear. Worker 0 wraps them, seal key (SEAL_KEY_LEN) | MAC
+ * key (SEAL_MAC_KEY_LEN), into wrap: AES-GCM under the SGX seal key of the
+ * enclave for a fresh keyid (EGETKEY, MRENCLAVE policy), IV seq | ~0. Only
+ * the enclave opens the dump again (DUMP_OPEN: root_mac, every tag and every
+ * leaf are checked, the chunks decrypted in place), before the native app is
+ * rebuilt from it. Outside SGX (native) there is no EGETKEY, and nothing is
+ * hidden from the host: the wrap key is drawn once and kept in the enclave.
+ */
+#define MERKLE_HASH_LEN 32
+#define MAX_MERKLE_PIECES 2048
+
+#define SEAL_KEYID_LEN 32
+struct seal_wrap {
+	unsigned char keyid[SEAL_KEYID_LEN];
+	unsigned char keys[SEAL_KEY_LEN + SEAL_MAC_KEY_LEN];
+	unsigned char tag[SEAL_TAG_LEN];
+};
+
+//dump_desc.op
+#define DUMP_SEAL 0 //the image into out: sealed, hashed or copied
+#define DUMP_OPEN 1 //out, sealed by DUMP_SEAL: checked and decrypted in place
+
+//dump_desc.failed
+#define DUMP_NO_KEYS 1 //no RDRAND or no seal key: the keys cannot be drawn or wrapped
+#define DUMP_TOO_BIG 2 //more than MAX_MERKLE_PIECES pieces, with merkle on
+#define DUMP_CORRUPT 3 //DUMP_OPEN: the keys, a tag, a leaf or the root did not verify
+
+//a live range of the image, offset from the enclave start
+struct dump_extent {
+	unsigned long offset;
+	unsigned long len;
+};
+
+//one per dump worker; worker 0 runs on the migration TCS
+struct dump_desc {
+	char *out;
+	unsigned long code_size;
+	unsigned long data_size;
+	int worker;
+	int nworkers;
+	//app threads: etid from nthreads up are the workers, their stacks are not dumped
+	int nthreads;
+	//filled by worker 0: only these ranges of out are valid
+	struct dump_extent *extents;
+	int nextents;
+	int op;
+	//not in SGX (user --native): no EGETKEY
+	int native;
+	//seal: out is ciphertext, one tag per chunk
+	int seal;
+	unsigned seq;
+	unsigned char *tags;
+	//worker 0: the keys, wrapped by DUMP_SEAL and opened by DUMP_OPEN
+	struct seal_wrap *wrap;
+	//TSC cycles of this worker in seal_chunk (DUMP_SEAL) or seal_open
+	//(DUMP_OPEN), if timed: RDTSC needs SGX2 in an enclave
+	int timed;
+	unsigned long seal_cycles;
+	//0, or why the pass failed
+	int failed;
+	//merkle: one hash per chunk into leaves; worker 0 writes root and root_mac,
+	//and DUMP_OPEN checks all three against the opened chunks
+	unsigned char *leaves;
+	unsigned char *root;
+	unsigned char *root_mac;
+	//workers done, counted outside: a counter in the enclave is dumped mid-count
+	volatile int *done;
+	int sha_ni;
+};
+
+#endif
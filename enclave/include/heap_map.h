@@ -0,0 +1,17 @@
+#ifndef __HEAP_MAP_H_
+#define __HEAP_MAP_H_
+
+#include "stddef.h"
+#include "dump.h"
+
+#define MAX_HEAP_HOLES 256
+
+//called by musl malloc (weak no-ops in libc)
+void __heap_reclaim(void *p, size_t len);
+void __heap_reuse(void *p, size_t len);
+
+//live ranges of [start, end) as extents (offset from base); return the count
+int heap_extents(unsigned long start, unsigned long end, unsigned long base,
+		struct dump_extent *ext, int max);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __MARSHAL_H_
+#define __MARSHAL_H_
+
+/*
+ * How the ocalls copy the buffers of a syscall through the outside buffer:
+ * one sc_desc per syscall number, generated into syscall_desc.h from
+ * lib/syscall.table and lib/syscall.annot (see lib/gen_syscall_desc.awk).
+ * A syscall without a desc (known == 0) keeps its code in
+ * ocall_syscall_wrapper.c.
+ */
+
+//staging room after the header page: COM_BUFFER_SIZE (include/vars.h) - 0x1000
+#define SC_STAGE_MAX (0x1000 * 4095)
+#define SC_MAX_BUFS 3
+
+//sc_buf.dir
+#define SC_IN 1
+#define SC_OUT 2
+#define SC_INOUT 3
+#define SC_STR 4 //in, up to its '\0'
+
+//sc_buf.count_kind
+#define SC_CONST 0 //count
+#define SC_ARG 1 //the value of argument count_arg
+#define SC_DEREF 2 //the socklen_t argument count_arg points to (value-result)
+
+//sc_buf.flags
+#define SC_RET 1 //copy out min(count, ret) elements
+#define SC_ALWAYS 2 //copy out even when the syscall fails
+#define SC_CLAMP 4 //too big for the staging room: shorten count_arg (a short read/write)
+
+//sc_desc.flags
+#define SC_ERRNO 1 //libc takes the result as is: -1 and errno on failure
+
+struct sc_buf {
+	unsigned char arg; //1-6
+	unsigned char dir;
+	unsigned char count_kind;
+	unsigned char count_arg;
+	unsigned short flags;
+	unsigned short unit; //bytes of an element
+	long count;
+};
+
+struct sc_desc {
+	unsigned char known;
+	unsigned char flags;
+	unsigned char nbuf;
+	struct sc_buf buf[SC_MAX_BUFS];
+};
+
+#endif
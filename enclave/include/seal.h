@@ -0,0 +1,27 @@
+#ifndef __SEAL_H_
+#define __SEAL_H_
+
+#include <wmmintrin.h>
+#include "dump.h"
+
+struct seal_ctx {
+	__m128i rk[11]; //AES-128 round keys
+	__m128i h[4]; //H^1..H^4, byte-reversed
+};
+
+//len random bytes from RDRAND; -1 if it keeps failing
+int seal_keygen(unsigned char *key, unsigned long len);
+void seal_init(struct seal_ctx *ctx, const unsigned char *key);
+void seal_clear(struct seal_ctx *ctx);
+//zero len bytes, not optimized away
+void seal_wipe(void *buf, unsigned long len);
+//AES-128-GCM without AAD; dst may be src
+void seal_chunk(const struct seal_ctx *ctx, char *dst, const char *src, unsigned long len,
+		const unsigned char *iv, unsigned char *tag);
+//0, or -1 if tag does not verify (dst untouched); dst may be src
+int seal_open(const struct seal_ctx *ctx, char *dst, const char *src, unsigned long len,
+		const unsigned char *iv, const unsigned char *tag);
+//the SGX seal key of this enclave for keyid (EGETKEY); -1 outside SGX or on error
+int seal_derive_key(const unsigned char *keyid, unsigned char *key);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __SHA256_H_
+#define __SHA256_H_
+
+#define SHA256_LEN 32
+
+struct sha256_ctx {
+	unsigned int state[8];
+	unsigned long len;
+	unsigned char buf[64];
+	unsigned long fill;
+};
+
+//set by the host (cpuid faults in the enclave)
+extern int sha256_use_ni;
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, unsigned long len);
+void sha256_final(struct sha256_ctx *ctx, unsigned char *out);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __SWITCHLESS_H_
+#define __SWITCHLESS_H_
+
+/*
+ * Switchless ocalls: instead of EEXIT + EENTER, an enclave thread posts its
+ * syscall to a ring in untrusted memory and spins; host workers run it.
+ *
+ * The ring sits at SL_RING_ADDR in every process (a restored snapshot too),
+ * so the enclave needs no pointer to it. The request is the sl_req at
+ * SL_REQ_OFFSET of the outside buffer of the thread: the header words of an
+ * ocall stay free for the ocall that falls back or waits.
+ *
+ * The ring is a bounded MPMC queue (Vyukov): cell seq == pos is free for the
+ * producer of pos, seq == pos + 1 holds its request.
+ */
+#define SL_RING_ADDR 0x610000000000UL
+#define SL_RING_SIZE 256 //a power of 2
+#define SL_MAX_WORKERS 16
+#define SL_REQ_OFFSET 0x800
+
+//sl_req.state
+#define SL_POSTED 0
+#define SL_DONE 1
+#define SL_SLEEP 2 //the enclave thread waits on state (futex)
+#define SL_CANCEL 3 //not taken in time: the enclave thread made the ocall
+#define SL_TAKEN 4
+
+struct sl_req {
+	long type; //SYSCALLn
+	long n;
+	long args[6];
+	long ret;
+	volatile int state;
+};
+
+struct sl_cell {
+	volatile unsigned long seq;
+	unsigned long req;
+};
+
+struct sl_ring {
+	volatile unsigned long head; //workers
+	char pad0[56];
+	volatile unsigned long tail; //enclave threads
+	char pad1[56];
+	int nworkers; //0: off, every call is an ocall
+	volatile int awake; //workers polling; 0: they sleep, take the ocall
+	volatile int doorbell; //futex of the sleeping workers
+	char pad2[52];
+	struct sl_cell cells[SL_RING_SIZE];
+};
+
+static inline void sl_ring_init(struct sl_ring *r)
+{
+	unsigned long i;
+
+	r->head = 0;
+	r->tail = 0;
+	for(i = 0; i < SL_RING_SIZE; ++i)
+		r->cells[i].seq = i;
+}
+
+//0, or -1 when full
+static inline int sl_push(struct sl_ring *r, unsigned long req)
+{
+	struct sl_cell *c;
+	unsigned long pos = r->tail;
+	long dif;
+
+	while(1)
+	{
+		c = &r->cells[pos & (SL_RING_SIZE - 1)];
+		dif = (long)(c->seq - pos);
+		if(dif == 0)
+		{
+			if(__sync_bool_compare_and_swap(&r->tail, pos, pos + 1))
+				break;
+			pos = r->tail;
+		}
+		else if(dif < 0)
+			return -1;
+		else
+			pos = r->tail;
+	}
+	c->req = req;
+	__sync_synchronize();
+	c->seq = pos + 1;
+	return 0;
+}
+
+//the request, or 0 when empty
+static inline unsigned long sl_pop(struct sl_ring *r)
+{
+	struct sl_cell *c;
+	unsigned long pos = r->head, req;
+	long dif;
+
+	while(1)
+	{
+		c = &r->cells[pos & (SL_RING_SIZE - 1)];
+		dif = (long)(c->seq - (pos + 1));
+		if(dif == 0)
+		{
+			if(__sync_bool_compare_and_swap(&r->head, pos, pos + 1))
+				break;
+			pos = r->head;
+		}
+		else if(dif < 0)
+			return 0;
+		else
+			pos = r->head;
+	}
+	req = c->req;
+	__sync_synchronize();
+	c->seq = pos + SL_RING_SIZE;
+	return req;
+}
+
+//host: sdk/switchless.c
+void sl_init();
+void sl_kick();
+
+#endif
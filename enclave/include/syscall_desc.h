@@ -0,0 +1,60 @@
+//generated by lib/gen_syscall_desc.awk from lib/syscall.table and lib/syscall.annot:
+//edit those and rebuild
+#ifndef __SYSCALL_DESC_H_
+#define __SYSCALL_DESC_H_
+
+#include "marshal.h"
+
+#define SC_NR 332
+
+static const struct sc_desc sc_desc[SC_NR] = {
+	[0] = {1, SC_ERRNO, 1, {{2, SC_OUT, SC_ARG, 3, SC_RET|SC_CLAMP, sizeof(char), 0}}}, //read
+	[1] = {1, SC_ERRNO, 1, {{2, SC_IN, SC_ARG, 3, SC_CLAMP, sizeof(char), 0}}}, //write
+	[2] = {1, 0, 1, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //open
+	[3] = {1, 0, 0, {}}, //close
+	[4] = {1, 0, 2, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}, {2, SC_OUT, SC_CONST, 0, 0, sizeof(struct stat), 1}}}, //stat
+	[5] = {1, 0, 1, {{2, SC_OUT, SC_CONST, 0, 0, sizeof(struct stat), 1}}}, //fstat
+	[6] = {1, 0, 2, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}, {2, SC_OUT, SC_CONST, 0, 0, sizeof(struct stat), 1}}}, //lstat
+	[8] = {1, 0, 0, {}}, //lseek
+	[17] = {1, 0, 1, {{2, SC_OUT, SC_ARG, 3, SC_RET|SC_CLAMP, sizeof(char), 0}}}, //pread64
+	[18] = {1, 0, 1, {{2, SC_IN, SC_ARG, 3, SC_CLAMP, sizeof(char), 0}}}, //pwrite64
+	[21] = {1, 0, 1, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //access
+	[22] = {1, 0, 1, {{1, SC_OUT, SC_CONST, 0, 0, sizeof(int), 2}}}, //pipe
+	[24] = {1, 0, 0, {}}, //sched_yield
+	[35] = {1, 0, 2, {{1, SC_IN, SC_CONST, 0, 0, sizeof(struct timespec), 1}, {2, SC_OUT, SC_CONST, 0, SC_ALWAYS, sizeof(struct timespec), 1}}}, //nanosleep
+	[39] = {1, 0, 0, {}}, //getpid
+	[41] = {1, 0, 0, {}}, //socket
+	[42] = {1, 0, 1, {{2, SC_IN, SC_ARG, 3, 0, sizeof(char), 0}}}, //connect
+	[43] = {1, SC_ERRNO, 2, {{2, SC_OUT, SC_DEREF, 3, 0, sizeof(char), 0}, {3, SC_INOUT, SC_CONST, 0, 0, sizeof(socklen_t), 1}}}, //accept
+	[44] = {1, 0, 2, {{2, SC_IN, SC_ARG, 3, SC_CLAMP, sizeof(char), 0}, {5, SC_IN, SC_ARG, 6, 0, sizeof(char), 0}}}, //sendto
+	[45] = {1, 0, 3, {{2, SC_OUT, SC_ARG, 3, SC_RET|SC_CLAMP, sizeof(char), 0}, {5, SC_OUT, SC_DEREF, 6, 0, sizeof(char), 0}, {6, SC_INOUT, SC_CONST, 0, 0, sizeof(socklen_t), 1}}}, //recvfrom
+	[48] = {1, 0, 0, {}}, //shutdown
+	[49] = {1, 0, 1, {{2, SC_IN, SC_ARG, 3, 0, sizeof(char), 0}}}, //bind
+	[50] = {1, 0, 0, {}}, //listen
+	[51] = {1, 0, 2, {{2, SC_OUT, SC_DEREF, 3, 0, sizeof(char), 0}, {3, SC_INOUT, SC_CONST, 0, 0, sizeof(socklen_t), 1}}}, //getsockname
+	[52] = {1, 0, 2, {{2, SC_OUT, SC_DEREF, 3, 0, sizeof(char), 0}, {3, SC_INOUT, SC_CONST, 0, 0, sizeof(socklen_t), 1}}}, //getpeername
+	[53] = {1, 0, 1, {{4, SC_OUT, SC_CONST, 0, 0, sizeof(int), 2}}}, //socketpair
+	[54] = {1, 0, 1, {{4, SC_IN, SC_ARG, 5, 0, sizeof(char), 0}}}, //setsockopt
+	[55] = {1, 0, 2, {{4, SC_OUT, SC_DEREF, 5, 0, sizeof(char), 0}, {5, SC_INOUT, SC_CONST, 0, 0, sizeof(socklen_t), 1}}}, //getsockopt
+	[63] = {1, 0, 1, {{1, SC_OUT, SC_CONST, 0, 0, sizeof(struct utsname), 1}}}, //uname
+	[74] = {1, 0, 0, {}}, //fsync
+	[75] = {1, 0, 0, {}}, //fdatasync
+	[77] = {1, 0, 0, {}}, //ftruncate
+	[79] = {1, 0, 1, {{1, SC_OUT, SC_ARG, 2, SC_RET, sizeof(char), 0}}}, //getcwd
+	[82] = {1, 0, 2, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}, {2, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //rename
+	[83] = {1, 0, 1, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //mkdir
+	[84] = {1, 0, 1, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //rmdir
+	[87] = {1, 0, 1, {{1, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //unlink
+	[228] = {1, 0, 1, {{2, SC_OUT, SC_CONST, 0, 0, sizeof(struct timespec), 1}}}, //clock_gettime
+	[232] = {1, 0, 1, {{2, SC_OUT, SC_ARG, 3, SC_RET, sizeof(struct epoll_event), 0}}}, //epoll_wait
+	[233] = {1, 0, 1, {{4, SC_INOUT, SC_CONST, 0, 0, sizeof(struct epoll_event), 1}}}, //epoll_ctl
+	[257] = {1, 0, 1, {{2, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}}}, //openat
+	[262] = {1, 0, 2, {{2, SC_STR, SC_CONST, 0, 0, sizeof(char), 0}, {3, SC_OUT, SC_CONST, 0, 0, sizeof(struct stat), 1}}}, //newfstatat
+	[281] = {1, 0, 2, {{2, SC_OUT, SC_ARG, 3, SC_RET, sizeof(struct epoll_event), 0}, {5, SC_IN, SC_ARG, 6, 0, sizeof(char), 0}}}, //epoll_pwait
+	[288] = {1, 0, 2, {{2, SC_OUT, SC_DEREF, 3, 0, sizeof(char), 0}, {3, SC_INOUT, SC_CONST, 0, 0, sizeof(socklen_t), 1}}}, //accept4
+	[291] = {1, 0, 0, {}}, //epoll_create1
+	[293] = {1, 0, 1, {{1, SC_OUT, SC_CONST, 0, 0, sizeof(int), 2}}}, //pipe2
+	[302] = {1, 0, 2, {{3, SC_IN, SC_CONST, 0, 0, sizeof(struct rlimit), 1}, {4, SC_OUT, SC_CONST, 0, 0, sizeof(struct rlimit), 1}}}, //prlimit64
+};
+
+#endif
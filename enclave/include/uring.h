@@ -0,0 +1,107 @@
+#ifndef __URING_H_
+#define __URING_H_
+
+/*
+ * io_uring behind the ocalls: the host sets up one ring (sdk/uring.c) and
+ * describes it in the ur_desc at UR_ADDR, in every process, so the enclave
+ * needs no pointer to it. An enclave thread takes a slot, stages its data in
+ * the slot buffer, puts an SQE in the SQ itself and waits for the CQE of the
+ * slot (user_data). Whoever reaps the CQ copies each result into res/done of
+ * its slot: the mirror the threads poll. Only when its result is not there
+ * after a spin does a thread make an ocall: io_uring_enter, which submits
+ * the SQ (without SQPOLL) and waits for a completion.
+ *
+ * ok == 0 (no io_uring, or URING unset): every call is an ordinary ocall.
+ * gen changes with every ring: a slot of an older one (a migration or a
+ * restart in between) is not waited for.
+ */
+#define UR_ADDR 0x620000000000UL
+#define UR_SLOTS 64 //ops in flight
+#define UR_BUF 0x4000 //staging bytes of a slot: larger calls are plain ocalls
+#define UR_BUF_OFFSET 0x10000 //slot buffers after the descriptor
+#define UR_MAP_SIZE (UR_BUF_OFFSET + UR_SLOTS * UR_BUF)
+
+#define UR_SYS_SETUP 425
+#define UR_SYS_ENTER 426
+
+//linux/io_uring.h, for the enclave (its libc has none)
+#define UR_OP_FSYNC 3
+#define UR_OP_ACCEPT 13
+#define UR_OP_READ 22
+#define UR_OP_WRITE 23
+#define UR_OP_SEND 26
+#define UR_OP_RECV 27
+#define UR_ENTER_GETEVENTS 1
+#define UR_ENTER_SQ_WAKEUP 2
+#define UR_ENTER_EXT_ARG 8 //a timeout on the wait (Linux 5.11+, required)
+#define UR_SQ_NEED_WAKEUP 1
+
+struct ur_sqe {
+	unsigned char opcode;
+	unsigned char flags;
+	unsigned short ioprio;
+	int fd;
+	unsigned long off; //addr2 of accept: the addrlen
+	unsigned long addr;
+	unsigned len;
+	unsigned op_flags; //msg_flags, accept_flags, fsync_flags
+	unsigned long user_data;
+	unsigned long pad[3];
+};
+
+struct ur_cqe {
+	unsigned long user_data;
+	int res;
+	unsigned flags;
+};
+
+struct ur_getevents_arg {
+	unsigned long sigmask;
+	unsigned sigmask_sz;
+	unsigned pad;
+	unsigned long ts; //struct timespec*
+};
+
+struct ur_desc {
+	int ok;
+	int fd;
+	int sqpoll;
+	volatile unsigned gen;
+
+	volatile unsigned *sq_head;
+	volatile unsigned *sq_tail;
+	volatile unsigned *sq_flags;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	struct ur_sqe *sqes;
+
+	volatile unsigned *cq_head;
+	volatile unsigned *cq_tail;
+	unsigned cq_mask;
+	struct ur_cqe *cqes;
+
+	volatile int sq_lock;
+	volatile int cq_lock;
+	volatile int used[UR_SLOTS];
+	volatile int done[UR_SLOTS];
+	volatile long res[UR_SLOTS];
+};
+
+static inline char *ur_buf(int slot)
+{
+	return (char*)(UR_ADDR + UR_BUF_OFFSET + (unsigned long)slot * UR_BUF);
+}
+
+//host: sdk/uring.c
+void ur_init();
+
+//enclave: ocall_syscall_wrapper.c. read/write/pread64/pwrite64/recvfrom/
+//sendto (no address)/accept/fsync go through the ring by themselves; these
+//keep several in flight. A ticket, or -errno (-ENOSYS: no ring, -EAGAIN:
+//no free slot, -E2BIG: more than UR_BUF bytes); off -1: the file position.
+int sgx_uring_read(int fd, void *buf, unsigned long len, long off);
+int sgx_uring_write(int fd, const void *buf, unsigned long len, long off);
+//the result of the call (-errno on failure); read data is copied in here
+long sgx_uring_wait(int ticket);
+
+#endif
@@ -25,6 +25,13 @@ struct enclave_tls {
 	unsigned long _outside_fs;
 };
 
+//musl's struct pthread goes on from offset 72 (cancel, ...): the word past it
+//holds, natively only (0 in an enclave), the host word that sends syscalls back
+//to the ocalls. sdk/migrate.c writes it.
+#define TLS_SAFEPOINT 0x800
+//the syscall queue of sgx_batch_begin (batch.h), 0 when not batching
+#define TLS_BATCH 0x808
+
 
 //TLS varible definition
 
@@ -47,4 +54,10 @@ extern unsigned long *__tls_outside_buffer(void);
 extern unsigned long *__tls_previous_stack(void);
 #define previous_stack (*__tls_previous_stack())
 
+extern unsigned long *__tls_safepoint(void);
+#define safepoint (*__tls_safepoint())
+
+extern unsigned long *__tls_batch(void);
+#define batch_queue (*__tls_batch())
+
 #endif
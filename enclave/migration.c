@@ -1,5 +1,9 @@
 #include "stdio.h"
 #include "string.h"
+#include "dump.h"
+#include "heap_map.h"
+#include "seal.h"
+#include "sha256.h"
 //dump each section
 //code
 //data
@@ -20,200 +24,549 @@ unsigned long mheap_pages = 0;
 unsigned long mstack_pages = 0;
 unsigned long mthread_pages = 0;
 
+#define FIXED_STACK_SIZE 0x7d000
+//below the interrupted rsp
+#define RED_ZONE 128
+//per thread: TCS, SSA, TLS pages
+#define THREAD_PAGES 3
+#define GPRSGX_RSP (2 * PS - 184 + 4 * 8)
+#define TLS_PREVIOUS_STACK (2 * PS + 6 * 8)
+
+//used part of the stack of thread etid, from its saved stack pointers
+static int stack_extent(unsigned long thread_sec, int etid, struct dump_extent *ext)
+{
+	unsigned long top, bottom, sp, v;
+	unsigned long base = (unsigned long)&enclave_start;
+
+	top = (unsigned long)&init_stack_1 - etid * FIXED_STACK_SIZE;
+	bottom = top - FIXED_STACK_SIZE;
+
+	//AEX: rsp in the SSA; ocall: previous_stack in the TLS.
+	//One of them may be stale, so take the deeper one.
+	sp = top;
+	v = *(unsigned long*)(thread_sec + etid * THREAD_PAGES * PS + GPRSGX_RSP);
+	if(v > bottom && v < sp)
+		sp = v;
+	v = *(unsigned long*)(thread_sec + etid * THREAD_PAGES * PS + TLS_PREVIOUS_STACK);
+	if(v > bottom && v < sp)
+		sp = v;
+	if(sp == top)
+		return 0;
+
+	sp = (sp - RED_ZONE) & ~(PS - 1UL);
+	if(sp < bottom)
+		sp = bottom;
+	ext->offset = sp - base;
+	ext->len = top - sp;
+	return 1;
+}
+
+//live ranges of the image, in increasing order
+static int get_extents(struct dump_desc *desc, struct dump_extent *ext)
+{
+	unsigned long base = (unsigned long)&enclave_start;
+	unsigned long heap = base + PS * (mcode_pages + mdata_pages);
+	unsigned long stack = heap + PS * mheap_pages;
+	unsigned long thread_sec = stack + PS * mstack_pages;
+	int n = 0;
+
+	ext[n].offset = 0;
+	ext[n].len = PS * mcode_pages;
+	n += 1;
+	ext[n].offset = PS * mcode_pages;
+	ext[n].len = PS * mdata_pages;
+	n += 1;
+
 #define ENABLE_COPY_NECESSARY 1
 #if ENABLE_COPY_NECESSARY
-void dump_out(char *out)
+	{
+		unsigned long brk;
+		int etid, nstacks;
+
+		ext[0].len = desc->code_size;
+		ext[1].len = desc->data_size;
+
+		//heap: up to brk, without what malloc has given back
+		brk = (__brk + PS - 1) & ~(PS - 1UL);
+		if(brk > stack)
+			brk = stack;
+		if(brk > heap)
+			n += heap_extents(heap, brk, base, ext + n, MAX_DUMP_EXTENTS - n - 32);
+
+		//stacks: from the deepest saved stack pointer. Only those of the app
+		//threads: the workers run on theirs, so each worker would see others.
+		nstacks = mthread_pages / THREAD_PAGES;
+		if(nstacks > PS * mstack_pages / FIXED_STACK_SIZE)
+			nstacks = PS * mstack_pages / FIXED_STACK_SIZE;
+		if(nstacks > desc->nthreads)
+			nstacks = desc->nthreads;
+		//the stack of thread 0 is the highest one
+		for(etid = nstacks - 1; etid >= 0; --etid)
+			n += stack_extent(thread_sec, etid, ext + n);
+	}
+#else
+	ext[n].offset = heap - base;
+	ext[n].len = PS * mheap_pages;
+	n += 1;
+	ext[n].offset = stack - base;
+	ext[n].len = PS * mstack_pages;
+	n += 1;
+#endif
+
+	ext[n].offset = thread_sec - base;
+	ext[n].len = PS * mthread_pages;
+	n += 1;
+	return n;
+}
+
+//thread section: tcs page is zero page
+static void copy_thread_pages(char *target, char *addr, unsigned long offset, unsigned long len)
 {
-	char *addr;
-	char *target;
 	unsigned long i;
-	int j;
-	unsigned long offset;
-	int skip_tcs;
-	unsigned long enclave_start_addr;
 
-	unsigned long code_size;
-	unsigned long data_size;
-	unsigned long heap_size; 
-	unsigned long stack_size;
+	for(i = 0; i < len; i += PS)
+	{
+		if(((offset + i) / PS) % THREAD_PAGES != 0)
+			memcpy(target + i, addr + i, PS);
+		else
+			memset(target + i, 0, PS);
+	}
+}
 
-	enclave_start_addr = (unsigned long)&enclave_start;
+//merkle: piece roots of the running dump, folded by the last worker
+static unsigned char piece_roots[MAX_MERKLE_PIECES][MERKLE_HASH_LEN];
 
-	code_size = *(unsigned long*)out;
-	data_size = *(((unsigned long*)out)+1);
-	heap_size = *(((unsigned long*)out)+2) + __brk - __init_brk;
-	stack_size = 0x1fd000;
-	//stack_size = 0x4000;
-
-	//printf("[copy] code 0x%lx, data 0x%lx, heap 0x%lx, stack 0x%lx\n",
-	//		code_size, data_size, heap_size, stack_size);
-
-	//dump code section
-	addr = (char*)enclave_start_addr;
-	target = out;
-	memcpy(target, addr, code_size);
-	
-	//dump data section
-	offset = PS * mcode_pages;
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
-	memcpy(target, addr, data_size);
-
-	//dump heap section
-	offset = PS * (mcode_pages + mdata_pages);
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
-	if(heap_size > (mheap_pages*PS))
-		heap_size = mheap_pages*PS;
-	memcpy(target, addr, heap_size);
-
-#if 0
-	//TODO: multiple threads
-	//dump stack section
-	addr = ((char*)&init_stack_1) - stack_size;
-	offset = (unsigned long)addr - enclave_start_addr;
-	target = out + offset;
-	memcpy(target, addr, stack_size);
-#endif
+static void merkle_leaf(unsigned long offset, const char *data, unsigned long len,
+		unsigned char *out)
+{
+	struct sha256_ctx ctx;
+	unsigned char pre[17];
+	int i;
 
-	//dump stack section
-	offset = PS * (mcode_pages + mdata_pages + mheap_pages);
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
-	memcpy(target, addr, mstack_pages*PS);
+	pre[0] = 0;
+	for(i = 0; i < 8; ++i)
+	{
+		pre[1 + i] = (unsigned char)(offset >> (8 * i));
+		pre[9 + i] = (unsigned char)(len >> (8 * i));
+	}
+	sha256_init(&ctx);
+	sha256_update(&ctx, pre, sizeof(pre));
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, out);
+}
 
+//fold n hashes into h[0], in place
+static void merkle_fold(unsigned char (*h)[MERKLE_HASH_LEN], unsigned long n)
+{
+	struct sha256_ctx ctx;
+	unsigned char one = 1;
+	unsigned long j;
 
-	skip_tcs = 0;
-	//dump thread section
-	offset = PS * (mcode_pages + mdata_pages + mheap_pages + mstack_pages);
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
-	for(i = 0; i < mthread_pages; ++i)
+	for(; n > 1; n = (n + 1) / 2)
 	{
-		if(skip_tcs % 3 != 0)
+		for(j = 0; j < n; j += 2)
 		{
-			memcpy(target, addr, PS);
-			//for(j = 0; j < PS; ++j)
-			//	target[j] = addr[j];
+			if(j + 1 == n)
+			{
+				memcpy(h[j / 2], h[j], MERKLE_HASH_LEN);
+				break;
+			}
+			sha256_init(&ctx);
+			sha256_update(&ctx, &one, 1);
+			sha256_update(&ctx, h[j], 2 * MERKLE_HASH_LEN);
+			sha256_final(&ctx, h[j / 2]);
 		}
-		else
+	}
+}
+
+//HMAC-SHA256(key, seq | root), dump.h
+static void merkle_root_mac(const unsigned char *key, unsigned seq, const unsigned char *root,
+		unsigned char *mac)
+{
+	struct sha256_ctx ctx;
+	unsigned char pad[64], inner[SHA256_LEN], s[4];
+	int i;
+
+	for(i = 0; i < 4; ++i)
+		s[i] = (unsigned char)(seq >> (8 * i));
+	memset(pad, 0x36, sizeof(pad));
+	for(i = 0; i < SEAL_MAC_KEY_LEN; ++i)
+		pad[i] ^= key[i];
+	sha256_init(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, s, sizeof(s));
+	sha256_update(&ctx, root, MERKLE_HASH_LEN);
+	sha256_final(&ctx, inner);
+
+	for(i = 0; i < (int)sizeof(pad); ++i)
+		pad[i] ^= 0x36 ^ 0x5c;
+	sha256_init(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, inner, sizeof(inner));
+	sha256_final(&ctx, mac);
+	seal_wipe(pad, sizeof(pad));
+}
+
+//the keys of the running dump, on the stack of worker 0; the others wait for
+//keys_seq to be the seq of their dump. This page is dumped too: seq tells a
+//stale pointer apart
+static unsigned char *volatile dump_keys;
+static volatile unsigned dump_keys_seq;
+
+//worker 0 hands out keys (NULL: none) for the dump of seq; the others wait
+static const unsigned char* share_keys(struct dump_desc *desc, unsigned char *keys)
+{
+	if(desc->worker == 0)
+	{
+		dump_keys = keys;
+		__sync_synchronize();
+		dump_keys_seq = desc->seq;
+		return keys;
+	}
+	while(dump_keys_seq != desc->seq)
+		__builtin_ia32_pause();
+	return dump_keys;
+}
+
+//the last of the workers: worker 0 waits for the others to let go of its keys
+static int workers_done(struct dump_desc *desc)
+{
+	__sync_add_and_fetch(desc->done, 1);
+	if(desc->worker != 0)
+		return 0;
+	while(*desc->done != desc->nworkers)
+		__builtin_ia32_pause();
+	dump_keys_seq = 0;
+	return 1;
+}
+
+//PROFILE (desc->timed): RDTSC needs SGX2 in an enclave
+static inline unsigned long cycles(const struct dump_desc *desc)
+{
+	unsigned lo, hi;
+
+	if(!desc->timed)
+		return 0;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long)hi << 32) | lo;
+}
+
+//natively there is no EGETKEY, and nothing to hide from the host
+static unsigned char native_wrap_key[SEAL_KEY_LEN];
+static int native_wrap_ready = 0;
+
+static int wrap_key(const struct dump_desc *desc, const unsigned char *keyid, unsigned char *key)
+{
+	if(!desc->native)
+		return seal_derive_key(keyid, key);
+	if(!native_wrap_ready)
+	{
+		if(seal_keygen(native_wrap_key, SEAL_KEY_LEN) != 0)
+			return -1;
+		native_wrap_ready = 1;
+	}
+	memcpy(key, native_wrap_key, SEAL_KEY_LEN);
+	return 0;
+}
+
+//keys into desc->wrap (dump.h), or back out of it with open: 0 or -1
+static int wrap_keys(struct dump_desc *desc, unsigned char *keys, int open)
+{
+	struct seal_wrap w;
+	struct seal_ctx ctx;
+	unsigned char key[SEAL_KEY_LEN], iv[SEAL_IV_LEN];
+	int ret = 0;
+
+	//the host may change it under us: read it once
+	memcpy(&w, desc->wrap, sizeof(w));
+	if(!open && seal_keygen(w.keyid, SEAL_KEYID_LEN) != 0)
+		return -1;
+	if(wrap_key(desc, w.keyid, key) != 0)
+		return -1;
+	seal_init(&ctx, key);
+	seal_iv(iv, desc->seq, -1UL);
+	if(open)
+		ret = seal_open(&ctx, (char*)keys, (const char*)w.keys, sizeof(w.keys), iv, w.tag);
+	else
+	{
+		seal_chunk(&ctx, (char*)w.keys, (const char*)keys, sizeof(w.keys), iv, w.tag);
+		memcpy(desc->wrap, &w, sizeof(w));
+	}
+	seal_clear(&ctx);
+	seal_wipe(key, sizeof(key));
+	return ret;
+}
+
+//[offset, offset + len) of the image from src into dst, chunk by chunk:
+//hash the plaintext into leaf[], then encrypt or copy it
+static void dump_range(struct dump_desc *desc, struct seal_ctx *ctx, char *dst, const char *src,
+		unsigned long offset, unsigned long len, unsigned char (*leaf)[MERKLE_HASH_LEN])
+{
+	unsigned char iv[SEAL_IV_LEN];
+	unsigned long i, n, t;
+
+	for(i = 0; i < len; i += SEAL_CHUNK)
+	{
+		n = len - i < SEAL_CHUNK ? len - i : SEAL_CHUNK;
+		//before sealing: dst may be src
+		if(leaf != NULL)
+			merkle_leaf(offset + i, src + i, n, leaf[i / SEAL_CHUNK]);
+		if(desc->seal)
 		{
-			for(j = 0; j < PS; ++j)
-				target[j] = '\0';
+			t = cycles(desc);
+			seal_iv(iv, desc->seq, offset + i);
+			seal_chunk(ctx, dst + i, src + i, n, iv,
+					desc->tags + (offset + i) / SEAL_TAG_SLOT * SEAL_TAG_LEN);
+			desc->seal_cycles += cycles(desc) - t;
 		}
-		addr += PS;
-		target += PS;
-		skip_tcs += 1;
+		else if(dst != src)
+			memcpy(dst + i, src + i, n);
 	}
 }
-#else
-void dump_out(char *out)
+
+//pieces of the extents: one piece root each
+static unsigned long count_pieces(const struct dump_extent *ext, int n)
 {
-	char *addr;
-	char *target;
-	unsigned long i;
-	int j;
-	unsigned long offset;
-	int skip_tcs;
-	unsigned long enclave_start_addr;
+	unsigned long piece = 0;
+	int i;
 
-	enclave_start_addr = (unsigned long)&enclave_start;
-	//printf("[inside] out: addr 0x%lx\n", (unsigned long)out);
+	for(i = 0; i < n; ++i)
+		piece += (ext[i].len + DUMP_PIECE_SIZE - 1) / DUMP_PIECE_SIZE;
+	return piece;
+}
 
-	//dump code section
-	addr = (char*)enclave_start_addr;
-	target = out;
+//in constant time: a MAC or a root
+static int same_hash(const unsigned char *a, const unsigned char *b)
+{
+	unsigned char d = 0;
+	int i;
 
-	//printf("[inside] src: addr 0x%lx, dst: addr 0x%lx\n", (unsigned long)addr, 
-//(unsigned long)target);
-	//printf("[copy] code 0x%lx, data 0x%lx, heap 0x%lx, stack 0x%lx, thread 0x%lx\n",
-	//		mcode_pages, mdata_pages, mheap_pages, mstack_pages, mthread_pages);
+	for(i = 0; i < MERKLE_HASH_LEN; ++i)
+		d |= a[i] ^ b[i];
+	return d == 0;
+}
 
-	
-	memcpy(target, addr, mcode_pages*PS);
+//DUMP_OPEN: every nworkers-th piece of out, as DUMP_SEAL cut it
+static void dump_open(struct dump_desc *desc)
+{
+	struct dump_extent ext[MAX_DUMP_EXTENTS];
+	unsigned char leaf[DUMP_PIECE_SIZE / SEAL_CHUNK][MERKLE_HASH_LEN];
+	struct seal_ctx ctx;
+	unsigned char keys[SEAL_KEY_LEN + SEAL_MAC_KEY_LEN];
+	unsigned char root[MERKLE_HASH_LEN], mac[MERKLE_HASH_LEN];
+	unsigned char iv[SEAL_IV_LEN];
+	const unsigned char *k;
+	unsigned long piece, off, len, nleaves, i, c, t;
+	char *p;
+	int e, n, merkle, ok = 1;
 
-#if 0
-	for(i = 0; i < mcode_pages; ++i)
+	n = get_extents(desc, ext);
+	merkle = desc->leaves != NULL && desc->root != NULL && desc->root_mac != NULL;
+	if(merkle)
 	{
-		for(j = 0; j < PS; ++j)
-			target[j] = addr[j];
-		addr += PS;
-		target += PS;
+		sha256_use_ni = desc->sha_ni;
+		if(count_pieces(ext, n) > MAX_MERKLE_PIECES)
+			ok = 0;
 	}
-#endif
+	if(desc->worker == 0 && ok)
+	{
+		if(wrap_keys(desc, keys, 1) != 0)
+			ok = 0;
+		else if(merkle)
+		{
+			//the host may change it under us: read it once, the leaves
+			//fold into this one
+			memcpy(root, desc->root, MERKLE_HASH_LEN);
+			merkle_root_mac(keys + SEAL_KEY_LEN, desc->seq, root, mac);
+			ok = same_hash(mac, desc->root_mac);
+		}
+	}
+	k = share_keys(desc, ok ? keys : NULL);
+	if(k == NULL)
+		desc->failed = DUMP_CORRUPT;
+	else if(desc->seal)
+		seal_init(&ctx, k);
 
-	
-	//dump data section
-	offset = PS * mcode_pages;
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
+	piece = 0;
+	nleaves = 0;
+	for(e = 0; e < n && k != NULL; ++e)
+	{
+		for(off = 0; off < ext[e].len; off += DUMP_PIECE_SIZE, ++piece)
+		{
+			len = ext[e].len - off;
+			if(len > DUMP_PIECE_SIZE)
+				len = DUMP_PIECE_SIZE;
+			nleaves += (len + SEAL_CHUNK - 1) / SEAL_CHUNK;
 
-	memcpy(target, addr, mdata_pages*PS);
+			if(piece % desc->nworkers != desc->worker)
+				continue;
+			p = desc->out + ext[e].offset + off;
+			for(i = 0; i < len; i += SEAL_CHUNK)
+			{
+				c = len - i < SEAL_CHUNK ? len - i : SEAL_CHUNK;
+				if(desc->seal)
+				{
+					t = cycles(desc);
+					seal_iv(iv, desc->seq, ext[e].offset + off + i);
+					if(seal_open(&ctx, p + i, p + i, c, iv, desc->tags +
+								(ext[e].offset + off + i) / SEAL_TAG_SLOT * SEAL_TAG_LEN) != 0)
+						desc->failed = DUMP_CORRUPT;
+					desc->seal_cycles += cycles(desc) - t;
+				}
+				if(merkle)
+					merkle_leaf(ext[e].offset + off + i, p + i, c, leaf[i / SEAL_CHUNK]);
+			}
+
+			//the leaves handed out must be these, and fold into the root
+			if(merkle)
+			{
+				len = (len + SEAL_CHUNK - 1) / SEAL_CHUNK;
+				if(memcmp(desc->leaves + (nleaves - len) * MERKLE_HASH_LEN, leaf,
+							len * MERKLE_HASH_LEN) != 0)
+					desc->failed = DUMP_CORRUPT;
+				merkle_fold(leaf, len);
+				memcpy(piece_roots[piece], leaf[0], MERKLE_HASH_LEN);
+			}
+		}
+	}
 
-#if 0
-	for(i = 0; i < mdata_pages; ++i)
+	if(k != NULL && desc->seal)
+		seal_clear(&ctx);
+	if(!workers_done(desc))
+		return;
+	if(k != NULL && merkle)
 	{
-		for(j = 0; j < PS; ++j)
-			target[j] = addr[j];
-		addr += PS;
-		target += PS;
+		memset(mac, 0, MERKLE_HASH_LEN);
+		if(piece != 0)
+		{
+			merkle_fold(piece_roots, piece);
+			memcpy(mac, piece_roots[0], MERKLE_HASH_LEN);
+		}
+		if(!same_hash(mac, root))
+			desc->failed = DUMP_CORRUPT;
 	}
-#endif
+	seal_wipe(keys, sizeof(keys));
+}
 
-	//dump heap section
-	offset = PS * (mcode_pages + mdata_pages);
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
+//MIGRATE and MIGRATE_WORKER: copy every nworkers-th piece, starting at worker
+void dump_out(struct dump_desc *desc)
+{
+	struct dump_extent ext[MAX_DUMP_EXTENTS];
+	unsigned char leaf[DUMP_PIECE_SIZE / SEAL_CHUNK][MERKLE_HASH_LEN];
+	unsigned long enclave_start_addr;
+	unsigned long thread_off;
+	unsigned long piece, off, len, nleaves;
+	char *addr;
+	char *target;
+	struct seal_ctx ctx;
+	unsigned char keys[SEAL_KEY_LEN + SEAL_MAC_KEY_LEN];
+	unsigned char root[MERKLE_HASH_LEN];
+	int i, n, merkle, keyed;
 
-	memcpy(target, addr, mheap_pages*PS);
-#if 0
-	for(i = 0; i < mheap_pages; ++i)
+	if(desc->op == DUMP_OPEN)
 	{
-		for(j = 0; j < PS; ++j)
-			target[j] = addr[j];
-		addr += PS;
-		target += PS;
+		dump_open(desc);
+		return;
 	}
-#endif
+	enclave_start_addr = (unsigned long)&enclave_start;
+	thread_off = PS * (mcode_pages + mdata_pages + mheap_pages + mstack_pages);
 
-	//dump stack section
-	offset = PS * (mcode_pages + mdata_pages + mheap_pages);
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
+	//the app is stopped: every worker finds the same extents
+	n = get_extents(desc, ext);
+	if(desc->worker == 0 && desc->extents != NULL)
+	{
+		memcpy(desc->extents, ext, n * sizeof(struct dump_extent));
+		desc->nextents = n;
+	}
 
-	memcpy(target, addr, mstack_pages*PS);
+	merkle = desc->leaves != NULL && desc->root != NULL && desc->root_mac != NULL;
+	if(merkle)
+	{
+		sha256_use_ni = desc->sha_ni;
+		//no room for the piece roots: the host has to leave the tree out
+		if(count_pieces(ext, n) > MAX_MERKLE_PIECES)
+		{
+			desc->failed = DUMP_TOO_BIG;
+			merkle = 0;
+		}
+	}
 
-#if 0
-	for(i = 0; i < mstack_pages; ++i)
+	//the seal and root_mac need keys
+	keyed = desc->seal || merkle;
+	if(desc->worker == 0 && keyed && seal_keygen(keys, sizeof(keys)) != 0)
 	{
-		for(j = 0; j < PS; ++j)
-			target[j] = addr[j];
-		addr += PS;
-		target += PS;
+		desc->failed = DUMP_NO_KEYS;
+		keyed = 0;
 	}
-#endif
-	
-	skip_tcs = 0;
-	//dump thread section
-	offset = PS * (mcode_pages + mdata_pages + mheap_pages + mstack_pages);
-	addr = (char*)(enclave_start_addr + offset);
-	target = out + offset;
-	for(i = 0; i < mthread_pages; ++i)
-	{
-		if(skip_tcs % 3 != 0)
+	//the others learn it here: no keys, neither seal nor tree
+	if(share_keys(desc, keyed ? keys : NULL) == NULL)
+	{
+		desc->seal = 0;
+		merkle = 0;
+		keyed = 0;
+	}
+	if(desc->seal)
+		seal_init(&ctx, dump_keys);
+
+	//a piece is a multiple of SEAL_CHUNK: chunks never cross pieces
+	piece = 0;
+	nleaves = 0;
+	for(i = 0; i < n; ++i)
+	{
+		for(off = 0; off < ext[i].len; off += DUMP_PIECE_SIZE, ++piece)
 		{
-			memcpy(target, addr, PS);
-			//for(j = 0; j < PS; ++j)
-			//	target[j] = addr[j];
+			len = ext[i].len - off;
+			if(len > DUMP_PIECE_SIZE)
+				len = DUMP_PIECE_SIZE;
+			//leaves of the pieces before this one
+			nleaves += (len + SEAL_CHUNK - 1) / SEAL_CHUNK;
+
+			if(piece % desc->nworkers != desc->worker)
+				continue;
+
+			addr = (char*)(enclave_start_addr + ext[i].offset + off);
+			target = desc->out + ext[i].offset + off;
+			if(ext[i].offset >= thread_off)
+			{
+				copy_thread_pages(target, addr, ext[i].offset - thread_off + off, len);
+				addr = target;
+			}
+			if(desc->seal || merkle)
+				dump_range(desc, &ctx, target, addr, ext[i].offset + off, len,
+						merkle ? leaf : NULL); //copy, hash and encrypt in one pass
+			else if(addr != target)
+				memcpy(target, addr, len);
+
+			if(merkle)
+			{
+				len = (len + SEAL_CHUNK - 1) / SEAL_CHUNK;
+				memcpy(desc->leaves + (nleaves - len) * MERKLE_HASH_LEN, leaf,
+						len * MERKLE_HASH_LEN);
+				merkle_fold(leaf, len);
+				memcpy(piece_roots[piece], leaf[0], MERKLE_HASH_LEN);
+			}
 		}
-		else
+	}
+
+	if(desc->seal)
+		seal_clear(&ctx);
+
+	//the others are done with piece_roots and the keys
+	if(!workers_done(desc))
+		return;
+	if(merkle)
+	{
+		memset(root, 0, MERKLE_HASH_LEN);
+		if(piece != 0)
 		{
-			for(j = 0; j < PS; ++j)
-				target[j] = '\0';
+			merkle_fold(piece_roots, piece);
+			memcpy(root, piece_roots[0], MERKLE_HASH_LEN);
 		}
-		addr += PS;
-		target += PS;
-		skip_tcs += 1;
+		memcpy(desc->root, root, MERKLE_HASH_LEN);
+		merkle_root_mac(keys + SEAL_KEY_LEN, desc->seq, root, desc->root_mac);
 	}
+	//only the enclave can open them again, and check root_mac
+	if(keyed && wrap_keys(desc, keys, 0) != 0)
+		desc->failed = DUMP_NO_KEYS;
+	seal_wipe(keys, sizeof(keys));
 }
-#endif
@@ -22,9 +22,18 @@
 #include "sys/epoll.h"
 #include "fcntl.h"
 #include "sys/file.h"
+#include "sys/time.h"
+#include "limits.h"
+#include "sys/utsname.h"
+#include "stdlib.h"
 
 // $(pwd)/include
 #include "vars.h"
+#include "switchless.h"
+#include "batch.h"
+#include "uring.h"
+#include "syscall_desc.h"
+#include "function_table.h"
 
 unsigned long __brk = 0 ; //used in migration thread
 unsigned long __init_brk = 0; //used in migration thread
@@ -51,6 +60,920 @@ static void unlock()
 //declaration
 void ocall_syscall();
 
+//Native fast path: after a migrate-out (or user --native) the app runs in the
+//address space of the host, so a syscall needs neither the staging copies nor
+//the trip through outside_trampoline. The host hands each thread the address
+//of its safepoint word (TLS, 0 in an enclave) and sets the word while a
+//migration waits for the threads (and while pre-copy tracks writes): then the
+//ocall path is taken, where they park.
+//A thread in a direct syscall counts as running, so only the syscalls that do
+//not wait for an event go direct, and only on the app's own memory.
+//The int after the word counts the threads in a direct syscall: raised before
+//the word is read, so the host that sets the word and then sees 0 there knows
+//none is left (pre-copy write-protects the app: one would fail with EFAULT).
+#define DIRECT_SYSCALL 1
+#if DIRECT_SYSCALL
+static inline long direct_syscall(long n, long a1, long a2, long a3, long a4);
+
+static inline int in_app(long addr, unsigned long len)
+{
+	unsigned long a = (unsigned long)addr;
+	unsigned long end = (unsigned long)&enclave_end;
+
+	return (a >= (unsigned long)&enclave_start) && (a <= end) && (len <= end - a);
+}
+
+//A write to a pipe or socket waits for its reader, maybe forever: only
+//regular files and O_NONBLOCK fds are written directly. What an fd is gets
+//probed on its first write and kept until it is closed, dup'ed over or its
+//flags change.
+#define DIRECT_FDS 1024
+#define FD_UNKNOWN 0
+#define FD_DIRECT 1
+#define FD_OCALL 2
+static volatile char direct_fd[DIRECT_FDS];
+
+static int direct_write_fd(long fd)
+{
+	struct stat st;
+	long flags;
+	char kind;
+
+	if(fd < 0 || fd >= DIRECT_FDS)
+		return 0;
+	kind = direct_fd[fd];
+	if(kind == FD_UNKNOWN)
+	{
+		kind = FD_OCALL;
+		flags = direct_syscall(SYS_fcntl, fd, F_GETFL, 0, 0);
+		if(flags >= 0 && (flags & O_NONBLOCK))
+			kind = FD_DIRECT;
+		else if(flags >= 0 && direct_syscall(SYS_fstat, fd, (long)&st, 0, 0) == 0 &&
+				S_ISREG(st.st_mode))
+			kind = FD_DIRECT;
+		direct_fd[fd] = kind;
+	}
+	return kind == FD_DIRECT;
+}
+
+//before any other path, and for a close queued by sgx_batch_add
+static inline void direct_forget(long n, long a1, long a2)
+{
+	long fd = -1;
+
+	switch(n)
+	{
+		case SYS_close:
+			fd = a1;
+			break;
+		case SYS_dup2:
+		case SYS_dup3:
+			fd = a2;
+			break;
+		case SYS_fcntl:
+			if(a2 == F_SETFL)
+				fd = a1;
+			break;
+		case SYS_ioctl:
+			if(a2 == FIONBIO)
+				fd = a1;
+			break;
+#ifdef SYS_close_range
+		case SYS_close_range:
+			memset((char*)direct_fd, FD_UNKNOWN, DIRECT_FDS);
+			return;
+#endif
+		default:
+			return;
+	}
+	if(fd >= 0 && fd < DIRECT_FDS)
+		direct_fd[fd] = FD_UNKNOWN;
+}
+
+static int direct_args(long n, long a1, long a2, long a3)
+{
+	struct iovec *v;
+	long i;
+
+	switch(n)
+	{
+		case SYS_getpid:
+		case SYS_getppid:
+		case SYS_gettid:
+		case SYS_getuid:
+		case SYS_geteuid:
+		case SYS_getgid:
+		case SYS_getegid:
+		case SYS_sched_yield:
+		case SYS_lseek:
+			return 1;
+		case SYS_clock_gettime:
+			return in_app(a2, sizeof(struct timespec));
+		case SYS_gettimeofday:
+			return in_app(a1, sizeof(struct timeval)) && (a2 == 0);
+		case SYS_fstat:
+			return in_app(a2, sizeof(struct stat));
+		case SYS_pread64:
+			return in_app(a2, a3);
+		case SYS_write:
+		case SYS_pwrite64:
+			return in_app(a2, a3) && direct_write_fd(a1);
+		case SYS_writev:
+			if(a3 < 0 || a3 > IOV_MAX || !in_app(a2, a3 * sizeof(struct iovec)))
+				return 0;
+			if(!direct_write_fd(a1))
+				return 0;
+			v = (struct iovec*)a2;
+			for(i = 0; i < a3; ++i)
+			{
+				if(!in_app((long)v[i].iov_base, v[i].iov_len))
+					return 0;
+			}
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+//1: go direct, then direct_end(); direct_args probes fds directly too
+static inline int direct(long n, long a1, long a2, long a3)
+{
+	volatile int *sp = (volatile int*)safepoint;
+
+	if(sp == NULL)
+		return 0;
+	__sync_add_and_fetch(&sp[1], 1);
+	if(sp[0] == 0 && direct_args(n, a1, a2, a3))
+		return 1;
+	__sync_sub_and_fetch(&sp[1], 1);
+	return 0;
+}
+
+static inline long direct_end(long ret)
+{
+	__sync_sub_and_fetch((volatile int*)safepoint + 1, 1);
+	return ret;
+}
+
+static inline long direct_syscall(long n, long a1, long a2, long a3, long a4)
+{
+	unsigned long ret;
+	register long r10 __asm__("r10") = a4;
+
+	__asm__ __volatile__ ("syscall" : "=a"(ret) : "a"(n), "D"(a1), "S"(a2), "d"(a3), "r"(r10)
+			: "rcx", "r11", "memory");
+	return ret;
+}
+#endif
+
+//Switchless: the hot syscalls go to the host workers through the ring (see
+//switchless.h) while they are awake. A request no worker takes within
+//SL_SPIN pauses is cancelled and made an ocall; one that runs longer (e.g. a
+//blocking epoll_wait) is waited for with a futex ocall. Either way the thread
+//reaches an ocall, where a migration finds it.
+#define SWITCHLESS 1
+#if SWITCHLESS
+#define SL_SPIN 2000
+#define SL_FUTEX_WAIT 0
+
+static int sl_hot(long n)
+{
+	switch(n)
+	{
+		case SYS_read:
+		case SYS_write:
+		case SYS_readv:
+		case SYS_writev:
+		case SYS_pread64:
+		case SYS_pwrite64:
+		case SYS_recvfrom:
+		case SYS_sendto:
+		case SYS_recvmsg:
+		case SYS_sendmsg:
+		case SYS_epoll_wait:
+		case SYS_epoll_pwait:
+		case SYS_clock_gettime:
+		case SYS_gettimeofday:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void sl_ocall(long n)
+{
+	struct sl_ring *r = (struct sl_ring*)SL_RING_ADDR;
+	unsigned long *ptr = (unsigned long*)outside_buffer;
+	struct sl_req *req;
+	int i, spin;
+
+	if(r->awake == 0 || !sl_hot(n))
+	{
+		ocall_syscall();
+		return;
+	}
+
+	//the header stays for the fallback
+	req = (struct sl_req*)(outside_buffer + SL_REQ_OFFSET);
+	req->type = ptr[0];
+	req->n = ptr[1];
+	for(i = 0; i < 6; ++i)
+		req->args[i] = ptr[2 + i];
+	__sync_synchronize();
+	req->state = SL_POSTED;
+	//full: straight to the fallback
+	spin = (sl_push(r, (unsigned long)req) == 0) ? 0 : SL_SPIN;
+
+	while(req->state != SL_DONE)
+	{
+		if(spin < SL_SPIN)
+		{
+			spin += 1;
+			__asm__ __volatile__ ("pause" ::: "memory");
+			continue;
+		}
+		if(req->state == SL_POSTED &&
+				__sync_bool_compare_and_swap(&req->state, SL_POSTED, SL_CANCEL))
+		{
+			//a stale cell of it in the ring is skipped
+			ocall_syscall();
+			return;
+		}
+		if(req->state == SL_TAKEN)
+			__sync_bool_compare_and_swap(&req->state, SL_TAKEN, SL_SLEEP);
+		if(req->state == SL_SLEEP)
+		{
+			ptr[0] = SYSCALL4;
+			ptr[1] = SYS_futex;
+			ptr[2] = (unsigned long)&req->state;
+			ptr[3] = SL_FUTEX_WAIT;
+			ptr[4] = SL_SLEEP;
+			ptr[5] = 0;
+			ocall_syscall();
+		}
+	}
+	ptr[0] = req->ret;
+}
+#define do_ocall(n) sl_ocall(n)
+#else
+#define do_ocall(n) ocall_syscall()
+#endif
+
+//Copies through the outside buffer: memcpy for a few bytes, rep movsb (fast
+//strings) up to COPY_NT_MIN, non-temporal stores above it, where the copy
+//would only evict the caches (below it they were slower: 256 KiB-4 MiB
+//writev, 10 GB/s against 25). SSE2 stores: the enclave cannot count on the
+//AVX state.
+#define COPY_NT_MIN 0x800000 //half the outside buffer
+#define IOV_STAGE (SC_STAGE_MAX - sizeof(struct iovec)) //data of one coalesced iovec at +0x1000
+
+static void copy_nt(char *dst, const char *src, unsigned long len)
+{
+	unsigned long head = (-(unsigned long)dst) & 15;
+	unsigned long blocks;
+
+	len -= head;
+	asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) :: "memory");
+	blocks = len / 64;
+	len &= 63;
+	if(blocks != 0)
+		asm volatile(
+				"1:\n\t"
+				"movdqu (%1), %%xmm0\n\t"
+				"movdqu 16(%1), %%xmm1\n\t"
+				"movdqu 32(%1), %%xmm2\n\t"
+				"movdqu 48(%1), %%xmm3\n\t"
+				"movntdq %%xmm0, (%0)\n\t"
+				"movntdq %%xmm1, 16(%0)\n\t"
+				"movntdq %%xmm2, 32(%0)\n\t"
+				"movntdq %%xmm3, 48(%0)\n\t"
+				"add $64, %1\n\t"
+				"add $64, %0\n\t"
+				"dec %2\n\t"
+				"jnz 1b\n\t"
+				"sfence\n\t"
+				: "+r"(dst), "+r"(src), "+r"(blocks)
+				:: "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+	asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(len) :: "memory");
+}
+
+static void copy(void *dst, const void *src, unsigned long len)
+{
+	if(len < 256)
+		memcpy(dst, src, len);
+	else if(len < COPY_NT_MIN)
+		asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(len) :: "memory");
+	else
+		copy_nt(dst, src, len);
+}
+
+//bytes of v[0..cnt), at most max: what one coalesced iovec carries
+static long iov_total(const struct iovec *v, long cnt, long max)
+{
+	long i, len = 0;
+
+	for(i = 0; i < cnt && len < max; ++i)
+		len += (v[i].iov_len < max - len) ? v[i].iov_len : max - len;
+	return len;
+}
+
+//the first len bytes of v[0..cnt) into dst, one after another; non-temporal
+//by the size of the whole, for the host reads it once
+static void iov_gather(char *dst, const struct iovec *v, long cnt, long len)
+{
+	int nt = (len >= COPY_NT_MIN);
+	long i, k;
+
+	for(i = 0; i < cnt && len > 0; ++i)
+	{
+		k = (v[i].iov_len < len) ? v[i].iov_len : len;
+		if(nt && k >= 256)
+			copy_nt(dst, v[i].iov_base, k);
+		else
+			copy(dst, v[i].iov_base, k);
+		dst += k;
+		len -= k;
+	}
+}
+
+//len bytes of src over v[0..cnt)
+static void iov_scatter(const struct iovec *v, long cnt, const char *src, long len)
+{
+	long i, k;
+
+	for(i = 0; i < cnt && len > 0; ++i)
+	{
+		k = (v[i].iov_len < len) ? v[i].iov_len : len;
+		copy(v[i].iov_base, src, k);
+		src += k;
+		len -= k;
+	}
+}
+
+//Batching (batch.h): the queue is kept in the enclave, so a migration
+//between two ocalls takes it along; only the SGXBATCH ocall stages it outside.
+//Only sgx_batch_add queues: libc's callers act on the result of the call
+//(EEXIST, ENOENT, a short write), which a queued call does not have yet.
+#define SYSCALL_BATCH 1
+#if SYSCALL_BATCH
+struct batch {
+	int on;
+	int count; //queued
+	int done; //calls of the last run, their results in calls
+	int failed; //queued calls that failed since sgx_batch_begin
+	unsigned long used; //bytes of data
+	int data_arg[BATCH_MAX]; //the arg that is an offset in data, -1: none
+	struct sgx_batch_call calls[BATCH_MAX];
+	char data[BATCH_DATA];
+};
+
+static int batch_run(struct batch *b)
+{
+	unsigned long *ptr = (unsigned long*)outside_buffer;
+	struct sgx_batch_call *calls = (struct sgx_batch_call*)(outside_buffer + 0x1000);
+	char *data = (char*)(calls + BATCH_MAX);
+	int i, n = b->count;
+
+	if(n == 0)
+		return 0;
+	memcpy(data, b->data, b->used);
+	memcpy(calls, b->calls, sizeof(struct sgx_batch_call) * n);
+	for(i = 0; i < n; ++i)
+	{
+		if(b->data_arg[i] >= 0)
+			calls[i].args[b->data_arg[i]] += (long)data;
+	}
+
+	ptr[0] = SGXBATCH;
+	ptr[1] = n;
+	ptr[2] = (unsigned long)calls;
+	ocall_syscall();
+
+	for(i = 0; i < n; ++i)
+	{
+		b->calls[i].ret = calls[i].ret;
+		if(calls[i].ret < 0)
+			b->failed += 1;
+	}
+	b->done = n;
+	b->count = 0;
+	b->used = 0;
+	return n;
+}
+
+//bytes of data a call queues, -1 when it does not queue
+static long batch_len(long n, long a2, long a3, long a4)
+{
+	struct iovec *v = (struct iovec*)a2;
+	long i, len = 0;
+
+	switch(n)
+	{
+		case SYS_close:
+			return 0;
+		case SYS_epoll_ctl:
+			return (a4 != 0) ? sizeof(struct epoll_event) : 0;
+		case SYS_write:
+			return (a3 >= 0 && a3 <= BATCH_DATA) ? a3 : -1;
+		case SYS_writev:
+			if(a3 < 0 || a3 > IOV_MAX)
+				return -1;
+			for(i = 0; i < a3; ++i)
+			{
+				if(v[i].iov_len > BATCH_DATA - len)
+					return -1;
+				len += v[i].iov_len;
+			}
+			return len;
+		default:
+			return -1;
+	}
+}
+
+//the index of the call in the next run; -EINVAL: no queue, or a call that
+//does not queue; -EAGAIN: the queue is full, sgx_batch_flush() first
+long sgx_batch_add(long n, long a1, long a2, long a3, long a4)
+{
+	struct batch *b = (struct batch*)batch_queue;
+	struct sgx_batch_call *c;
+	long len;
+	char *p;
+
+	if(b == NULL || !b->on)
+		return -EINVAL;
+	len = batch_len(n, a2, a3, a4);
+	if(len < 0)
+		return -EINVAL;
+	if(b->count == BATCH_MAX || len > BATCH_DATA - b->used)
+		return -EAGAIN;
+#if DIRECT_SYSCALL
+	direct_forget(n, a1, a2);
+#endif
+
+	c = &b->calls[b->count];
+	c->n = n;
+	c->args[0] = a1;
+	c->args[1] = a2;
+	c->args[2] = a3;
+	c->args[3] = a4;
+	c->args[4] = 0;
+	c->args[5] = 0;
+	c->ret = 0;
+	b->data_arg[b->count] = -1;
+	p = b->data + b->used;
+
+	if(n == SYS_epoll_ctl && a4 != 0)
+	{
+		memcpy(p, (void*)a4, len);
+		c->args[3] = b->used;
+		b->data_arg[b->count] = 3;
+	}
+	if(n == SYS_write)
+	{
+		memcpy(p, (void*)a2, len);
+		c->args[1] = b->used;
+		b->data_arg[b->count] = 1;
+	}
+	if(n == SYS_writev) //the write of the gathered bytes
+	{
+		iov_gather(p, (struct iovec*)a2, a3, len);
+		c->n = SYS_write;
+		c->args[1] = b->used;
+		c->args[2] = len;
+		b->data_arg[b->count] = 1;
+	}
+
+	b->used = (b->used + len + 15) & ~15UL;
+	return b->count++;
+}
+
+//0, or -1 when the queue cannot be allocated
+int sgx_batch_begin()
+{
+	struct batch *b = (struct batch*)batch_queue;
+
+	if(b == NULL)
+	{
+		b = malloc(sizeof(struct batch));
+		if(b == NULL)
+			return -1;
+		b->count = 0;
+		b->done = 0;
+		b->used = 0;
+		b->on = 0;
+		batch_queue = (unsigned long)b;
+	}
+	b->failed = 0;
+	b->on = 1;
+	return 0;
+}
+
+//the calls run
+int sgx_batch_flush()
+{
+	struct batch *b = (struct batch*)batch_queue;
+
+	return (b == NULL) ? 0 : batch_run(b);
+}
+
+//stops queueing; the queued calls that failed since sgx_batch_begin
+int sgx_batch_end()
+{
+	struct batch *b = (struct batch*)batch_queue;
+
+	if(b == NULL)
+		return 0;
+	batch_run(b);
+	b->on = 0;
+	return b->failed;
+}
+
+//the result of call i of the last run, as the syscall returns it in libc
+//(-1 with *err = errno on failure)
+long sgx_batch_result(int i, int *err)
+{
+	struct batch *b = (struct batch*)batch_queue;
+	long ret;
+
+	*err = 0;
+	if(b == NULL || i < 0 || i >= b->done)
+	{
+		*err = EINVAL;
+		return -1;
+	}
+	ret = b->calls[i].ret;
+	if(ret < 0 && ret > -4096)
+	{
+		*err = -ret;
+		return -1;
+	}
+	return ret;
+}
+#endif
+
+//io_uring (uring.h): the thread puts its SQE in the SQ itself and polls the
+//mirror of the CQ. With SQPOLL a call whose result comes within UR_SPIN
+//pauses makes no ocall; without it one io_uring_enter ocall submits and
+//waits, for the SQEs of the other threads too.
+#define URING 1
+#if URING
+#define UR_SPIN 2000
+#define UR_WAIT_NS 10000000 //a CQE reaped by another thread does not wake us
+
+//what the thread of a slot copies back (in the enclave, owner only)
+static void *ur_dst[UR_SLOTS];
+static void *ur_dst2[UR_SLOTS];
+static unsigned ur_gen[UR_SLOTS];
+static int ur_op[UR_SLOTS];
+
+static void ur_enter(struct ur_desc *d, long submit, long wait, long flags)
+{
+	unsigned long *ptr = (unsigned long*)outside_buffer;
+	struct ur_getevents_arg *arg = (struct ur_getevents_arg*)(outside_buffer + 0x1000);
+	struct timespec *ts = (struct timespec*)(arg + 1);
+
+	ptr[0] = SYSCALL6;
+	ptr[1] = UR_SYS_ENTER;
+	ptr[2] = d->fd;
+	ptr[3] = submit;
+	ptr[4] = wait;
+	ptr[5] = flags;
+	ptr[6] = 0;
+	ptr[7] = 0;
+	if(flags & UR_ENTER_EXT_ARG)
+	{
+		ts->tv_sec = 0;
+		ts->tv_nsec = UR_WAIT_NS;
+		arg->sigmask = 0;
+		arg->sigmask_sz = 0;
+		arg->pad = 0;
+		arg->ts = (unsigned long)ts;
+		ptr[6] = (unsigned long)arg;
+		ptr[7] = sizeof(struct ur_getevents_arg);
+	}
+	ocall_syscall();
+}
+
+//the CQ into the mirror, by one thread at a time
+static void ur_reap(struct ur_desc *d)
+{
+	struct ur_cqe *c;
+	unsigned head;
+
+	if(*d->cq_head == *d->cq_tail || !__sync_bool_compare_and_swap(&d->cq_lock, 0, 1))
+		return;
+	head = *d->cq_head;
+	while(head != *d->cq_tail)
+	{
+		__sync_synchronize();
+		c = &d->cqes[head & d->cq_mask];
+		if(c->user_data < UR_SLOTS)
+		{
+			d->res[c->user_data] = c->res;
+			__sync_synchronize();
+			d->done[c->user_data] = 1;
+		}
+		head += 1;
+	}
+	__sync_synchronize();
+	*d->cq_head = head;
+	__sync_lock_release(&d->cq_lock);
+}
+
+//a slot with its SQE in the SQ, or -errno
+static int ur_start(int op, long fd, void *buf, unsigned long len, long off, unsigned flags, void *buf2)
+{
+	struct ur_desc *d = (struct ur_desc*)UR_ADDR;
+	struct ur_sqe *sqe;
+	unsigned tail, idx;
+	int slot;
+
+	if(!d->ok)
+		return -ENOSYS;
+	if(len > UR_BUF)
+		return -E2BIG;
+	for(slot = 0; slot < UR_SLOTS; ++slot)
+	{
+		if(d->used[slot] == 0 && __sync_bool_compare_and_swap(&d->used[slot], 0, 1))
+			break;
+	}
+	if(slot == UR_SLOTS)
+		return -EAGAIN;
+
+	ur_dst[slot] = buf;
+	ur_dst2[slot] = buf2;
+	ur_gen[slot] = d->gen;
+	ur_op[slot] = op;
+	d->done[slot] = 0;
+	if(op == UR_OP_WRITE || op == UR_OP_SEND)
+		memcpy(ur_buf(slot), buf, len);
+	//accept: the addrlen, then the address
+	if(op == UR_OP_ACCEPT && buf != NULL)
+	{
+		*(socklen_t*)ur_buf(slot) = *(socklen_t*)buf2;
+		len = 0;
+	}
+
+	while(!__sync_bool_compare_and_swap(&d->sq_lock, 0, 1))
+		__asm__ __volatile__ ("pause" ::: "memory");
+	tail = *d->sq_tail;
+	idx = tail & d->sq_mask;
+	sqe = &d->sqes[idx];
+	memset(sqe, 0, sizeof(struct ur_sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->off = off;
+	sqe->addr = (unsigned long)ur_buf(slot);
+	sqe->len = len;
+	sqe->op_flags = flags;
+	sqe->user_data = slot;
+	if(op == UR_OP_ACCEPT)
+	{
+		sqe->addr = (buf != NULL) ? (unsigned long)ur_buf(slot) + sizeof(socklen_t) : 0;
+		sqe->off = (buf != NULL) ? (unsigned long)ur_buf(slot) : 0;
+	}
+	d->sq_array[idx] = idx;
+	__sync_synchronize();
+	*d->sq_tail = tail + 1;
+	__sync_lock_release(&d->sq_lock);
+	return slot;
+}
+
+//the result of a slot, which is freed
+static long ur_finish(int slot)
+{
+	struct ur_desc *d = (struct ur_desc*)UR_ADDR;
+	int spin = 0, op = ur_op[slot];
+	long ret;
+
+	while(1)
+	{
+		//the ring went with a migration: the call may not have been made
+		if(d->gen != ur_gen[slot])
+			return -EINTR;
+		ur_reap(d);
+		if(d->done[slot])
+			break;
+		if(d->sqpoll && (*d->sq_flags & UR_SQ_NEED_WAKEUP))
+			ur_enter(d, 0, 0, UR_ENTER_SQ_WAKEUP);
+		if(d->sqpoll && spin < UR_SPIN)
+		{
+			spin += 1;
+			__asm__ __volatile__ ("pause" ::: "memory");
+			continue;
+		}
+		ur_enter(d, d->sqpoll ? 0 : UR_SLOTS, 1, UR_ENTER_GETEVENTS | UR_ENTER_EXT_ARG);
+	}
+
+	ret = d->res[slot];
+	if((op == UR_OP_READ || op == UR_OP_RECV) && ret > 0)
+		memcpy(ur_dst[slot], ur_buf(slot), ret);
+	if(op == UR_OP_ACCEPT && ret >= 0 && ur_dst[slot] != NULL)
+	{
+		memcpy(ur_dst[slot], ur_buf(slot) + sizeof(socklen_t),
+				*(socklen_t*)ur_buf(slot) < *(socklen_t*)ur_dst2[slot] ?
+				*(socklen_t*)ur_buf(slot) : *(socklen_t*)ur_dst2[slot]);
+		*(socklen_t*)ur_dst2[slot] = *(socklen_t*)ur_buf(slot);
+	}
+	__sync_lock_release(&d->used[slot]);
+	return ret;
+}
+
+//1: made through the ring, *ret is its result
+static int ur_call(long n, long a1, long a2, long a3, long a4, long a5, long *ret)
+{
+	int op, slot;
+	long off = -1;
+	unsigned flags = 0;
+
+	switch(n)
+	{
+		case SYS_read:
+			op = UR_OP_READ;
+			break;
+		case SYS_write:
+			op = UR_OP_WRITE;
+			break;
+		case SYS_pread64:
+			op = UR_OP_READ;
+			off = a4;
+			break;
+		case SYS_pwrite64:
+			op = UR_OP_WRITE;
+			off = a4;
+			break;
+		case SYS_recvfrom:
+			if(a5 != 0)
+				return 0;
+			op = UR_OP_RECV;
+			flags = a4;
+			off = 0;
+			break;
+		case SYS_sendto:
+			if(a5 != 0)
+				return 0;
+			op = UR_OP_SEND;
+			flags = a4;
+			off = 0;
+			break;
+		case SYS_accept:
+			op = UR_OP_ACCEPT;
+			if(a2 != 0 && (a3 == 0 || *(socklen_t*)a3 > UR_BUF - sizeof(socklen_t)))
+				return 0;
+			slot = ur_start(op, a1, (void*)a2, 0, 0, 0, (void*)a3);
+			goto started;
+		case SYS_fsync:
+			op = UR_OP_FSYNC;
+			off = 0;
+			break;
+		default:
+			return 0;
+	}
+	slot = ur_start(op, a1, (void*)a2, (n == SYS_fsync) ? 0 : a3, off, flags, NULL);
+started:
+	if(slot < 0)
+		return 0;
+	*ret = ur_finish(slot);
+	return 1;
+}
+
+int sgx_uring_read(int fd, void *buf, unsigned long len, long off)
+{
+	struct ur_desc *d = (struct ur_desc*)UR_ADDR;
+	int slot = ur_start(UR_OP_READ, fd, buf, len, off, 0, NULL);
+
+	if(slot >= 0 && !d->sqpoll)
+		ur_enter(d, UR_SLOTS, 0, 0);
+	return slot;
+}
+
+int sgx_uring_write(int fd, const void *buf, unsigned long len, long off)
+{
+	struct ur_desc *d = (struct ur_desc*)UR_ADDR;
+	int slot = ur_start(UR_OP_WRITE, fd, (void*)buf, len, off, 0, NULL);
+
+	if(slot >= 0 && !d->sqpoll)
+		ur_enter(d, UR_SLOTS, 0, 0);
+	return slot;
+}
+
+long sgx_uring_wait(int ticket)
+{
+	struct ur_desc *d = (struct ur_desc*)UR_ADDR;
+
+	if(ticket < 0 || ticket >= UR_SLOTS || !d->used[ticket])
+		return -EINVAL;
+	return ur_finish(ticket);
+}
+#endif
+
+//Table-driven marshaling (marshal.h): a syscall with a desc in
+//syscall_desc.h (generated from lib/syscall.annot) has its buffers staged at
+//+0x1000 of the outside buffer one after another, within SC_STAGE_MAX, and
+//copied back as the desc says. No chain of ifs for it below.
+#define SYSCALL_TABLE 1
+#if SYSCALL_TABLE
+static long sc_count(const struct sc_buf *b, unsigned long *args)
+{
+	socklen_t *len;
+
+	if(b->count_kind == SC_ARG)
+		return args[b->count_arg - 1];
+	if(b->count_kind == SC_DEREF)
+	{
+		len = (socklen_t*)args[b->count_arg - 1];
+		return (len != NULL) ? *len : 0;
+	}
+	return b->count;
+}
+
+//args go to the header as they are; a buffer argument is then replaced by
+//its staged copy, and a clamped count by the room left
+static long sc_call(long type, long n, long a1, long a2, long a3, long a4, long a5, long a6)
+{
+	const struct sc_desc *d = &sc_desc[n];
+	const struct sc_buf *b;
+	unsigned long *ptr = (unsigned long*)outside_buffer;
+	unsigned long *args = ptr + 2;
+	char *stage = (char*)outside_buffer + 0x1000;
+	void *user[SC_MAX_BUFS];
+	long off[SC_MAX_BUFS], size[SC_MAX_BUFS];
+	long used = 0, count, len, ret;
+	int i;
+
+	ptr[0] = type;
+	ptr[1] = n;
+	args[0] = a1;
+	args[1] = a2;
+	args[2] = a3;
+	args[3] = a4;
+	args[4] = a5;
+	args[5] = a6;
+
+	for(i = 0; i < d->nbuf; ++i)
+	{
+		b = &d->buf[i];
+		user[i] = (void*)args[b->arg - 1];
+		if(user[i] == NULL)
+			continue;
+		if(b->dir == SC_STR)
+			len = strlen(user[i]) + 1;
+		else
+		{
+			count = sc_count(b, args);
+			if(count < 0)
+				return -EINVAL;
+			if(count > (SC_STAGE_MAX - used) / b->unit)
+			{
+				if(!(b->flags & SC_CLAMP))
+					return -E2BIG;
+				count = (SC_STAGE_MAX - used) / b->unit;
+				args[b->count_arg - 1] = count;
+			}
+			len = count * b->unit;
+		}
+		if(len > SC_STAGE_MAX - used)
+			return -E2BIG;
+		if(b->dir != SC_OUT)
+			copy(stage + used, user[i], len);
+		args[b->arg - 1] = (unsigned long)(stage + used);
+		off[i] = used;
+		size[i] = len;
+		used = (used + len + 7) & ~7L;
+	}
+
+	do_ocall(n);
+	ret = ptr[0];
+
+	for(i = 0; i < d->nbuf; ++i)
+	{
+		b = &d->buf[i];
+		if(user[i] == NULL || !(b->dir & SC_OUT))
+			continue;
+		if(ret < 0 && !(b->flags & SC_ALWAYS))
+			continue;
+		len = size[i];
+		if((b->flags & SC_RET) && ret >= 0 && ret < len / b->unit)
+			len = ret * b->unit;
+		copy(user[i], stage + off[i], len);
+	}
+
+	return ret;
+}
+#endif
+
+//read/write/accept come from libc without __syscall_ret (SC_ERRNO): -1 and
+//errno on failure, whichever path made the call
+static inline long sc_result(long n, long ret)
+{
+	if(ret < 0 && ret > -4096 && (unsigned long)n < SC_NR && (sc_desc[n].flags & SC_ERRNO))
+	{
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
 //For debugging
 void ocall_debug(long a1)
 {
@@ -67,10 +990,25 @@ long ocall_syscall0(long n)
 	long ret;
 	unsigned long *ptr;
 
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+#if DIRECT_SYSCALL
+	if(direct(n, 0, 0, 0))
+		return direct_end(direct_syscall(n, 0, 0, 0, 0));
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_call(SYSCALL0, n, 0, 0, 0, 0, 0, 0);
+#endif
+
 	ptr = (unsigned long*)outside_buffer;
 	*ptr = 0;
 	*(ptr+1) = n;
-	ocall_syscall();
+	do_ocall(n);
 	ret = *ptr;
 	return ret;	
 }
@@ -124,32 +1062,38 @@ long ocall_syscall1(long n, long a1)
 		}
 	}
 
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+#if DIRECT_SYSCALL
+	direct_forget(n, a1, 0);
+	if(direct(n, a1, 0, 0))
+		return direct_end(direct_syscall(n, a1, 0, 0, 0));
+#endif
+#if URING
+	if(ur_call(n, a1, 0, 0, 0, 0, &ret))
+		return ret;
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_call(SYSCALL1, n, a1, 0, 0, 0, 0, 0);
+#endif
 
 	ptr = (unsigned long*)outside_buffer;
 	*ptr = 1;
 	*(ptr+1) = n;
 	*(ptr+2) = a1;
 
-	if(n == SYS_pipe) //22
-	{
-		ptr_out = (void*)outside_buffer + 0x1000;
-		*(ptr+2) = (unsigned long)ptr_out;
-		memcpy(ptr_out, (void*)a1, sizeof(int)*2);
-	}
-
 	if(n == 218) //set_tid_address
 	{
 		ptr_out = (void*)outside_buffer + 0x1000;
 		*(ptr+2) = (unsigned long)ptr_out;
 	}
 
-	ocall_syscall();
-
-	if(n == SYS_pipe) //22
-	{
-		ptr_out = (void*)outside_buffer + 0x1000;
-		memcpy((void*)a1, ptr_out, sizeof(int)*2);
-	}
+	do_ocall(n);
 
 	if(n == 218)
 	{
@@ -165,9 +1109,21 @@ long ocall_syscall2(long n, long a1, long a2)
 	long ret;
 	unsigned long *ptr;
 
-	void *ptr_out;
-	void *ptr_in;
-	int len;
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+#if DIRECT_SYSCALL
+	direct_forget(n, a1, a2);
+	if(direct(n, a1, a2, 0))
+		return direct_end(direct_syscall(n, a1, a2, 0, 0));
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_call(SYSCALL2, n, a1, a2, 0, 0, 0, 0);
+#endif
 
 	ptr = (unsigned long*)outside_buffer;
 	*ptr = 2;
@@ -175,28 +1131,6 @@ long ocall_syscall2(long n, long a1, long a2)
 	*(ptr+2) = a1;
 	*(ptr+3) = a2;
 
-	if(n == SYS_nanosleep)
-	{
-		ptr_in = (void*)a1;
-		ptr_out = (void*)outside_buffer + 0x1000;
-		*(ptr+2) = (unsigned long)ptr_out;
-		memcpy(ptr_out, ptr_in, sizeof(struct timespec));
-
-		if(a2 != 0)
-		{
-			ptr_in = (void*)a2;
-			ptr_out = (void*)outside_buffer + 0x1000 + sizeof(struct timespec);
-			*(ptr+3) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, sizeof(struct timespec));
-		}
-	}
-
-	if(n == SYS_clock_gettime) // 228
-	{
-		ptr_out = (void*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-	}
-
 	if(n == SYS_arch_prctl) //158
 	{
 		ocall_debug(0xdeadbeef);
@@ -207,63 +1141,15 @@ long ocall_syscall2(long n, long a1, long a2)
 			*(unsigned long*)a2 = (unsigned long)pthread_self();
 			return 0;
 		}
-		else //a1 == ARCH_GET_GS ARCH_SET_FS or ARCH_SET_GS
-		{
-			ocall_debug(0xdeadbeef);
-			asm("rdtsc");
-		}
-		*/
-	}
-
-	if(n == SYS_stat) // 4
-	{
-		len = strlen((char*)a1) + 1;
-		ptr_in = (char*)a1;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+2) = (unsigned long)ptr_out;
-		memcpy(ptr_out, ptr_in, len);			
-
-		ptr_in = (char*)a2;
-		ptr_out = (char*)outside_buffer + 0x1000 + len;
-		*(ptr+3) = (unsigned long)ptr_out;
-	}
-
-	if(n == SYS_fstat)
-	{
-		ptr_out = (void*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-	}
-
-	ocall_syscall();
-
-	if(n == SYS_nanosleep)
-	{
-		if(a2 != 0)
+		else //a1 == ARCH_GET_GS ARCH_SET_FS or ARCH_SET_GS
 		{
-			ptr_in = (void*)a2;
-			ptr_out = (void*)outside_buffer + 0x1000 + sizeof(struct timespec);
-			memcpy(ptr_in, ptr_out, sizeof(struct timespec));
+			ocall_debug(0xdeadbeef);
+			asm("rdtsc");
 		}
+		*/
 	}
 
-	if(n == SYS_stat)
-	{
-		ptr_in = (char*)a2;
-		ptr_out = (char*)outside_buffer + 0x1000 + len;
-
-		memcpy(ptr_in, ptr_out, sizeof(struct stat));
-	}
-
-	if(n == SYS_fstat)
-	{
-		ptr_in = (char*)a2;
-		ptr_out = (void*)outside_buffer + 0x1000;
-
-		memcpy(ptr_in, ptr_out, sizeof(struct stat));
-	}
-
-	if(n == 228)
-		memcpy((void*)a2, ptr_out, sizeof(struct timespec));
+	do_ocall(n);
 
 	ret = *ptr;
 	//if(ret == 0) return ret;
@@ -271,7 +1157,7 @@ long ocall_syscall2(long n, long a1, long a2)
 	//errno is a positive number.
 	errno = -ret; //set the errno
 	//return -1; //From the manual: -1 means error, errno shows the reason.
-	return ret;
+	return sc_result(n, ret);
 }
 
 void check_fs()                    
@@ -301,17 +1187,29 @@ long ocall_syscall3(long n, long a1, long a2, long a3)
 	long ret;
 	unsigned long *ptr;
 
-	int i;
-	int j;
-	void *base1;
-	void *base2;
-	int offset;
-	struct iovec* s_vec;
-	struct iovec* t_vec;
-
-	char *ptr_in;
+	struct iovec *vec = NULL;
+	long staged = 0;
 	char *ptr_out;
-	socklen_t len;
+
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+#if DIRECT_SYSCALL
+	direct_forget(n, a1, a2);
+	if(direct(n, a1, a2, a3))
+		return sc_result(n, direct_end(direct_syscall(n, a1, a2, a3, 0)));
+#endif
+#if URING
+	if(ur_call(n, a1, a2, a3, 0, 0, &ret))
+		return sc_result(n, ret);
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_result(n, sc_call(SYSCALL3, n, a1, a2, a3, 0, 0, 0));
+#endif
 
 	ptr = (unsigned long*)outside_buffer;
 
@@ -353,82 +1251,19 @@ long ocall_syscall3(long n, long a1, long a2, long a3)
 		*/
 	}
 
-	if(n == SYS_connect)
-	{
-		ptr_in = (char*)a2;
-		ptr_out = (char*)outside_buffer + 0x1000;	
-		*(ptr+3) = (unsigned long)ptr_out;
-		memcpy(ptr_out, ptr_in, a3);	
-	}
-
-	if(n == SYS_bind)
-	{
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-		memcpy(ptr_out, (void*)a2, a3);
-	}
-
-	if(n == SYS_accept) //43
-	{
-		if(a2 != 0)
-		{
-			ptr_in = (char*)a3;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			*(ptr+4) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, sizeof(socklen_t));
-
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			*(ptr+3) = (unsigned long)ptr_out;
-		}
-	}
-
-	if(n == SYS_write)
-	{
-		ptr_in = (char*)a2;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-		
-		memcpy(ptr_out, ptr_in, a3);
-	}
-
-	if(n == SYS_read)
-	{
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-	}
-
 	if(n == SYS_writev || n == SYS_readv) // 20, 19
 	{
-		base1 = (void*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)base1;
-
-		base2 = base1 + sizeof(struct iovec) * a3;
-		offset = 0;
-
-		s_vec = (struct iovec*)a2;
-		t_vec = (struct iovec*)base1;
-
-		//copy args out of the enclave
-		for(i = 0; i < a3; ++i)
-		{
-			t_vec->iov_base = base2 + offset;
-			t_vec->iov_len = s_vec->iov_len;
-			for(j = 0; j < t_vec->iov_len; ++j)
-				*(char*)(t_vec->iov_base+j) = *(char*)(s_vec->iov_base+j);
-			offset += t_vec->iov_len;
-			s_vec += 1;
-			t_vec += 1;
-		}
-	}
-
-	if(n == SYS_open) // 2
-	{
-		ptr_in = (char*)a1;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+2) = (unsigned long)ptr_out;
-	
-		i = strlen(ptr_in) + 1; // include the str ending '\0'
-		memcpy(ptr_out, ptr_in, i);
+		//coalesced: the host gets one iovec, a short write/read beyond IOV_STAGE
+		if(a3 < 0 || a3 > IOV_MAX)
+			return -EINVAL;
+		vec = (struct iovec*)((char*)outside_buffer + 0x1000);
+		vec->iov_base = (char*)(vec + 1);
+		staged = iov_total((struct iovec*)a2, a3, IOV_STAGE);
+		vec->iov_len = staged;
+		if(n == SYS_writev)
+			iov_gather(vec->iov_base, (struct iovec*)a2, a3, staged);
+		*(ptr+3) = (unsigned long)vec;
+		*(ptr+4) = 1;
 	}
 
 	if(n == 16) // ioctl
@@ -437,7 +1272,7 @@ long ocall_syscall3(long n, long a1, long a2, long a3)
 		*(ptr+4) = (unsigned long)ptr_out;
 	}
 
-	ocall_syscall();
+	do_ocall(n);
 
 	if(n == SYS_fcntl)
 	{
@@ -454,63 +1289,18 @@ long ocall_syscall3(long n, long a1, long a2, long a3)
 		*/
 	}
 
-	if(n == SYS_accept) //43
-	{
-		if(a2 != 0)
-		{
-			ptr_in = (char*)a3;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			memcpy(ptr_in, ptr_out, sizeof(socklen_t));
-
-			len = *(socklen_t *)ptr_out;
-			ptr_in = (char*)a2;
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			memcpy(ptr_in, ptr_out, (size_t)len);
-		}
-	}
-	
 	if(n == 16 && a2 == 0x5413) //get the size of window
 	{
 		memcpy((void*)a3, ptr_out, sizeof(struct winsize));
 	}
 
-	if(n == SYS_readv) // readv: copy data into enclave
-	{
-		base1 = (void*)outside_buffer + 0x1000;
-
-		base2 = base1 + sizeof(struct iovec) * a3;
-
-		s_vec = (struct iovec*)base1;
-		t_vec = (struct iovec*)a2;
-
-		//copy args out of the enclave
-		for(i = 0; i < a3; ++i)
-		{
-			for(j = 0; j < t_vec->iov_len; ++j)
-				*(char*)(t_vec->iov_base+j) = *(char*)(s_vec->iov_base+j);
-			s_vec += 1;
-			t_vec += 1;
-		}
-	}
-
-	if(n == SYS_read)
-	{
-		ret = *ptr;
-		if(ret > 0)
-		{
-			ptr_in = (char*)a2;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			memcpy(ptr_in, ptr_out, a3);
-		}
-		if(ret < 0)
-		{
-			//This shoule be done in musl-libc. Musl-libc's bug? Maybe because it is modified.
-			errno = -ret; 			
-			return -1;
-		}
-	}
-
 	ret = *ptr;
+	//the host's word: never more than was staged (vec is outside too)
+	if(n == SYS_readv && ret > staged)
+		ret = staged;
+	if(n == SYS_readv && ret > 0) // readv: copy data into enclave
+		iov_scatter((struct iovec*)a2, a3, (char*)(vec + 1), ret);
+
 	return ret;	
 }
 
@@ -525,6 +1315,25 @@ long ocall_syscall4(long n, long a1, long a2, long a3, long a4)
 	//if(n == SYS_rt_sigaction || n == SYS_rt_sigprocmask)
 		//return 0;
 
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+#if DIRECT_SYSCALL
+	if(direct(n, a1, a2, a3))
+		return direct_end(direct_syscall(n, a1, a2, a3, a4));
+#endif
+#if URING
+	if(ur_call(n, a1, a2, a3, a4, 0, &ret))
+		return ret;
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_call(SYSCALL4, n, a1, a2, a3, a4, 0, 0);
+#endif
+
 	ptr = (unsigned long*)outside_buffer;
 	*ptr = 4;
 	*(ptr+1) = n;
@@ -563,41 +1372,7 @@ long ocall_syscall4(long n, long a1, long a2, long a3, long a4)
 		}
 	}
 
-	if(n == SYS_prlimit64) //302
-	{
-		if(a3 != 0)
-		{
-			ptr_in = (char*)a3;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			*(ptr+4) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, sizeof(struct rlimit));
-		}
-
-		if(a4 != 0)
-		{
-			ptr_in = (char*)a4;
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(struct rlimit);
-			*(ptr+5) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, sizeof(struct rlimit));
-		}
-	}
-
-	if(n == SYS_epoll_ctl)
-	{
-		ptr_in = (char*)a4;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+5) = (unsigned long)ptr_out;	
-		memcpy(ptr_out, ptr_in, sizeof(struct epoll_event));
-	}
-
-	ocall_syscall();
-
-	if(n == SYS_epoll_ctl)
-	{
-		ptr_in = (char*)a4;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		memcpy(ptr_in, ptr_out, sizeof(struct epoll_event));
-	}
+	do_ocall(n);
 
 	if(n == SYS_rt_sigprocmask)
 	{
@@ -618,23 +1393,6 @@ long ocall_syscall4(long n, long a1, long a2, long a3, long a4)
 		}
 	}
 
-	if(n == SYS_prlimit64)
-	{
-		if(a3 != 0)
-		{
-			ptr_in = (char*)a3;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			memcpy(ptr_in, ptr_out, sizeof(struct rlimit));
-		}
-
-		if(a4 != 0)
-		{
-			ptr_in = (char*)a4;
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(struct rlimit);
-			memcpy(ptr_in, ptr_out, sizeof(struct rlimit));
-		}
-	}
-
 	ret = *ptr;
 	return ret;	
 }
@@ -644,6 +1402,17 @@ long ocall_syscall5(long n, long a1, long a2, long a3, long a4, long a5)
 	long ret;
 	unsigned long *ptr;
 
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_call(SYSCALL5, n, a1, a2, a3, a4, a5, 0);
+#endif
+
 	ptr = (unsigned long*)outside_buffer;
 	*ptr = 5;
 	*(ptr+1) = n;
@@ -652,7 +1421,7 @@ long ocall_syscall5(long n, long a1, long a2, long a3, long a4, long a5)
 	*(ptr+4) = a3;
 	*(ptr+5) = a4;
 	*(ptr+6) = a5;
-	ocall_syscall();
+	do_ocall(n);
 	ret = *ptr;
 	return ret;	
 }
@@ -662,17 +1431,31 @@ long ocall_syscall6(long n, long a1, long a2, long a3, long a4, long a5, long a6
 	long ret;
 	unsigned long *ptr;
 
-	char *ptr_in;
 	char *ptr_out;
 
-	socklen_t len;
-
 	struct msghdr *hdr_out;
 	struct msghdr *hdr_in;
-	struct iovec *s_vec;
-	struct iovec *t_vec;
-	int i;
-	int j;
+	struct iovec *vec;
+
+	//syscall() of libc comes here whatever the count
+#if SYSCALL_BATCH
+	//the queued calls first: they stay in order
+	if(batch_queue != 0)
+		batch_run((struct batch*)batch_queue);
+#endif
+#if DIRECT_SYSCALL
+	if(direct(n, a1, a2, a3))
+		return direct_end(direct_syscall(n, a1, a2, a3, a4));
+#endif
+#if URING
+	if(ur_call(n, a1, a2, a3, a4, a5, &ret))
+		return ret;
+#endif
+
+#if SYSCALL_TABLE
+	if((unsigned long)n < SC_NR && sc_desc[n].known)
+		return sc_call(SYSCALL6, n, a1, a2, a3, a4, a5, a6);
+#endif
 
 	ptr = (unsigned long*)outside_buffer;
 	*ptr = 6;
@@ -684,114 +1467,19 @@ long ocall_syscall6(long n, long a1, long a2, long a3, long a4, long a5, long a6
 	*(ptr+6) = a5;
 	*(ptr+7) = a6;
 	
-	if(n == SYS_accept4) //288
-	{
-		if(a2 != 0)
-		{
-			ptr_in = (char*)a3;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			*(ptr+4) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, sizeof(socklen_t));
-
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			*(ptr+3) = (unsigned long)ptr_out;
-		}
-	}
-
-	if(n == SYS_getsockname)
-	{
-		ptr_in = (char*)a3;		
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+4) = (unsigned long)ptr_out;
-		memcpy(ptr_out, ptr_in, sizeof(socklen_t));
-
-		ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-		*(ptr+3) = (unsigned long)ptr_out;
-	}
-
-	if(n == SYS_getsockopt)
-	{
-		if(a4 != 0)
-		{
-			ptr_in = (char*)a5; //socklen_t* (int *)
-			ptr_out = (char*)outside_buffer + 0x1000;
-			*(ptr+6) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, sizeof(socklen_t));
-
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			*(ptr+5) = (unsigned long)ptr_out;
-		}
-	}
-
-	if(n == SYS_setsockopt)
-	{
-		if(a4 != 0 && a5 != 0)
-		{
-			ptr_in = (char*)a4;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			*(ptr+5) = (unsigned long)ptr_out;
-			memcpy(ptr_out, ptr_in, a5);
-		}
-	}
-
-	if(n == SYS_epoll_pwait)
-	{
-		if(a5 != 0)
-		{
-			ptr_out = (char*)outside_buffer + 0x1000;
-			*(ptr+6) = (unsigned long)ptr_out;
-			memcpy(ptr_out, (void*)a5, a6);
-		}
-
-		ptr_out = (char*)outside_buffer + 0x1000 + a6;
-		*(ptr+3) = (unsigned long)ptr_out;
-	}	
-
-	if(n == SYS_getpeername)
-	{
-		len = *(socklen_t *)a3;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(socklen_t *)ptr_out = len;
-		*(ptr+4) = (unsigned long)ptr_out;
-
-		ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-		*(ptr+3) = (unsigned long)ptr_out;
-	}
-
-	if(n == SYS_socketpair) // 53
+	if(n == SYS_sendmsg && a2 != 0)
 	{
-		ptr_in = (char*)a4;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+5) = (unsigned long)ptr_out;
-		memcpy(ptr_out, ptr_in, sizeof(int)*2);
-	}
-
-	if(n == SYS_recvfrom)
-	{
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-
-		if(a5 != 0)
-		{
-			ptr_out = (char*)outside_buffer + 0x1000 + a3;
-			*(ptr+7) = (unsigned long)ptr_out;
-			memcpy(ptr_out, (void*)a6, sizeof(int));
-			
-			ptr_out = (char*)outside_buffer + 0x1000 + a3 + sizeof(int);
-			*(ptr+6) = (unsigned long)ptr_out;
-			memcpy(ptr_out, (void*)a5, a6);
-		}
-	}
+		hdr_in = (struct msghdr*)a2;
+		if(hdr_in->msg_iovlen < 0 || hdr_in->msg_iovlen > IOV_MAX ||
+				hdr_in->msg_namelen > sizeof(struct sockaddr_storage) ||
+				hdr_in->msg_controllen > 0x10000)
+			return -EINVAL;
 
-	if(n == SYS_sendmsg)
-	{
-		ptr_in = (char*)a2;
 		ptr_out = (char*)outside_buffer + 0x1000;
 		*(ptr+3) = (unsigned long)ptr_out;
 		hdr_out = (struct msghdr*)ptr_out;
-		hdr_in = (struct msghdr*)ptr_in;
 
-		memcpy(ptr_out, ptr_in, sizeof(struct msghdr));
+		memcpy(ptr_out, hdr_in, sizeof(struct msghdr));
 		ptr_out += sizeof(struct msghdr);
 		
 		//deep copy	
@@ -809,133 +1497,17 @@ long ocall_syscall6(long n, long a1, long a2, long a3, long a4, long a5, long a6
 			ptr_out += hdr_in->msg_controllen;
 		}
 		
-		hdr_out->msg_iov = (struct iovec*)ptr_out;
-		s_vec = hdr_in->msg_iov;
-		t_vec = hdr_out->msg_iov;
-
-		ptr_out += sizeof(struct iovec) * hdr_in->msg_iovlen;	
-		for(i = 0; i < hdr_in->msg_iovlen; ++i)
-		{
-			t_vec->iov_base = ptr_out;
-			t_vec->iov_len = s_vec->iov_len;
-
-			for(j = 0; j < s_vec->iov_len; ++j)
-				*(char*)(t_vec->iov_base+j) = *(char*)(s_vec->iov_base+j);
-
-			ptr_out += s_vec->iov_len;
-			s_vec += 1;
-			t_vec += 1;
-		}
-	}
-
-	if(n == SYS_sendto)
-	{
-		ptr_out = (char*)outside_buffer + 0x1000;
-		*(ptr+3) = (unsigned long)ptr_out;
-		memcpy(ptr_out, (void*)a2, a3);
-
-		if(a5 != 0)
-		{
-			ptr_out = (char*)outside_buffer + 0x1000 + a3;
-			*(ptr+6) = (unsigned long)ptr_out;
-			memcpy(ptr_out, (void*)a5, a6);
-		}
-	}
-
-	ocall_syscall();
-
-	if(n == SYS_accept4) // 288
-	{
-		if(a2 != 0)
-		{
-			ptr_in = (char*)a3;
-			ptr_out = (char*)outside_buffer + 0x1000;
-			memcpy(ptr_in, ptr_out, sizeof(socklen_t));
-
-			len = *(socklen_t *)ptr_out;
-			ptr_in = (char*)a2;
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			memcpy(ptr_in, ptr_out, (size_t)len);
-		}
-	}
-
-	if(n == SYS_getsockname)
-	{
-		ret = *ptr;
-		if(ret == 0)
-		{
-			ptr_in = (char*)a3;	
-			ptr_out = (char*)outside_buffer + 0x1000;
-			memcpy(ptr_in, ptr_out, sizeof(socklen_t));
-
-			len = *(socklen_t *)ptr_out;
-			ptr_in = (char*)a2;
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			memcpy(ptr_in, ptr_out, (size_t)len);
-		}
-	}
-
-	if(n == SYS_getsockopt)
-	{
-		ret = *ptr;
-		if(ret == 0 && a4 != 0)
-		{
-			ptr_in = (char*)a5; //socklen_t* (int *)
-			ptr_out = (char*)outside_buffer + 0x1000;
-			memcpy(ptr_in, ptr_out, sizeof(socklen_t));
-			
-			len = *(socklen_t *)ptr_out;
-			ptr_in = (char*)a4;	
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			memcpy(ptr_in, ptr_out, (size_t)len);
-		}
-	}
-
-	if(n == SYS_epoll_pwait)
-	{
-		ret = *ptr;
-		if(ret > 0)
-		{
-			ptr_out = (char*)outside_buffer + 0x1000 + a6;
-			memcpy((void*)a2, ptr_out, sizeof(struct epoll_event)*ret);
-		}
-	}
-
-	if(n == SYS_getpeername)
-	{
-		ret = *ptr;
-		if(ret == 0)
-		{
-			ptr_out = (char*)outside_buffer + 0x1000;
-			len = *(socklen_t *)ptr_out;
-			*(socklen_t *)a3 = len;
-
-			ptr_out = (char*)outside_buffer + 0x1000 + sizeof(socklen_t);
-			memcpy((void*)a2, ptr_out, (size_t)len);
-		}
-	}
-
-	if(n == SYS_socketpair) // 53
-	{
-		ptr_in = (char*)a4;
-		ptr_out = (char*)outside_buffer + 0x1000;
-		memcpy(ptr_in, ptr_out, sizeof(int)*2);
+		//the iovecs coalesced into one, as for writev
+		vec = (struct iovec*)(((unsigned long)ptr_out + 15) & ~15UL);
+		vec->iov_base = (char*)(vec + 1);
+		vec->iov_len = iov_total(hdr_in->msg_iov, hdr_in->msg_iovlen,
+				SC_STAGE_MAX - ((char*)(vec + 1) - ((char*)outside_buffer + 0x1000)));
+		iov_gather(vec->iov_base, hdr_in->msg_iov, hdr_in->msg_iovlen, vec->iov_len);
+		hdr_out->msg_iov = vec;
+		hdr_out->msg_iovlen = 1;
 	}
 
-	if(n == SYS_recvfrom)
-	{
-		ptr_out = (char*)outside_buffer + 0x1000;
-		memcpy((void*)a2, ptr_out, a3);
-
-		if(a5 != 0)
-		{
-			ptr_out = (char*)outside_buffer + 0x1000 + a3;
-			memcpy((void*)a6, ptr_out, sizeof(int));
-			
-			ptr_out = (char*)outside_buffer + 0x1000 + a3 + sizeof(int);
-			memcpy((void*)a5, ptr_out, (size_t)a6);
-		}
-	}
+	do_ocall(n);
 
 	ret = *ptr;
 	return ret;	
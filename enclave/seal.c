@@ -0,0 +1,392 @@
+#include "string.h"
+#include <wmmintrin.h>
+#include <smmintrin.h>
+#include "seal.h"
+
+/*
+ * AES-128-GCM with AES-NI and PCLMULQDQ, for sealing the dump.
+ *
+ * Counter blocks are encrypted four at a time, and GHASH multiplies four
+ * blocks by H^4..H^1 and sums the products before a single reduction, so the
+ * multiplications do not wait for each other.
+ * Blocks are byte-reversed before GHASH (the usual PCLMULQDQ trick).
+ */
+
+#define KEY_EXP(k, rcon) key_expand(k, _mm_aeskeygenassist_si128(k, rcon))
+
+static inline __m128i key_expand(__m128i k, __m128i t)
+{
+	t = _mm_shuffle_epi32(t, 0xff);
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, t);
+}
+
+static inline __m128i bswap(__m128i x)
+{
+	const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	return _mm_shuffle_epi8(x, mask);
+}
+
+static inline __m128i aes_block(const struct seal_ctx *ctx, __m128i x)
+{
+	int i;
+
+	x = _mm_xor_si128(x, ctx->rk[0]);
+	for(i = 1; i < 10; ++i)
+		x = _mm_aesenc_si128(x, ctx->rk[i]);
+	return _mm_aesenclast_si128(x, ctx->rk[10]);
+}
+
+//carry-less 128x128 -> 256 bit product, not reduced
+static inline void clmul(__m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+	__m128i t3, t4, t5, t6;
+
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t4 = _mm_xor_si128(t4, t5);
+	*lo = _mm_xor_si128(t3, _mm_slli_si128(t4, 8));
+	*hi = _mm_xor_si128(t6, _mm_srli_si128(t4, 8));
+}
+
+//reduce a (sum of) product(s) in GF(2^128), on byte-reversed values
+static inline __m128i reduce(__m128i t3, __m128i t6)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	//shift the 256-bit product left by one
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	//modulo x^128 + x^7 + x^2 + x + 1
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	return _mm_xor_si128(t6, t3);
+}
+
+static inline __m128i gfmul(__m128i a, __m128i b)
+{
+	__m128i lo, hi;
+
+	clmul(a, b, &lo, &hi);
+	return reduce(lo, hi);
+}
+
+void seal_init(struct seal_ctx *ctx, const unsigned char *key)
+{
+	__m128i k = _mm_loadu_si128((const __m128i*)key);
+
+	ctx->rk[0] = k;
+	ctx->rk[1] = k = KEY_EXP(k, 0x01);
+	ctx->rk[2] = k = KEY_EXP(k, 0x02);
+	ctx->rk[3] = k = KEY_EXP(k, 0x04);
+	ctx->rk[4] = k = KEY_EXP(k, 0x08);
+	ctx->rk[5] = k = KEY_EXP(k, 0x10);
+	ctx->rk[6] = k = KEY_EXP(k, 0x20);
+	ctx->rk[7] = k = KEY_EXP(k, 0x40);
+	ctx->rk[8] = k = KEY_EXP(k, 0x80);
+	ctx->rk[9] = k = KEY_EXP(k, 0x1b);
+	ctx->rk[10] = KEY_EXP(k, 0x36);
+
+	ctx->h[0] = bswap(aes_block(ctx, _mm_setzero_si128()));
+	ctx->h[1] = gfmul(ctx->h[0], ctx->h[0]);
+	ctx->h[2] = gfmul(ctx->h[1], ctx->h[0]);
+	ctx->h[3] = gfmul(ctx->h[2], ctx->h[0]);
+}
+
+void seal_wipe(void *buf, unsigned long len)
+{
+	volatile char *p = (volatile char*)buf;
+	unsigned long i;
+
+	for(i = 0; i < len; ++i)
+		p[i] = 0;
+}
+
+void seal_clear(struct seal_ctx *ctx)
+{
+	seal_wipe(ctx, sizeof(*ctx));
+}
+
+//RDRAND may run dry for a moment: retry a word a few times
+#define RDRAND_RETRY 10
+
+int seal_keygen(unsigned char *key, unsigned long len)
+{
+	unsigned long v, i;
+	unsigned char ok;
+	int retry;
+
+	for(i = 0; i < len; i += sizeof(v))
+	{
+		for(retry = 0; retry < RDRAND_RETRY; ++retry)
+		{
+			asm volatile("rdrand %0; setc %1" : "=r"(v), "=qm"(ok) :: "cc");
+			if(ok)
+				break;
+		}
+		if(!ok)
+			return -1;
+		memcpy(key + i, &v, len - i < sizeof(v) ? len - i : sizeof(v));
+	}
+	return 0;
+}
+
+static inline __m128i counter(__m128i j0, unsigned c)
+{
+	return _mm_insert_epi32(j0, (int)__builtin_bswap32(c), 3);
+}
+
+//J0 = IV | 1 (a 96-bit IV)
+static inline __m128i first_counter(const unsigned char *iv)
+{
+	unsigned char b[16];
+
+	memcpy(b, iv, SEAL_IV_LEN);
+	b[12] = 0;
+	b[13] = 0;
+	b[14] = 0;
+	b[15] = 1;
+	return _mm_loadu_si128((__m128i*)b);
+}
+
+//GHASH of len bytes of ciphertext and of the lengths, as seal_chunk folds it
+static __m128i ghash(const struct seal_ctx *ctx, const char *src, unsigned long len)
+{
+	__m128i y, lens;
+	__m128i lo, hi, l, h;
+	unsigned char last[16];
+	unsigned long i, rest;
+
+	y = _mm_setzero_si128();
+	for(i = 0; i + 64 <= len; i += 64)
+	{
+		clmul(_mm_xor_si128(y, bswap(_mm_loadu_si128((const __m128i*)(src + i)))),
+				ctx->h[3], &lo, &hi);
+		clmul(bswap(_mm_loadu_si128((const __m128i*)(src + i + 16))), ctx->h[2], &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		clmul(bswap(_mm_loadu_si128((const __m128i*)(src + i + 32))), ctx->h[1], &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		clmul(bswap(_mm_loadu_si128((const __m128i*)(src + i + 48))), ctx->h[0], &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		y = reduce(lo, hi);
+	}
+	for(; i < len; i += 16)
+	{
+		rest = len - i < 16 ? len - i : 16;
+		memset(last, 0, sizeof(last));
+		memcpy(last, src + i, rest);
+		y = gfmul(_mm_xor_si128(y, bswap(_mm_loadu_si128((__m128i*)last))), ctx->h[0]);
+	}
+
+	lens = _mm_set_epi64x((long long)__builtin_bswap64(len * 8), 0);
+	return gfmul(_mm_xor_si128(y, bswap(lens)), ctx->h[0]);
+}
+
+//CTR from counter c of j0: dst = src ^ keystream
+static void ctr(const struct seal_ctx *ctx, __m128i j0, unsigned c, char *dst, const char *src,
+		unsigned long len)
+{
+	__m128i c0, c1, c2, c3, x;
+	unsigned char last[16];
+	unsigned long i, rest;
+	int r;
+
+	for(i = 0; i + 64 <= len; i += 64, c += 4)
+	{
+		c0 = _mm_xor_si128(counter(j0, c), ctx->rk[0]);
+		c1 = _mm_xor_si128(counter(j0, c + 1), ctx->rk[0]);
+		c2 = _mm_xor_si128(counter(j0, c + 2), ctx->rk[0]);
+		c3 = _mm_xor_si128(counter(j0, c + 3), ctx->rk[0]);
+		for(r = 1; r < 10; ++r)
+		{
+			c0 = _mm_aesenc_si128(c0, ctx->rk[r]);
+			c1 = _mm_aesenc_si128(c1, ctx->rk[r]);
+			c2 = _mm_aesenc_si128(c2, ctx->rk[r]);
+			c3 = _mm_aesenc_si128(c3, ctx->rk[r]);
+		}
+		c0 = _mm_aesenclast_si128(c0, ctx->rk[10]);
+		c1 = _mm_aesenclast_si128(c1, ctx->rk[10]);
+		c2 = _mm_aesenclast_si128(c2, ctx->rk[10]);
+		c3 = _mm_aesenclast_si128(c3, ctx->rk[10]);
+		_mm_storeu_si128((__m128i*)(dst + i),
+				_mm_xor_si128(c0, _mm_loadu_si128((const __m128i*)(src + i))));
+		_mm_storeu_si128((__m128i*)(dst + i + 16),
+				_mm_xor_si128(c1, _mm_loadu_si128((const __m128i*)(src + i + 16))));
+		_mm_storeu_si128((__m128i*)(dst + i + 32),
+				_mm_xor_si128(c2, _mm_loadu_si128((const __m128i*)(src + i + 32))));
+		_mm_storeu_si128((__m128i*)(dst + i + 48),
+				_mm_xor_si128(c3, _mm_loadu_si128((const __m128i*)(src + i + 48))));
+	}
+	for(; i < len; i += 16, ++c)
+	{
+		rest = len - i < 16 ? len - i : 16;
+		memset(last, 0, sizeof(last));
+		memcpy(last, src + i, rest);
+		x = _mm_xor_si128(aes_block(ctx, counter(j0, c)), _mm_loadu_si128((__m128i*)last));
+		_mm_storeu_si128((__m128i*)last, x);
+		memcpy(dst + i, last, rest);
+	}
+}
+
+//the tag is checked before anything is written: a forged chunk leaves dst alone
+int seal_open(const struct seal_ctx *ctx, char *dst, const char *src, unsigned long len,
+		const unsigned char *iv, const unsigned char *tag)
+{
+	__m128i j0, t;
+
+	j0 = first_counter(iv);
+	t = _mm_xor_si128(bswap(ghash(ctx, src, len)), aes_block(ctx, j0));
+	t = _mm_xor_si128(t, _mm_loadu_si128((const __m128i*)tag));
+	if(!_mm_testz_si128(t, t))
+		return -1;
+	ctr(ctx, j0, 2, dst, src, len);
+	return 0;
+}
+
+/*
+ * EGETKEY: the seal key of this enclave (MRENCLAVE policy) for keyid. Only
+ * the same enclave can derive it again; the host never can.
+ */
+#define SGX_KEYSELECT_SEAL 4
+#define SGX_KEYPOLICY_MRENCLAVE 1
+#define SGX_FLAGS_MASK 0xff0000000000000bULL //INITTED, DEBUG, MODE64BIT, KSS...
+#define SGX_MISC_MASK 0xf0000000U
+#define ENCLU_EGETKEY 1
+
+struct key_request {
+	unsigned short key_name;
+	unsigned short key_policy;
+	unsigned short isv_svn;
+	unsigned short reserved1;
+	unsigned char cpu_svn[16];
+	unsigned long attribute_mask[2];
+	unsigned char key_id[SEAL_KEYID_LEN];
+	unsigned misc_mask;
+	unsigned char reserved2[436];
+} __attribute__((aligned(512)));
+
+int seal_derive_key(const unsigned char *keyid, unsigned char *key)
+{
+	struct key_request req;
+	unsigned char out[SEAL_KEY_LEN] __attribute__((aligned(16)));
+	long ret;
+
+	memset(&req, 0, sizeof(req));
+	req.key_name = SGX_KEYSELECT_SEAL;
+	req.key_policy = SGX_KEYPOLICY_MRENCLAVE;
+	req.attribute_mask[0] = SGX_FLAGS_MASK;
+	req.misc_mask = SGX_MISC_MASK;
+	memcpy(req.key_id, keyid, SEAL_KEYID_LEN);
+
+	asm volatile("enclu" : "=a"(ret) : "a"(ENCLU_EGETKEY), "b"(&req), "c"(out) : "memory", "cc");
+	if(ret == 0)
+		memcpy(key, out, SEAL_KEY_LEN);
+	seal_wipe(out, sizeof(out));
+	return ret == 0 ? 0 : -1;
+}
+
+void seal_chunk(const struct seal_ctx *ctx, char *dst, const char *src, unsigned long len,
+		const unsigned char *iv, unsigned char *tag)
+{
+	__m128i j0, y, c0, c1, c2, c3, x, lens;
+	__m128i lo, hi, l, h;
+	unsigned char last[16];
+	unsigned long i, rest;
+	unsigned c = 2;
+	int r;
+
+	j0 = first_counter(iv);
+	y = _mm_setzero_si128();
+
+	for(i = 0; i + 64 <= len; i += 64, c += 4)
+	{
+		c0 = _mm_xor_si128(counter(j0, c), ctx->rk[0]);
+		c1 = _mm_xor_si128(counter(j0, c + 1), ctx->rk[0]);
+		c2 = _mm_xor_si128(counter(j0, c + 2), ctx->rk[0]);
+		c3 = _mm_xor_si128(counter(j0, c + 3), ctx->rk[0]);
+		for(r = 1; r < 10; ++r)
+		{
+			c0 = _mm_aesenc_si128(c0, ctx->rk[r]);
+			c1 = _mm_aesenc_si128(c1, ctx->rk[r]);
+			c2 = _mm_aesenc_si128(c2, ctx->rk[r]);
+			c3 = _mm_aesenc_si128(c3, ctx->rk[r]);
+		}
+		c0 = _mm_aesenclast_si128(c0, ctx->rk[10]);
+		c1 = _mm_aesenclast_si128(c1, ctx->rk[10]);
+		c2 = _mm_aesenclast_si128(c2, ctx->rk[10]);
+		c3 = _mm_aesenclast_si128(c3, ctx->rk[10]);
+
+		c0 = _mm_xor_si128(c0, _mm_loadu_si128((const __m128i*)(src + i)));
+		c1 = _mm_xor_si128(c1, _mm_loadu_si128((const __m128i*)(src + i + 16)));
+		c2 = _mm_xor_si128(c2, _mm_loadu_si128((const __m128i*)(src + i + 32)));
+		c3 = _mm_xor_si128(c3, _mm_loadu_si128((const __m128i*)(src + i + 48)));
+		_mm_storeu_si128((__m128i*)(dst + i), c0);
+		_mm_storeu_si128((__m128i*)(dst + i + 16), c1);
+		_mm_storeu_si128((__m128i*)(dst + i + 32), c2);
+		_mm_storeu_si128((__m128i*)(dst + i + 48), c3);
+
+		//Y = (Y + C0) H^4 + C1 H^3 + C2 H^2 + C3 H, reduced once
+		clmul(_mm_xor_si128(y, bswap(c0)), ctx->h[3], &lo, &hi);
+		clmul(bswap(c1), ctx->h[2], &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		clmul(bswap(c2), ctx->h[1], &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		clmul(bswap(c3), ctx->h[0], &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		y = reduce(lo, hi);
+	}
+
+	for(; i < len; i += 16, ++c)
+	{
+		rest = len - i < 16 ? len - i : 16;
+		memset(last, 0, sizeof(last));
+		memcpy(last, src + i, rest);
+		x = _mm_xor_si128(aes_block(ctx, counter(j0, c)), _mm_loadu_si128((__m128i*)last));
+		_mm_storeu_si128((__m128i*)last, x);
+		//the pad of a partial block is not hashed
+		memset(last + rest, 0, sizeof(last) - rest);
+		memcpy(dst + i, last, rest);
+		y = gfmul(_mm_xor_si128(y, bswap(_mm_loadu_si128((__m128i*)last))), ctx->h[0]);
+	}
+
+	//no AAD: len(A) = 0, len(C) in bits
+	lens = _mm_set_epi64x((long long)__builtin_bswap64(len * 8), 0);
+	y = gfmul(_mm_xor_si128(y, bswap(lens)), ctx->h[0]);
+
+	x = _mm_xor_si128(bswap(y), aes_block(ctx, j0));
+	_mm_storeu_si128((__m128i*)tag, x);
+}
@@ -0,0 +1,203 @@
+#include "string.h"
+#include <immintrin.h>
+#include "sha256.h"
+
+/*
+ * SHA-256 for the Merkle leaves of the dump.
+ *
+ * cpuid faults inside the enclave: the host tells us whether the SHA
+ * extensions are there (sha256_use_ni), otherwise the portable code runs.
+ */
+
+int sha256_use_ni = 0;
+
+static const unsigned int K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void transform_c(unsigned int *state, const unsigned char *data, unsigned long nblocks)
+{
+	unsigned int w[64];
+	unsigned int a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for(; nblocks; --nblocks, data += 64)
+	{
+		for(i = 0; i < 16; ++i)
+			w[i] = ((unsigned int)data[4*i] << 24) | ((unsigned int)data[4*i+1] << 16) |
+				((unsigned int)data[4*i+2] << 8) | data[4*i+3];
+		for(i = 16; i < 64; ++i)
+			w[i] = w[i-16] + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3)) +
+				w[i-7] + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+		for(i = 0; i < 64; ++i)
+		{
+			t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+//four rounds with the SHA extensions; m: the message words of these rounds
+#define RNDS4(m, i) \
+	do { \
+		msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&K[i])); \
+		s1 = _mm_sha256rnds2_epu32(s1, s0, msg); \
+		msg = _mm_shuffle_epi32(msg, 0x0e); \
+		s0 = _mm_sha256rnds2_epu32(s0, s1, msg); \
+	} while(0)
+
+//next four message words: m0 = f(m0, m1, m2, m3)
+#define SCHED(m0, m1, m2, m3) \
+	do { \
+		m0 = _mm_sha256msg1_epu32(m0, m1); \
+		m0 = _mm_add_epi32(m0, _mm_alignr_epi8(m3, m2, 4)); \
+		m0 = _mm_sha256msg2_epu32(m0, m3); \
+	} while(0)
+
+__attribute__((target("sha,sse4.1")))
+static void transform_ni(unsigned int *state, const unsigned char *data, unsigned long nblocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+	__m128i s0, s1, save0, save1, msg, m0, m1, m2, m3, t;
+	int i;
+
+	//state as ABEF / CDGH
+	t = _mm_loadu_si128((const __m128i*)&state[0]);
+	s1 = _mm_loadu_si128((const __m128i*)&state[4]);
+	t = _mm_shuffle_epi32(t, 0xb1); //CDAB
+	s1 = _mm_shuffle_epi32(s1, 0x1b); //EFGH
+	s0 = _mm_alignr_epi8(t, s1, 8); //ABEF
+	s1 = _mm_blend_epi16(s1, t, 0xf0); //CDGH
+
+	for(; nblocks; --nblocks, data += 64)
+	{
+		save0 = s0;
+		save1 = s1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap);
+
+		RNDS4(m0, 0);
+		RNDS4(m1, 4);
+		RNDS4(m2, 8);
+		RNDS4(m3, 12);
+		for(i = 16; i < 64; i += 16)
+		{
+			SCHED(m0, m1, m2, m3);
+			RNDS4(m0, i);
+			SCHED(m1, m2, m3, m0);
+			RNDS4(m1, i + 4);
+			SCHED(m2, m3, m0, m1);
+			RNDS4(m2, i + 8);
+			SCHED(m3, m0, m1, m2);
+			RNDS4(m3, i + 12);
+		}
+
+		s0 = _mm_add_epi32(s0, save0);
+		s1 = _mm_add_epi32(s1, save1);
+	}
+
+	t = _mm_shuffle_epi32(s0, 0x1b); //FEBA
+	s1 = _mm_shuffle_epi32(s1, 0xb1); //DCHG
+	s0 = _mm_blend_epi16(t, s1, 0xf0); //DCBA
+	s1 = _mm_alignr_epi8(s1, t, 8); //HGFE
+	_mm_storeu_si128((__m128i*)&state[0], s0);
+	_mm_storeu_si128((__m128i*)&state[4], s1);
+}
+
+static inline void transform(unsigned int *state, const unsigned char *data, unsigned long nblocks)
+{
+	if(sha256_use_ni)
+		transform_ni(state, data, nblocks);
+	else
+		transform_c(state, data, nblocks);
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->len = 0;
+	ctx->fill = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, unsigned long len)
+{
+	const unsigned char *p = data;
+	unsigned long n;
+
+	ctx->len += len;
+
+	if(ctx->fill)
+	{
+		n = 64 - ctx->fill < len ? 64 - ctx->fill : len;
+		memcpy(ctx->buf + ctx->fill, p, n);
+		ctx->fill += n;
+		p += n;
+		len -= n;
+		if(ctx->fill < 64)
+			return;
+		transform(ctx->state, ctx->buf, 1);
+		ctx->fill = 0;
+	}
+
+	if(len >= 64)
+	{
+		transform(ctx->state, p, len / 64);
+		p += len & ~63UL;
+		len &= 63;
+	}
+
+	memcpy(ctx->buf, p, len);
+	ctx->fill = len;
+}
+
+void sha256_final(struct sha256_ctx *ctx, unsigned char *out)
+{
+	unsigned long bits = ctx->len * 8;
+	int i;
+
+	ctx->buf[ctx->fill++] = 0x80;
+	if(ctx->fill > 56)
+	{
+		memset(ctx->buf + ctx->fill, 0, 64 - ctx->fill);
+		transform(ctx->state, ctx->buf, 1);
+		ctx->fill = 0;
+	}
+	memset(ctx->buf + ctx->fill, 0, 56 - ctx->fill);
+	for(i = 0; i < 8; ++i)
+		ctx->buf[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+	transform(ctx->state, ctx->buf, 1);
+
+	for(i = 0; i < 8; ++i)
+	{
+		out[4*i] = (unsigned char)(ctx->state[i] >> 24);
+		out[4*i+1] = (unsigned char)(ctx->state[i] >> 16);
+		out[4*i+2] = (unsigned char)(ctx->state[i] >> 8);
+		out[4*i+3] = (unsigned char)ctx->state[i];
+	}
+}
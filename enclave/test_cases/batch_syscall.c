@@ -0,0 +1,140 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "time.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/uio.h"
+#include "sys/epoll.h"
+#include "syscall.h"
+
+//$(pwd)/include
+#include "vars.h"
+#include "batch.h"
+
+//An event loop turn of a server: epoll_ctl and writev for every ready fd,
+//each an ocall or all of them queued and run as one batch. libc's calls keep
+//their results in a batch (EEXIST for a second EPOLL_CTL_ADD); a bad fd closed
+//in the last batch shows the error come back.
+//usage: [turns (10000)] [fds per turn (8)]
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//batch: queued, run by the caller; the results are checked
+static int turn(int ep, int in, int out, int fds, char *msg, int batch)
+{
+	struct epoll_event ev;
+	struct iovec v[2];
+	int i, err, bad = 0;
+
+	v[0].iov_base = msg;
+	v[0].iov_len = 16;
+	v[1].iov_base = msg + 16;
+	v[1].iov_len = 48;
+	for(i = 0; i < fds; ++i)
+	{
+		ev.events = EPOLLIN;
+		ev.data.u64 = i;
+		if(!batch)
+		{
+			epoll_ctl(ep, EPOLL_CTL_MOD, in, &ev);
+			writev(out, v, 2);
+		}
+		else if(sgx_batch_add(SYS_epoll_ctl, ep, EPOLL_CTL_MOD, in, (long)&ev) < 0 ||
+				sgx_batch_add(SYS_writev, out, (long)v, 2, 0) < 0)
+			return -1;
+	}
+	if(!batch)
+		return 0;
+	sgx_batch_flush();
+	for(i = 0; i < 2 * fds; i += 2)
+	{
+		if(sgx_batch_result(i, &err) != 0 || sgx_batch_result(i + 1, &err) != 64)
+			bad += 1;
+	}
+	return bad;
+}
+
+int main(int argc, char* argv[])
+{
+	long turns = 10000, fds = 8, t;
+	unsigned long start, plain_ns, batch_ns;
+	struct epoll_event ev;
+	struct iovec v;
+	char msg[64];
+	int p[2], ep, out, err, failed;
+	long ret, bad;
+
+	if(argc > 1)
+		turns = strtol(argv[1], NULL, 0);
+	if(argc > 2)
+		fds = strtol(argv[2], NULL, 0);
+	if(turns <= 0 || fds <= 0)
+	{
+		printf("usage: %s [turns] [fds per turn]\n", argv[0]);
+		return 1;
+	}
+
+	memset(msg, 'b', sizeof(msg));
+	ep = epoll_create1(0);
+	out = open("/dev/null", O_WRONLY);
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	if(ep < 0 || out < 0 || pipe(p) != 0 || epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &ev) != 0)
+	{
+		printf("setup failed: %d\n", errno);
+		return 1;
+	}
+
+	if(fds * 2 > BATCH_MAX)
+	{
+		printf("at most %d fds per turn\n", BATCH_MAX / 2);
+		return 1;
+	}
+
+	start = now_ns();
+	for(t = 0; t < turns; ++t)
+		turn(ep, p[0], out, fds, msg, 0);
+	plain_ns = now_ns() - start;
+
+	if(sgx_batch_begin() != 0)
+	{
+		printf("sgx_batch_begin failed\n");
+		return 1;
+	}
+	bad = 0;
+	start = now_ns();
+	for(t = 0; t < turns; ++t)
+		bad += turn(ep, p[0], out, fds, msg, 1);
+	batch_ns = now_ns() - start;
+	if(bad != 0)
+	{
+		printf("%ld batched calls did not return what they do alone\n", bad);
+		return 1;
+	}
+
+	//libc's calls are not queued: their results are the real ones
+	ret = epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &ev);
+	printf("epoll_ctl ADD again: %ld (errno %d)\n", ret, ret < 0 ? errno : 0);
+	v.iov_base = msg;
+	v.iov_len = sizeof(msg);
+	ret = writev(out, &v, 1);
+	printf("writev: %ld\n", ret);
+	//a queued close fails when the queue runs, at the end
+	sgx_batch_add(SYS_close, -1, 0, 0, 0);
+	failed = sgx_batch_end();
+	ret = sgx_batch_result(0, &err);
+	printf("close(-1): %ld (errno %d)\n", ret, err);
+
+	printf("%ld syscalls per turn: %lu ns plain, %lu ns batched (%d queued calls failed)\n",
+			fds * 2, plain_ns / turns, batch_ns / turns, failed);
+	return 0;
+}
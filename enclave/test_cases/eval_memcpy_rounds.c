@@ -0,0 +1,77 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+//$(pwd)/include
+#include "pthread.h"
+
+/*
+ * The copy of eval_memcpy_with_n_threads, in rounds, for the migration
+ * benchmark: each thread copies its part of one heap buffer into another
+ * and prints a line per round, so the app can be migrated under load and
+ * its progress counted.
+ */
+
+#define THREAD_NUM 64
+#define TOTAL_MEM 0x1000000
+
+char *inner_start;
+char *outer_start;
+unsigned long offset;
+long rounds;
+
+//the threads stay up between the rounds: a TCS is not reused
+static void *func(void *arg)
+{
+	char *src;
+	char *dst;
+	long id;
+	long i;
+
+	id = (long)arg;
+	src = inner_start + offset * id;
+	dst = outer_start + offset * id;
+
+	for(i = 0; rounds == 0 || i < rounds; ++i)
+	{
+		memcpy(dst, src, offset);
+		//an ocall per round: the thread can be stopped here
+		printf("thread %ld copied 0x%lx bytes\n", id, offset);
+	}
+
+	return (void*)0;
+}
+
+//eval_memcpy_rounds threads [bytes (TOTAL_MEM)] [rounds (1, 0: forever)]
+int main(int argc, char* argv[])
+{
+	pthread_t thread[THREAD_NUM];
+	unsigned long i;
+	unsigned long threads;
+	unsigned long total;
+
+	threads = (argc > 1) ? atoi(argv[1]) : 1;
+	total = (argc > 2) ? strtoul(argv[2], NULL, 0) : TOTAL_MEM;
+	rounds = (argc > 3) ? atoi(argv[3]) : 1;
+	if(threads < 1 || threads > THREAD_NUM)
+		threads = 1;
+
+	inner_start = malloc(total);
+	outer_start = malloc(total);
+	if(inner_start == NULL || outer_start == NULL)
+	{
+		printf("cannot allocate 0x%lx bytes twice\n", total);
+		return -1;
+	}
+	memset(inner_start, 1, total);
+	offset = total / threads;
+
+	for(i = 0; i < threads; ++i)
+		pthread_create(&(thread[i]), NULL, func, (void*)i);
+
+	for(i = 0; i < threads; ++i)
+		pthread_join(thread[i], NULL);
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+//$(pwd)/include
+#include "vars.h"
+
+/*
+ * A block malloc cuts from a large free chunk (pretrim) must be dumped:
+ * free() reported the middle of that chunk as a heap hole. Frees BLOCKS
+ * neighbours into one large chunk, takes a smaller block from it and
+ * checks, round after round, the pattern written the round before. Migrate
+ * it out and in (SIGUSR1, SIGUSR2): a block left in a hole comes back with
+ * zero or stale pages.
+ */
+
+//free() reclaims a merged chunk when its size crosses a power of two: the
+//last of the BLOCKS frees goes past 4 MiB
+#define BLOCKS 21
+#define BLOCK_SIZE (200 << 10) //below MMAP_THRESHOLD: on the brk heap
+#define SMALL_SIZE (128 << 10)
+
+int main(int argc, char* argv[])
+{
+	char *blocks[BLOCKS];
+	char *guard, *small;
+	unsigned long round, i;
+	volatile int spin;
+	int inside;
+
+	for(i = 0; i < BLOCKS; ++i)
+		blocks[i] = malloc(BLOCK_SIZE);
+	//keeps the free chunk off the top of the heap
+	guard = malloc(16);
+	if(guard == NULL)
+	{
+		printf("cannot allocate the blocks\n");
+		return -1;
+	}
+	for(i = 0; i < BLOCKS; ++i)
+	{
+		if(blocks[i] == NULL)
+		{
+			printf("cannot allocate the blocks\n");
+			return -1;
+		}
+		memset(blocks[i], 0xff, BLOCK_SIZE);
+	}
+	for(i = 0; i < BLOCKS; ++i)
+		free(blocks[i]);
+
+	small = malloc(SMALL_SIZE);
+	inside = (small >= blocks[0] && small < blocks[BLOCKS - 1] + BLOCK_SIZE);
+	printf("small block at %p: %s the freed blocks\n", small, inside ? "inside" : "outside");
+	memset(small, 1, SMALL_SIZE);
+
+	for(round = 1; ; ++round)
+	{
+		for(i = 0; i < SMALL_SIZE; ++i)
+		{
+			if(small[i] != (char)round)
+			{
+				printf("pattern lost at +0x%lx in round %lu: %d\n", i, round, small[i]);
+				return -1;
+			}
+		}
+		memset(small, (char)(round + 1), SMALL_SIZE);
+		printf("pattern ok in round %lu\n", round);
+		for(spin = 0; spin < 10000000; ++spin){}
+	}
+
+	return 0;
+}
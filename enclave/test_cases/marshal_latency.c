@@ -0,0 +1,117 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "time.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/stat.h"
+#include "sys/socket.h"
+#include "netinet/in.h"
+
+//$(pwd)/include
+#include "vars.h"
+
+//Per-call cost of the ocalls that copy buffers (fstat, clock_gettime,
+//getsockname, a 64-byte write and read through a pipe), then the corner
+//cases of their copy-in/copy-out: a short addrlen, the errno of read/accept.
+//Run with MIGRATE_DIRECT=0 when native, or the calls go direct.
+//usage: [calls (200000)]
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[])
+{
+	long calls = 200000, i;
+	unsigned long start, fstat_ns, clock_ns, name_ns, pipe_ns;
+	struct timespec ts;
+	struct stat st;
+	struct sockaddr_in addr;
+	char guard[sizeof(addr) + 8];
+	socklen_t len;
+	char msg[64];
+	int p[2], s, failed = 0;
+
+	if(argc > 1)
+		calls = strtol(argv[1], NULL, 0);
+	if(calls <= 0)
+		calls = 1;
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(s < 0 || pipe(p) != 0 || bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+			listen(s, 1) != 0)
+	{
+		printf("setup failed: %d\n", errno);
+		return 1;
+	}
+
+	start = now_ns();
+	for(i = 0; i < calls; ++i)
+		fstat(p[0], &st);
+	fstat_ns = now_ns() - start;
+
+	start = now_ns();
+	for(i = 0; i < calls; ++i)
+		clock_gettime(CLOCK_REALTIME, &ts);
+	clock_ns = now_ns() - start;
+
+	start = now_ns();
+	for(i = 0; i < calls; ++i)
+	{
+		len = sizeof(addr);
+		getsockname(s, (struct sockaddr*)&addr, &len);
+	}
+	name_ns = now_ns() - start;
+
+	memset(msg, 'm', sizeof(msg));
+	start = now_ns();
+	for(i = 0; i < calls; ++i)
+	{
+		write(p[1], msg, sizeof(msg));
+		read(p[0], msg, sizeof(msg));
+	}
+	pipe_ns = now_ns() - start;
+
+	printf("fstat %lu ns, clock_gettime %lu ns, getsockname %lu ns, write+read %lu ns per call\n",
+			fstat_ns / calls, clock_ns / calls, name_ns / calls, pipe_ns / calls);
+
+	//the kernel gets no more room than addrlen says
+	memset(guard, 0x5a, sizeof(guard));
+	len = 4;
+	if(getsockname(s, (struct sockaddr*)guard, &len) != 0 || len != sizeof(addr) ||
+			guard[4] != 0x5a || guard[sizeof(guard) - 1] != 0x5a)
+	{
+		printf("getsockname: short addrlen overrun\n");
+		failed = 1;
+	}
+
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	if(read(p[0], msg, sizeof(msg)) != -1 || errno != EAGAIN)
+	{
+		printf("read: no -1/EAGAIN on an empty pipe\n");
+		failed = 1;
+	}
+
+	fcntl(s, F_SETFL, O_NONBLOCK);
+	if(accept(s, NULL, NULL) != -1 || errno != EAGAIN)
+	{
+		printf("accept: no -1/EAGAIN without a connection\n");
+		failed = 1;
+	}
+
+	close(s);
+	close(p[0]);
+	close(p[1]);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
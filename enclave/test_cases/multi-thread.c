@@ -1,5 +1,3 @@
-#include "function_table.h"
-
 //musl-libc
 #include "stdio.h"
 #include "stdlib.h"
@@ -16,79 +14,49 @@
 pthread_mutex_t m;
 pthread_cond_t cond;
 
-//function declarations
-void init_syscall(unsigned long*);
-void my_start();
-int main(int argc, char* argv[]);
-
-void trampoline(long function_choice, unsigned long arg)
-{
-	unsigned long *ptr;
-	int argc;
-	char **argv;
-	void*(*func)(void*);
-	void *retval;
+#define MAX_THREADS 64
 
-	switch(function_choice)
-	{
-		case INIT_SYSCALL:
-			init_syscall((unsigned long*)arg);
-			//init libc
-			//my_start();
-			break;
-		case TEST_ECALL:
-			ptr = (unsigned long*)(outside_buffer + 0x1000);
-			argc = (int)(*ptr);
-			argc -= 1;
-			argv = (char**)(*(ptr+1));
-			argv += 1;
-			main(argc, argv);
-			break;
-		default:
-			//pthread_create: function_choice is the address of target function.
-			printf("[pthread_create] New Thread\n");
-			func = (void*)function_choice;	
-			retval = func((void*)arg);
-			printf("[pthread_create] The end of Thread: retval addr 0x%lx\n", \
-				   (unsigned long)retval);
-			break;
-	}
-
-	return;
-}
+long rounds;
 
 void *func(void *arg)
 {
 	pthread_t tid;
+	long i;
+	volatile int j;
 	
-	pthread_mutex_lock(&m);
-	*(long*)arg = 1;
-	pthread_cond_signal(&cond);
 	tid = pthread_self();
-	printf("Hello! Enclave thread(0x%lx). value: 0x%lx\n", (unsigned long)tid, *(long*)arg);
-	pthread_mutex_unlock(&m);
-
+	for(i = 0; rounds == 0 || i < rounds; ++i)
+	{
+		pthread_mutex_lock(&m);
+		*(long*)arg += 1;
+		pthread_cond_signal(&cond);
+		printf("Hello! Enclave thread(0x%lx). value: 0x%lx\n", (unsigned long)tid, *(long*)arg);
+		pthread_mutex_unlock(&m);
+		for(j = 0; j < 10000000; ++j){}
+	}
 
 	return (void*)0;
 }
 
+//multi-thread [threads (3)] [rounds of each thread (1, 0: forever)]
 int main(int argc, char* argv[])
 {
 	int ret;	
 	long value;
-	pthread_t thread;
-	pthread_t thread1;
-	pthread_t thread2;
+	long i, threads;
+	pthread_t thread[MAX_THREADS];
 		
 	value = 0x888;
+	threads = (argc > 1) ? atoi(argv[1]) : 3;
+	rounds = (argc > 2) ? atoi(argv[2]) : 1;
+	if(threads < 1 || threads > MAX_THREADS)
+		threads = 3;
 
 	pthread_mutex_init(&m, NULL);
 	pthread_cond_init(&cond, NULL);
 
-	pthread_create(&thread, NULL, func, &value);
-	pthread_create(&thread1, NULL, func, &value);
-	pthread_create(&thread2, NULL, func, &value);
-
+	for(i = 0; i < threads; ++i)
+		pthread_create(&thread[i], NULL, func, &value);
 
 	pthread_mutex_lock(&m);
 	//pthread_cond_wait(&cond, &m);
@@ -97,10 +65,10 @@ int main(int argc, char* argv[])
 	pthread_mutex_unlock(&m);
 
 	
-	printf("wait for another thread 0x%lx\n", thread);
-	ret = pthread_join(thread, NULL);
-	ret = pthread_join(thread1, NULL);
-	ret = pthread_join(thread2, NULL);
+	printf("wait for another thread 0x%lx\n", (unsigned long)thread[0]);
+	ret = 0;
+	for(i = 0; i < threads; ++i)
+		ret = pthread_join(thread[i], NULL);
 
 	return ret;
 }
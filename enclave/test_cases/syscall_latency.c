@@ -0,0 +1,63 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "syscall.h"
+#include "time.h"
+#include "unistd.h"
+#include "sys/stat.h"
+
+//$(pwd)/include
+#include "vars.h"
+
+//Null syscall latency: an ocall in an enclave, a direct syscall once the app
+//runs natively (user --native, or after a migrate-out; MIGRATE_DIRECT=0 keeps
+//the ocalls there). umask never goes direct: the ocall round trip, FS
+//switches included (MIGRATE_FSGSBASE=2 moves FS with arch_prctl).
+//usage: [calls (1000000)] [rounds (1, 0 forever)]
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[])
+{
+	long calls = 1000000, rounds = 1, r, i;
+	unsigned long start, getpid_ns, clock_ns, ocall_ns;
+	struct timespec ts;
+	mode_t mask;
+
+	if(argc > 1)
+		calls = strtol(argv[1], NULL, 0);
+	if(argc > 2)
+		rounds = strtol(argv[2], NULL, 0);
+	if(calls <= 0)
+		calls = 1;
+
+	for(r = 0; rounds == 0 || r < rounds; ++r)
+	{
+		start = now_ns();
+		for(i = 0; i < calls; ++i)
+			syscall(SYS_getpid);
+		getpid_ns = now_ns() - start;
+
+		start = now_ns();
+		for(i = 0; i < calls; ++i)
+			syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+		clock_ns = now_ns() - start;
+
+		mask = umask(022);
+		start = now_ns();
+		for(i = 0; i < calls; ++i)
+			umask(mask);
+		ocall_ns = now_ns() - start;
+
+		printf("round %ld: getpid %lu ns, clock_gettime %lu ns, ocall (umask) %lu ns per call\n",
+				r, getpid_ns / calls, clock_ns / calls, ocall_ns / calls);
+	}
+
+	return 0;
+}
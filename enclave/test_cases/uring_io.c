@@ -0,0 +1,116 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "time.h"
+#include "fcntl.h"
+#include "unistd.h"
+
+//$(pwd)/include
+#include "vars.h"
+#include "uring.h"
+
+//4 KiB file I/O: pwrite/pread one at a time (the ring when URING is set,
+//ocalls otherwise), then reads kept in flight with sgx_uring_read.
+//usage: [file (/tmp/uring_io.dat)] [blocks (4096)] [in flight (16)]
+
+#define BLOCK 4096
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//block b holds the byte b
+static int check(char *buf, long b)
+{
+	return (buf[0] == (char)b && memcmp(buf, buf + 1, BLOCK - 1) == 0) ? 0 : -1;
+}
+
+int main(int argc, char* argv[])
+{
+	char *file = "/tmp/uring_io.dat";
+	long blocks = 4096, depth = 16, b, k, n;
+	unsigned long start, write_ns, read_ns, async_ns;
+	static char bufs[64][BLOCK];
+	int tickets[64];
+	int fd;
+
+	if(argc > 1)
+		file = argv[1];
+	if(argc > 2)
+		blocks = strtol(argv[2], NULL, 0);
+	if(argc > 3)
+		depth = strtol(argv[3], NULL, 0);
+	if(blocks <= 0 || depth <= 0 || depth > 64)
+	{
+		printf("usage: %s [file] [blocks] [in flight (1-64)]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		printf("open %s failed: %d\n", file, errno);
+		return 1;
+	}
+
+	start = now_ns();
+	for(b = 0; b < blocks; ++b)
+	{
+		memset(bufs[0], (char)b, BLOCK);
+		if(pwrite(fd, bufs[0], BLOCK, b * BLOCK) != BLOCK)
+		{
+			printf("pwrite %ld failed\n", b);
+			return 1;
+		}
+	}
+	fsync(fd);
+	write_ns = now_ns() - start;
+
+	start = now_ns();
+	for(b = 0; b < blocks; ++b)
+	{
+		if(pread(fd, bufs[0], BLOCK, b * BLOCK) != BLOCK || check(bufs[0], b) != 0)
+		{
+			printf("pread %ld failed\n", b);
+			return 1;
+		}
+	}
+	read_ns = now_ns() - start;
+	printf("pwrite %lu ns, pread %lu ns per block\n", write_ns / blocks, read_ns / blocks);
+
+	start = now_ns();
+	for(b = 0; b < blocks; b += n)
+	{
+		n = (blocks - b < depth) ? blocks - b : depth;
+		for(k = 0; k < n; ++k)
+		{
+			tickets[k] = sgx_uring_read(fd, bufs[k], BLOCK, (b + k) * BLOCK);
+			if(tickets[k] < 0)
+			{
+				printf("sgx_uring_read: %d (no ring: run with URING=1 or URING=sqpoll)\n",
+						tickets[k]);
+				return 0;
+			}
+		}
+		for(k = 0; k < n; ++k)
+		{
+			if(sgx_uring_wait(tickets[k]) != BLOCK || check(bufs[k], b + k) != 0)
+			{
+				printf("async read %ld failed\n", b + k);
+				return 1;
+			}
+		}
+	}
+	async_ns = now_ns() - start;
+	printf("%ld reads in flight: %lu ns per block\n", depth, async_ns / blocks);
+
+	close(fd);
+	unlink(file);
+	return 0;
+}
@@ -0,0 +1,134 @@
+//musl-libc
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "time.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/uio.h"
+
+//$(pwd)/include
+#include "vars.h"
+
+//writev throughput through the ocall path: 1 to 64 iovecs of 64 B to 64 KiB
+//into /dev/null, so the copies into the outside buffer are what is timed.
+//First a writev/readv round trip through a file checks the data.
+//Run with MIGRATE_DIRECT=0 when native, or writev goes direct.
+//usage: [MiB per case (16)] [file (/tmp/writev_bench.dat)]
+
+#define MAX_IOV 64
+#define MAX_SIZE 0x10000
+
+static unsigned long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static char data[MAX_IOV * MAX_SIZE];
+static char back[MAX_IOV * MAX_SIZE];
+
+//iovecs of uneven sizes over data/back, written and read back
+static int check(char *file)
+{
+	struct iovec in[MAX_IOV], out[MAX_IOV];
+	long i, off = 0, len;
+	int fd;
+
+	for(i = 0; i < MAX_IOV; ++i)
+	{
+		len = (i * 977) % 5000 + ((i % 7 == 0) ? MAX_SIZE / 2 : 1);
+		in[i].iov_base = data + off;
+		in[i].iov_len = len;
+		out[i].iov_base = back + off;
+		out[i].iov_len = len;
+		off += len;
+	}
+	for(i = 0; i < off; ++i)
+		data[i] = (char)(i * 131 + (i >> 12));
+	memset(back, 0, off);
+
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		printf("open %s failed: %d\n", file, errno);
+		return -1;
+	}
+	if(writev(fd, in, MAX_IOV) != off || lseek(fd, 0, SEEK_SET) != 0 ||
+			readv(fd, out, MAX_IOV) != off || memcmp(data, back, off) != 0)
+	{
+		printf("writev/readv of %ld bytes: data differs\n", off);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	unlink(file);
+	printf("writev/readv of %ld bytes in %d iovecs: ok\n", off, MAX_IOV);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	long mib = 16, calls, cnt, size, k, i;
+	char *file = "/tmp/writev_bench.dat";
+	struct iovec v[MAX_IOV];
+	unsigned long start, ns;
+	int fd;
+
+	if(argc > 1)
+		mib = strtol(argv[1], NULL, 0);
+	if(argc > 2)
+		file = argv[2];
+	if(mib <= 0)
+		mib = 1;
+
+	if(check(file) != 0)
+		return 1;
+
+	fd = open("/dev/null", O_WRONLY);
+	if(fd < 0)
+	{
+		printf("open /dev/null failed: %d\n", errno);
+		return 1;
+	}
+
+	printf("%8s", "iovecs");
+	for(size = 64; size <= MAX_SIZE; size *= 4)
+		printf(" %9ld B", size);
+	printf("  (MB/s)\n");
+
+	for(cnt = 1; cnt <= MAX_IOV; cnt *= 2)
+	{
+		printf("%8ld", cnt);
+		for(size = 64; size <= MAX_SIZE; size *= 4)
+		{
+			for(i = 0; i < cnt; ++i)
+			{
+				v[i].iov_base = data + i * size;
+				v[i].iov_len = size;
+			}
+			calls = (mib << 20) / (cnt * size);
+			if(calls < 100)
+				calls = 100;
+
+			start = now_ns();
+			for(k = 0; k < calls; ++k)
+			{
+				if(writev(fd, v, cnt) != cnt * size)
+				{
+					printf("\nwritev of %ld x %ld failed\n", cnt, size);
+					return 1;
+				}
+			}
+			ns = now_ns() - start;
+			printf(" %11lu", (unsigned long)(calls * cnt * size * 1000 / ns));
+		}
+		printf("\n");
+	}
+
+	close(fd);
+	return 0;
+}
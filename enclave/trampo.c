@@ -11,12 +11,13 @@
 
 //$(pwd)/include
 #include "vars.h"
+#include "dump.h"
 
 //function declarations
 void init_syscall(unsigned long*);
 //void my_start();
 int main(int argc, char* argv[]);
-void dump_out(char *out);
+void dump_out(struct dump_desc *desc);
 
 void trampoline(long function_choice, unsigned long arg)
 {
@@ -43,7 +44,8 @@ void trampoline(long function_choice, unsigned long arg)
 			main(argc, argv);
 			break;
 		case MIGRATE:
-			dump_out((char*)arg);
+		case MIGRATE_WORKER:
+			dump_out((struct dump_desc*)arg);
 			break;
 		//default: new thread
 		default:
@@ -0,0 +1,150 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+/*
+ * Checkpoint stream format:
+ *
+ *   struct ckpt_header
+ *   struct ckpt_record [payload] ... (pages in increasing order)
+ *   struct ckpt_record (CKPT_END)
+ *
+ * The image is cut into chunks of chunk_pages pages. Inside a chunk, a run
+ * of all-zero pages becomes one CKPT_ZERO record without payload; a run of
+ * other pages becomes one CKPT_LZ4 record (LZ4 block format), or CKPT_RAW
+ * if it does not compress. A record never crosses a chunk, so a chunk can be
+ * produced and consumed with a fixed-size buffer.
+ *
+ * Dedup: the target advertises the SHA-256 of pages it already holds (its
+ * own ELF load, a local cache). A run of such pages becomes one CKPT_REF
+ * record whose payload is the hash of each page; the target copies the
+ * pages from its own set.
+ *
+ * Delta (CKPT_FLAG_DELTA): both ends keep the image of their last checkpoint
+ * (sent or received) and the SHA-256 of each page of it. Only pages whose
+ * hash changed get a record; the others are left as they are in the
+ * receiver's image. base_seq must match the receiver's last checkpoint.
+ */
+
+#define CKPT_MAGIC "ENCKPT01"
+#define CKPT_VERSION 2
+#define CKPT_PAGE_SIZE 0x1000
+#define CKPT_CHUNK_PAGES 256
+
+enum ckpt_type {
+	CKPT_ZERO = 1,
+	CKPT_RAW = 2,
+	CKPT_LZ4 = 3,
+	CKPT_REF = 4,
+	CKPT_END = 0xff,
+};
+
+#define CKPT_FLAG_DELTA 0x1
+
+struct ckpt_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t npages; //logical size of the image
+	uint64_t chunk_pages;
+	uint64_t flags;
+	uint64_t seq; //checkpoint number
+	uint64_t base_seq; //delta: applies on top of this one
+};
+
+struct ckpt_record {
+	uint32_t type;
+	uint32_t npages;
+	uint64_t page; //first page index
+	uint32_t len; //payload bytes
+	uint32_t reserved;
+};
+
+struct ckpt_stat {
+	unsigned long zero_pages;
+	unsigned long raw_pages;
+	unsigned long lz4_pages;
+	unsigned long ref_pages;
+	unsigned long same_pages; //delta: not sent
+	unsigned long bytes; //stream size
+};
+
+//return 0 on success; a source must fill the whole buffer
+typedef int (*ckpt_sink_t)(void *ctx, const void *buf, unsigned long len);
+typedef int (*ckpt_source_t)(void *ctx, void *buf, unsigned long len);
+
+//return the stream size, or -1
+long ckpt_write(const char *image, unsigned long npages,
+		ckpt_sink_t sink, void *ctx, struct ckpt_stat *stat);
+//zeroed: the image is known to be zero-filled (fresh mapping)
+long ckpt_read(char *image, unsigned long npages,
+		ckpt_source_t source, void *ctx, int zeroed);
+
+//memory buffer as sink/source
+struct ckpt_buf {
+	char *buf;
+	unsigned long size;
+	unsigned long pos;
+};
+int ckpt_buf_sink(void *ctx, const void *buf, unsigned long len);
+int ckpt_buf_source(void *ctx, void *buf, unsigned long len);
+
+#define CKPT_HASH_LEN 32
+
+//pages known by hash; page is NULL on the producer (only the hashes are known)
+struct ckpt_page_ent {
+	unsigned char hash[CKPT_HASH_LEN];
+	const char *page;
+	int used;
+};
+
+struct ckpt_pageset {
+	struct ckpt_page_ent *ents;
+	unsigned long cap; //power of 2
+	unsigned long num;
+};
+
+void ckpt_page_hash(const char *page, unsigned char *hash);
+int ckpt_pageset_init(struct ckpt_pageset *set, unsigned long max_pages);
+void ckpt_pageset_free(struct ckpt_pageset *set);
+int ckpt_pageset_add(struct ckpt_pageset *set, const unsigned char *hash, const char *page);
+//hash and add every non-zero page of a region; return the number of pages added
+long ckpt_pageset_add_region(struct ckpt_pageset *set, const char *base, unsigned long npages);
+const struct ckpt_page_ent* ckpt_pageset_find(const struct ckpt_pageset *set, const unsigned char *hash);
+//advertisement: num * CKPT_HASH_LEN bytes; return the number of hashes
+unsigned long ckpt_pageset_export(const struct ckpt_pageset *set, unsigned char *out);
+int ckpt_pageset_import(struct ckpt_pageset *set, const unsigned char *hashes, unsigned long n);
+
+//hashes of the last checkpoint; seq 0: none yet (the next one is full)
+struct ckpt_delta {
+	uint64_t seq;
+	unsigned long npages;
+	unsigned char (*hash)[CKPT_HASH_LEN];
+};
+
+int ckpt_delta_init(struct ckpt_delta *d, unsigned long npages);
+void ckpt_delta_free(struct ckpt_delta *d);
+//image is the last checkpoint, numbered seq (both ends hold it already)
+void ckpt_delta_base(struct ckpt_delta *d, const char *image, uint64_t seq);
+
+struct ckpt_opts {
+	//write: pages of [dedup_first, dedup_first + dedup_npages) that the target has
+	//read: the pages that CKPT_REF records point to
+	const struct ckpt_pageset *have;
+	unsigned long dedup_first;
+	unsigned long dedup_npages;
+	//write a delta / accept one; updated on success, reset (seq 0) on failure
+	struct ckpt_delta *delta;
+};
+
+long ckpt_write_opts(const char *image, unsigned long npages,
+		ckpt_sink_t sink, void *ctx, struct ckpt_stat *stat, const struct ckpt_opts *opts);
+long ckpt_read_opts(char *image, unsigned long npages,
+		ckpt_source_t source, void *ctx, int zeroed, const struct ckpt_opts *opts);
+
+//LZ4 block format; return the output size, or -1 (compress: does not fit)
+int lz4_compress(const char *src, int srclen, char *dst, int dstcap);
+int lz4_decompress(const char *src, int srclen, char *dst, int dstcap);
+
+#endif
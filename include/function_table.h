@@ -11,6 +11,7 @@
 #define SYSCALL6 6
 #define SGXDEBUG 7
 #define SGXLIBCALL 8
+#define SGXBATCH 9
 
 //SGXLIBCALL
 #define CREATE_THREAD 0x0
@@ -21,6 +22,7 @@
 //ecall
 #define SYSCALL_RET 0x10086
 #define MIGRATE 0x10087
+#define MIGRATE_WORKER 0x10088
 
 #define INIT_SYSCALL 0x0
 #define TEST_ECALL 0x1
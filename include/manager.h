@@ -0,0 +1,28 @@
+#ifndef MANAGER_H
+#define MANAGER_H
+
+/*
+ * Notes from an enclave process (user) to the migration manager.
+ *
+ * The manager starts every enclave as its own user process: the migration
+ * state of user is process-wide (one enclave at enclave_mapaddr). It passes
+ * the write end of one pipe in MIGRATE_NOTIFY_FD; a note is smaller than
+ * PIPE_BUF, so the notes of all the children arrive whole.
+ */
+
+#define NOTE_READY 0 //bytes: enclave size; the migration signals can be sent
+#define NOTE_OUT 1 //migrate-out done; bytes: live bytes dumped, us: signal to resume
+#define NOTE_IN 2 //migrate-in done; bytes: enclave size
+#define NOTE_FAIL 3 //migrate-out declined: the app stays in the enclave
+
+struct migrate_note {
+	int pid;
+	int type;
+	unsigned long bytes;
+	unsigned long us;
+};
+
+//no-op without MIGRATE_NOTIFY_FD
+void migrate_notify(int type, unsigned long bytes, unsigned long us);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef MBUF_H
+#define MBUF_H
+
+//the intermediate migration buffer always sits here, clear of 0x600000000000
+//(the outside range of test_cases/eval_memcpy_with_n_threads)
+#define MBUF_ADDR 0x630000000000UL
+#define HUGE_PAGE_SIZE 0x200000UL
+
+/*
+ * One intermediate buffer for both migration directions, reserved when the
+ * enclave is created and pre-faulted in the background, so no page of it is
+ * faulted in during the downtime.
+ */
+int mbuf_init(unsigned long size);
+//wait for the pre-fault and return the buffer; reserve it again if it was
+//moved away. NULL if it cannot be reserved
+char* mbuf_get();
+//move the buffer's pages to dst; NULL if it cannot
+char* mbuf_move(void *dst, unsigned long size);
+
+#endif
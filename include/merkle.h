@@ -0,0 +1,70 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include "dump.h"
+
+/*
+ * Merkle index of a dump (the tree is described in dump.h).
+ *
+ * The receiver gets the leaves with the dump and the root from the enclave;
+ * only the enclave can check root_mac (DUMP_OPEN).
+ * merkle_check() folds the leaves and compares the root once; after that a
+ * chunk is verified on its own by hashing it against its leaf, so chunks can
+ * be checked as they arrive, in any order and from any thread.
+ * A proof (siblings up to the root) verifies a single chunk without the
+ * other leaves.
+ */
+
+#define MERKLE_PIECE_LEAVES (DUMP_PIECE_SIZE / SEAL_CHUNK)
+//within the piece, then among the pieces
+#define MERKLE_MAX_PROOF 32
+
+struct merkle_chunk {
+	unsigned long offset;
+	unsigned long len;
+	unsigned long piece;
+};
+
+struct merkle {
+	unsigned long nleaves;
+	unsigned long npieces;
+	struct merkle_chunk *chunks;
+	unsigned long *piece_leaf; //first leaf of each piece, npieces + 1 entries
+	unsigned char *leaves; //nleaves hashes
+	unsigned char *pieces; //npieces roots
+	unsigned char root[MERKLE_HASH_LEN];
+	int own_leaves;
+};
+
+//where a leaf sits: what a proof needs besides the hashes
+struct merkle_pos {
+	unsigned long idx; //in its piece
+	unsigned long n; //leaves of its piece
+	unsigned long piece;
+	unsigned long npieces;
+};
+
+//cut the extents into chunks; leaves: the received hashes, or NULL to allocate
+int merkle_init(struct merkle *m, const struct dump_extent *ext, int n, unsigned char *leaves);
+void merkle_free(struct merkle *m);
+
+void merkle_leaf(unsigned long offset, const char *data, unsigned long len, unsigned char *out);
+//sender: hash every chunk of image with nthreads threads, then merkle_build()
+int merkle_hash_image(struct merkle *m, const char *image, int nthreads);
+//piece roots and root from the leaves
+void merkle_build(struct merkle *m);
+//receiver: build, then compare with the trusted root; 0 if they match
+int merkle_check(struct merkle *m, const unsigned char *root);
+//after merkle_check: 0 if the chunk data matches its leaf
+int merkle_verify_chunk(const struct merkle *m, unsigned long leaf, const char *data);
+//every chunk of image, with nthreads threads
+int merkle_verify_image(const struct merkle *m, const char *image, int nthreads);
+
+//return the number of hashes in proof
+int merkle_proof(const struct merkle *m, unsigned long leaf, unsigned char *proof,
+		struct merkle_pos *pos);
+//0 if the leaf hash and the proof lead to root
+int merkle_verify_proof(const unsigned char *root, const unsigned char *leaf,
+		const unsigned char *proof, int nproof, const struct merkle_pos *pos);
+
+#endif
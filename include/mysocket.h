@@ -1,3 +1,4 @@
+//a whole buffer over the checkpoint transport (transport.h), on port 8000
 int send_buf(char* buf, int size);
 
 int recv_buf(char* buf, int size);
@@ -13,5 +13,7 @@ extern const char *mrsigner_path;
 extern const char *modulus_path; 
 
 extern const char *systable_path;
+extern const char *timeline_path;
+extern const char *snapshot_path;
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef POSTCOPY_H
+#define POSTCOPY_H
+
+//pages per UFFDIO_COPY issued by the background prefetcher
+#define POSTCOPY_PREFETCH_PAGES 64
+
+/*
+ * Post-copy of a checkpoint (src) into an empty range (dst).
+ *
+ * postcopy_start() maps dst empty and returns right away; a page is fetched
+ * from src on its first touch, and a background thread fetches the rest.
+ * src must stay valid until postcopy_wait() returns.
+ */
+int postcopy_start(char *src, unsigned long dst, unsigned long size, void (*resident)());
+void postcopy_wait();
+
+/*
+ * With UFFD_USER_MODE_ONLY (unprivileged), a syscall that touches a page not
+ * fetched yet fails with EFAULT instead of waiting for it: until resident()
+ * is called back, by the prefetcher, only user mode may touch dst.
+ */
+int postcopy_kernel_faults();
+
+#endif
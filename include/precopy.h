@@ -0,0 +1,24 @@
+#ifndef PRECOPY_H
+#define PRECOPY_H
+
+//stop iterating once a round copies no more than this many pages
+#define PRECOPY_STOP_PAGES 256
+#define PRECOPY_MAX_ROUNDS 8
+
+/*
+ * Pre-copy of a running (native) image into a buffer.
+ *
+ * Only the ranges given to precopy_track() are copied while the threads run;
+ * writes to them are caught by write-protecting the pages. Everything else
+ * (data, stacks, TCS/SSA/TLS) is copied in precopy_finish(), which must be
+ * called once all the threads are stopped.
+ */
+int precopy_init(unsigned long base, unsigned long size);
+void precopy_track(unsigned long offset, unsigned long len);
+//round 0 copies each tracked range (pages [first, first + npages) of image,
+//already write-protected) into dst with it; NULL: memcpy
+typedef void (*precopy_copy_t)(char *dst, const char *image, unsigned long first, unsigned long npages);
+long precopy_rounds(char *dst, precopy_copy_t copy0);
+long precopy_finish(char *dst);
+
+#endif
@@ -7,5 +7,8 @@
 extern unsigned long total_mmap_size;
 extern unsigned long current_mmap_size;
 extern unsigned long max_mmap_size;
+//SGXBATCH ocalls and the syscalls they made: the average batch size
+extern unsigned long batch_ocalls;
+extern unsigned long batch_calls;
 
 #endif
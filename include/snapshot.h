@@ -0,0 +1,55 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "config.h"
+#include "dump.h"
+
+/*
+ * Snapshot file: a dump of the enclave kept on disk, to restart the app
+ * natively from it (user --restore <file> <enclave>).
+ *
+ *   [0, SNAP_HEADER_SIZE)            struct snap_header
+ *   [data_off, data_off + size)      the image, byte for byte as it sits at mapaddr
+ *
+ * Only the live extents are written: the rest of the image is a hole and
+ * reads as zero. data_off is page aligned, so the image is mmap'ed straight
+ * back at mapaddr (MAP_PRIVATE) and faulted in on first touch.
+ */
+#define SNAP_MAGIC 0x50414e53
+#define SNAP_VERSION 1
+#define SNAP_HEADER_SIZE 0x10000
+#define SNAP_MAX_THREADS 1024
+
+struct snap_header {
+	unsigned magic;
+	unsigned version;
+	unsigned long data_off;
+
+	//layout: the enclave it is restored into must agree
+	struct enclave_config cfg;
+	unsigned long mapaddr;
+	unsigned long size;
+	unsigned long code_size;
+	unsigned long data_size;
+	//host code the enclave jumps to (outside_trampoline)
+	unsigned long trampoline;
+
+	int tcs_num;
+	int nthreads; //app threads, from etid 0
+	int thread_state[SNAP_MAX_THREADS];
+	unsigned long tcs_addr[SNAP_MAX_THREADS];
+
+	int nextents;
+	struct dump_extent extents[MAX_DUMP_EXTENTS];
+};
+
+//write h and the extents of image to path (through path.tmp)
+int snapshot_save(const char *path, struct snap_header *h, const char *image);
+//fd of the file, h filled and sane; -1 on error
+int snapshot_open(const char *path, struct snap_header *h);
+//0 if the layout of h is the one of cfg
+int snapshot_check(const struct snap_header *h, const struct enclave_config *cfg);
+//the image at h->mapaddr, or NULL
+char* snapshot_map(int fd, const struct snap_header *h);
+
+#endif
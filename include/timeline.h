@@ -0,0 +1,60 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+/*
+ * Migration timeline:
+ *
+ * tl_begin() starts a record when the migration signal arrives. Each
+ * tl_mark(phase) charges the cycles since the previous mark to that phase,
+ * so the phases of one direction can be marked in any order and a phase
+ * that does not happen (no EINIT on migrate-out) stays 0. tl_end() marks
+ * TL_RESUME and stores the record.
+ *
+ * The last TL_RING records are kept, and every finished record also goes
+ * into per-phase log2 histograms (in us) that are never reset.
+ */
+
+#define TL_RING 1024
+//bucket i: [2^(i-1), 2^i) us, bucket 0: < 1 us
+#define TL_BUCKETS 32
+
+enum tl_phase {
+	TL_SIGNAL = 0, //handler entry until the threads are asked to stop
+	TL_QUIESCE,
+	TL_DUMP,
+	TL_REBUILD,
+	TL_REWRITE,
+	TL_EINIT,
+	TL_RESUME,
+	TL_PHASES,
+};
+
+enum tl_dir {
+	TL_OUT = 0, //enclave -> native
+	TL_IN = 1, //native -> enclave
+};
+
+struct tl_record {
+	unsigned long seq;
+	int dir;
+	unsigned long start; //tsc
+	unsigned long last; //tsc of the last mark
+	unsigned long cycles[TL_PHASES];
+	unsigned long total;
+	unsigned long bytes; //of the checkpoint
+};
+
+//calibrate the tsc; call once before any migration
+void tl_init();
+//TSC cycles in us, as calibrated by tl_init()
+unsigned long tl_cycles_us(unsigned long cycles);
+void tl_begin(int dir);
+void tl_mark(int phase);
+void tl_bytes(unsigned long bytes);
+void tl_end();
+
+//JSON: records of the ring, histograms and percentiles
+//path: a file, or "unix:/path" for a stream socket; return 0 on success
+int tl_export(const char *path);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <pthread.h>
+
+/*
+ * Checkpoint transport over TCP:
+ *
+ * The sender opens nstreams connections once and keeps them for every
+ * transfer. A transfer is a byte range [0, total) cut into frames that never
+ * cross a chunk boundary; each frame carries its offset, so the streams are
+ * independent and the receiver writes every frame straight to dest + offset.
+ * Frames wait in one bounded queue (depth entries) drained by one thread per
+ * stream: a producer blocks when the queue is full, which bounds the bytes in
+ * flight.
+ * xport_end() sends END on every stream and waits until the receiver has
+ * acknowledged the whole transfer.
+ *
+ * On the receiver, on_chunk runs as soon as a frame has landed, from the
+ * stream thread, so the target can map or EADD pages before the end of the
+ * transfer. For a dense stream (xport_sink), xport_source() reads in order and
+ * blocks only until the bytes it needs are there.
+ */
+
+#define XPORT_PORT 8000
+#define XPORT_CHUNK 0x100000
+#define XPORT_DEPTH 16
+#define XPORT_MAX_STREAMS 16
+#define XPORT_MAGIC 0x584d4745
+
+enum {
+	XPORT_DATA = 0, //len bytes of payload follow
+	XPORT_HELLO, //offset: nstreams, len: chunk size
+	XPORT_END, //offset: total length of the transfer
+	XPORT_ACK, //offset: 0, or 1 if the transfer failed
+};
+
+struct xport_frame {
+	unsigned int magic;
+	unsigned int type;
+	unsigned long offset;
+	unsigned long len;
+};
+
+struct xport_item {
+	unsigned long offset;
+	const char *data;
+	unsigned long len;
+	char *buf; //a copy buffer to give back, or NULL
+	int type; //XPORT_DATA, XPORT_END, or -1 to stop the thread
+};
+
+struct xport_stream {
+	struct xport *x;
+	struct xport_recv *r;
+	int fd;
+	pthread_t tid;
+};
+
+struct xport {
+	int nstreams;
+	struct xport_stream s[XPORT_MAX_STREAMS];
+	unsigned long chunk;
+	int depth;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct xport_item *queue;
+	int head;
+	int len;
+
+	//xport_sink: copy buffers, the one being filled and the stream position
+	char **bufs;
+	int nbufs;
+	char *cur;
+	unsigned long cur_len;
+	unsigned long pos;
+
+	unsigned long total; //end of the furthest frame of this transfer
+	int acked;
+	int failed;
+	unsigned long bytes; //payload sent, ever
+};
+
+typedef void (*xport_chunk_t)(void *ctx, unsigned long offset, char *data, unsigned long len);
+
+struct xport_recv {
+	int lfd;
+	int port;
+	int nstreams;
+	struct xport_stream s[XPORT_MAX_STREAMS];
+	unsigned long chunk;
+
+	char *dest;
+	unsigned long cap;
+	xport_chunk_t on_chunk;
+	void *ctx;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long *done; //bytes landed per chunk
+	unsigned long nchunks;
+	unsigned long contig; //[0, contig) has landed
+	long total; //-1 until the first END
+	int ended;
+	int failed;
+	unsigned long pos; //xport_source
+};
+
+//sender
+struct xport* xport_connect(const char *host, int port, int nstreams, unsigned long chunk,
+		int depth);
+//zero copy: data must stay valid until xport_end()
+int xport_send(struct xport *x, unsigned long offset, const void *data, unsigned long len);
+//a ckpt_sink_t: append at the stream position, copied
+int xport_sink(void *ctx, const void *buf, unsigned long len);
+int xport_end(struct xport *x);
+void xport_close(struct xport *x);
+
+//receiver; port 0: any, see r->port
+struct xport_recv* xport_listen(int port);
+int xport_accept(struct xport_recv *r);
+int xport_recv_start(struct xport_recv *r, char *dest, unsigned long cap, xport_chunk_t on_chunk,
+		void *ctx);
+//total length, or -1
+long xport_recv_wait(struct xport_recv *r);
+//a ckpt_source_t over dest, ctx: the xport_recv
+int xport_source(void *ctx, void *buf, unsigned long len);
+void xport_recv_close(struct xport_recv *r);
+
+#endif
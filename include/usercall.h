@@ -8,6 +8,8 @@ void get_enclave_hash();
 
 void* create_enclave(const char* filename);
 void destroy_enclave();
+//when the fixed range of an image is taken
+void reexec_no_aslr(unsigned long addr);
 
 void enter_enclave(long , void* );
 
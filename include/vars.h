@@ -3,9 +3,20 @@
 
 extern int sgxfd;
 
+//128 pages for communication
+//TODO: 128 is enough for gcc while 64 is not. For 166.i. COPY iteratively.
+//#define COM_BUFFER_SIZE (0x1000 * 128)
+#define COM_BUFFER_SIZE (0x1000 * 4096)
+#define OUTSIDE_STACK_SIZE 0x2000
+
 extern int tcs_num;
 extern unsigned long *tcs_addr;
 extern __thread unsigned long tcs_p;
+//set on the migrate thread and the dump helpers
+extern __thread int migrate_tcs;
+
+//user --native: run without SGX
+extern int native_mode;
 
 extern unsigned long enclave_mapaddr;
 extern unsigned long enclave_size;
@@ -17,13 +28,28 @@ extern volatile int put_in_flag;
 extern volatile int *see_flag;
 extern volatile int *see_flag_in;
 
+//where an enclave thread is, for reaching the quiescent point
+#define THREAD_RUNNING 0 //in the app, or on its way back to it
+#define THREAD_IN_HOST 1 //out for an ocall (e.g. parked in epoll_wait)
+#define THREAD_EXITED 2
+extern volatile int *thread_state;
+
 extern struct enclave_config ecfg;
 
 void init_migrate();
+void start_native(char *base);
 void loop_for_dump();
+void set_thread_state(int state);
 void restore_enclave_thread();
 unsigned long restore_enclave_thread_fsgs();
 void write_fs(unsigned long);
 unsigned long read_fs();
 
+//moving FS on the host
+#define FS_NONE 0 //arch_prctl only
+#define FS_KERNEL 1 //rdfsbase/wrfsbase: the kernel saves the base (Linux 5.9+)
+#define FS_PRCTL 2 //rdfsbase, and arch_prctl so that the kernel knows the base
+extern int fs_mode;
+void init_fs_mode();
+
 #endif
@@ -0,0 +1,683 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+
+#include "../include/checkpoint.h"
+
+#define PS CKPT_PAGE_SIZE
+#define CHUNK_BYTES (CKPT_CHUNK_PAGES * PS)
+//worst case of LZ4 on a chunk
+#define CHUNK_BOUND (CHUNK_BYTES + CHUNK_BYTES / 255 + 16)
+
+/******************************** LZ4 block ********************************/
+
+#define LZ4_HASH_LOG 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_OFFSET 65535
+
+static inline uint32_t read32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+//write a length continuation (after the 4-bit field was saturated)
+static inline char* put_len(char *op, int len)
+{
+	while(len >= 255)
+	{
+		*op++ = (char)255;
+		len -= 255;
+	}
+	*op++ = (char)len;
+	return op;
+}
+
+static char* put_sequence(char *op, const char *lit, int litlen, int offset, int mlen)
+{
+	char *token = op++;
+	int ml = mlen - LZ4_MIN_MATCH;
+
+	*token = (char)((litlen >= 15 ? 15 : litlen) << 4);
+	if(litlen >= 15)
+		op = put_len(op, litlen - 15);
+	memcpy(op, lit, litlen);
+	op += litlen;
+
+	//last sequence: literals only
+	if(mlen == 0)
+		return op;
+
+	*op++ = (char)(offset & 0xff);
+	*op++ = (char)(offset >> 8);
+	*token |= (char)(ml >= 15 ? 15 : ml);
+	if(ml >= 15)
+		op = put_len(op, ml - 15);
+	return op;
+}
+
+int lz4_compress(const char *src, int srclen, char *dst, int dstcap)
+{
+	uint32_t table[1 << LZ4_HASH_LOG];
+	const char *ip = src;
+	const char *anchor = src;
+	const char *mflimit = src + srclen - LZ4_MFLIMIT;
+	const char *matchlimit = src + srclen - LZ4_LAST_LITERALS;
+	const char *ref;
+	char *op = dst;
+	char *oend = dst + dstcap;
+	uint32_t h, seq;
+	int litlen, mlen;
+	unsigned searched = 0;
+
+	memset(table, 0, sizeof(table));
+
+	if(srclen < LZ4_MFLIMIT + 1)
+		goto last;
+
+	while(ip < mflimit)
+	{
+		seq = read32(ip);
+		h = lz4_hash(seq);
+		ref = src + table[h];
+		table[h] = (uint32_t)(ip - src);
+
+		if(ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(ref) != seq)
+		{
+			//skip faster over data that does not compress
+			ip += 1 + (searched++ >> 6);
+			continue;
+		}
+		searched = 0;
+
+		while(ip > anchor && ref > src && ip[-1] == ref[-1])
+		{
+			ip--;
+			ref--;
+		}
+		mlen = LZ4_MIN_MATCH;
+		while(ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+			mlen++;
+
+		litlen = (int)(ip - anchor);
+		if(op + 1 + litlen + litlen / 255 + 1 + 2 + mlen / 255 + 1 > oend)
+			return -1;
+		op = put_sequence(op, anchor, litlen, (int)(ip - ref), mlen);
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+last:
+	litlen = (int)(src + srclen - anchor);
+	if(op + 1 + litlen + litlen / 255 + 1 > oend)
+		return -1;
+	op = put_sequence(op, anchor, litlen, 0, 0);
+	return (int)(op - dst);
+}
+
+int lz4_decompress(const char *src, int srclen, char *dst, int dstcap)
+{
+	const unsigned char *ip = (const unsigned char*)src;
+	const unsigned char *iend = ip + srclen;
+	char *op = dst;
+	char *oend = dst + dstcap;
+	const char *match;
+	unsigned token, b;
+	int litlen, mlen, offset;
+
+	while(ip < iend)
+	{
+		token = *ip++;
+
+		litlen = token >> 4;
+		if(litlen == 15)
+		{
+			do {
+				if(ip >= iend)
+					return -1;
+				b = *ip++;
+				litlen += b;
+			} while(b == 255);
+		}
+		if(litlen > iend - ip || litlen > oend - op)
+			return -1;
+		memcpy(op, ip, litlen);
+		ip += litlen;
+		op += litlen;
+
+		if(ip == iend)
+			break;
+
+		if(iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op - dst)
+			return -1;
+
+		mlen = token & 15;
+		if(mlen == 15)
+		{
+			do {
+				if(ip >= iend)
+					return -1;
+				b = *ip++;
+				mlen += b;
+			} while(b == 255);
+		}
+		mlen += LZ4_MIN_MATCH;
+		if(mlen > oend - op)
+			return -1;
+
+		match = op - offset;
+		if(offset >= mlen)
+		{
+			memcpy(op, match, mlen);
+			op += mlen;
+		}
+		else
+		{
+			//overlapping copy repeats the pattern
+			while(mlen--)
+				*op++ = *match++;
+		}
+	}
+	return (int)(op - dst);
+}
+
+/******************************** page sets ********************************/
+
+static inline int is_zero_page(const char *page)
+{
+	const unsigned long *p = (const unsigned long*)page;
+	unsigned long acc = 0;
+	int i;
+
+	for(i = 0; i < PS / 8; i += 8)
+	{
+		acc |= p[i] | p[i+1] | p[i+2] | p[i+3] | p[i+4] | p[i+5] | p[i+6] | p[i+7];
+		if(acc)
+			return 0;
+	}
+	return 1;
+}
+
+void ckpt_page_hash(const char *page, unsigned char *hash)
+{
+	EVP_Digest(page, PS, hash, NULL, EVP_sha256(), NULL);
+}
+
+int ckpt_pageset_init(struct ckpt_pageset *set, unsigned long max_pages)
+{
+	set->cap = 16;
+	while(set->cap < max_pages * 2)
+		set->cap <<= 1;
+	set->num = 0;
+	set->ents = calloc(set->cap, sizeof(struct ckpt_page_ent));
+	return set->ents ? 0 : -1;
+}
+
+void ckpt_pageset_free(struct ckpt_pageset *set)
+{
+	free(set->ents);
+	set->ents = NULL;
+	set->cap = set->num = 0;
+}
+
+static inline unsigned long slot_of(const struct ckpt_pageset *set, const unsigned char *hash)
+{
+	unsigned long h;
+
+	//already a good hash
+	memcpy(&h, hash, sizeof(h));
+	return h & (set->cap - 1);
+}
+
+const struct ckpt_page_ent* ckpt_pageset_find(const struct ckpt_pageset *set, const unsigned char *hash)
+{
+	unsigned long i;
+
+	if(set == NULL || set->num == 0)
+		return NULL;
+
+	for(i = slot_of(set, hash); set->ents[i].used; i = (i + 1) & (set->cap - 1))
+	{
+		if(memcmp(set->ents[i].hash, hash, CKPT_HASH_LEN) == 0)
+			return &set->ents[i];
+	}
+	return NULL;
+}
+
+int ckpt_pageset_add(struct ckpt_pageset *set, const unsigned char *hash, const char *page)
+{
+	unsigned long i;
+
+	for(i = slot_of(set, hash); set->ents[i].used; i = (i + 1) & (set->cap - 1))
+	{
+		//same content: keep the first copy
+		if(memcmp(set->ents[i].hash, hash, CKPT_HASH_LEN) == 0)
+			return 0;
+	}
+	//keep it at most half full
+	if((set->num + 1) * 2 > set->cap)
+		return -1;
+
+	memcpy(set->ents[i].hash, hash, CKPT_HASH_LEN);
+	set->ents[i].page = page;
+	set->ents[i].used = 1;
+	set->num += 1;
+	return 0;
+}
+
+long ckpt_pageset_add_region(struct ckpt_pageset *set, const char *base, unsigned long npages)
+{
+	unsigned char hash[CKPT_HASH_LEN];
+	unsigned long i;
+	long cnt = 0;
+
+	for(i = 0; i < npages; ++i)
+	{
+		//zero pages cost nothing in the stream anyway
+		if(is_zero_page(base + i * PS))
+			continue;
+		ckpt_page_hash(base + i * PS, hash);
+		if(ckpt_pageset_add(set, hash, base + i * PS) != 0)
+			return -1;
+		cnt += 1;
+	}
+	return cnt;
+}
+
+unsigned long ckpt_pageset_export(const struct ckpt_pageset *set, unsigned char *out)
+{
+	unsigned long i, n = 0;
+
+	for(i = 0; i < set->cap; ++i)
+	{
+		if(!set->ents[i].used)
+			continue;
+		memcpy(out + n * CKPT_HASH_LEN, set->ents[i].hash, CKPT_HASH_LEN);
+		n += 1;
+	}
+	return n;
+}
+
+int ckpt_pageset_import(struct ckpt_pageset *set, const unsigned char *hashes, unsigned long n)
+{
+	unsigned long i;
+
+	for(i = 0; i < n; ++i)
+	{
+		if(ckpt_pageset_add(set, hashes + i * CKPT_HASH_LEN, NULL) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/******************************** delta base *******************************/
+
+int ckpt_delta_init(struct ckpt_delta *d, unsigned long npages)
+{
+	d->seq = 0;
+	d->npages = npages;
+	d->hash = calloc(npages, CKPT_HASH_LEN);
+	return d->hash ? 0 : -1;
+}
+
+void ckpt_delta_free(struct ckpt_delta *d)
+{
+	free(d->hash);
+	d->hash = NULL;
+	d->npages = 0;
+	d->seq = 0;
+}
+
+//the receiver wrote these pages
+static void rehash(struct ckpt_delta *d, const char *image, unsigned long page, unsigned long npages)
+{
+	unsigned long i;
+
+	if(d == NULL)
+		return;
+	for(i = page; i < page + npages; ++i)
+		ckpt_page_hash(image + i * PS, d->hash[i]);
+}
+
+void ckpt_delta_base(struct ckpt_delta *d, const char *image, uint64_t seq)
+{
+	rehash(d, image, 0, d->npages);
+	d->seq = seq;
+}
+
+/***************************** stream format *******************************/
+
+static int put_record(ckpt_sink_t sink, void *ctx, struct ckpt_stat *stat,
+		uint32_t type, unsigned long page, unsigned long npages,
+		const char *payload, unsigned long len)
+{
+	struct ckpt_record rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = type;
+	rec.page = page;
+	rec.npages = (uint32_t)npages;
+	rec.len = (uint32_t)len;
+
+	if(sink(ctx, &rec, sizeof(rec)) != 0)
+		return -1;
+	if(len && sink(ctx, payload, len) != 0)
+		return -1;
+
+	stat->bytes += sizeof(rec) + len;
+	return 0;
+}
+
+//a run of non-zero pages inside one chunk
+static int put_data(ckpt_sink_t sink, void *ctx, struct ckpt_stat *stat, char *scratch,
+		const char *image, unsigned long page, unsigned long npages)
+{
+	const char *src = image + page * PS;
+	int len;
+
+	len = lz4_compress(src, (int)(npages * PS), scratch, (int)(npages * PS) - 1);
+	if(len < 0)
+	{
+		stat->raw_pages += npages;
+		return put_record(sink, ctx, stat, CKPT_RAW, page, npages, src, npages * PS);
+	}
+	stat->lz4_pages += npages;
+	return put_record(sink, ctx, stat, CKPT_LZ4, page, npages, scratch, len);
+}
+
+enum { PAGE_ZERO, PAGE_DATA, PAGE_REF, PAGE_SAME };
+
+//hash: where to put the hash of a page the target may have
+//delta: compare with the base, and make this page the new base
+static inline int page_kind(const char *image, unsigned long page,
+		const struct ckpt_opts *opts, int delta, unsigned char *hash)
+{
+	int hashed = 0;
+
+	if(opts && opts->delta)
+	{
+		ckpt_page_hash(image + page * PS, hash);
+		hashed = 1;
+		if(delta && memcmp(opts->delta->hash[page], hash, CKPT_HASH_LEN) == 0)
+			return PAGE_SAME;
+		memcpy(opts->delta->hash[page], hash, CKPT_HASH_LEN);
+	}
+
+	if(is_zero_page(image + page * PS))
+		return PAGE_ZERO;
+
+	if(opts && opts->have && page >= opts->dedup_first &&
+			page < opts->dedup_first + opts->dedup_npages)
+	{
+		if(!hashed)
+			ckpt_page_hash(image + page * PS, hash);
+		if(ckpt_pageset_find(opts->have, hash))
+			return PAGE_REF;
+	}
+	return PAGE_DATA;
+}
+
+long ckpt_write(const char *image, unsigned long npages,
+		ckpt_sink_t sink, void *ctx, struct ckpt_stat *stat)
+{
+	return ckpt_write_opts(image, npages, sink, ctx, stat, NULL);
+}
+
+long ckpt_write_opts(const char *image, unsigned long npages,
+		ckpt_sink_t sink, void *ctx, struct ckpt_stat *stat, const struct ckpt_opts *opts)
+{
+	struct ckpt_header hdr;
+	struct ckpt_stat local;
+	unsigned char hashes[CKPT_CHUNK_PAGES][CKPT_HASH_LEN];
+	char *scratch;
+	unsigned long chunk, end, page, run;
+	struct ckpt_delta *d = opts ? opts->delta : NULL;
+	int kind, delta, ret = 0;
+
+	if(stat == NULL)
+		stat = &local;
+	memset(stat, 0, sizeof(*stat));
+
+	scratch = malloc(CHUNK_BOUND);
+	if(scratch == NULL)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic));
+	hdr.version = CKPT_VERSION;
+	hdr.page_size = PS;
+	hdr.npages = npages;
+	hdr.chunk_pages = CKPT_CHUNK_PAGES;
+	delta = 0;
+	if(d)
+	{
+		if(d->npages != npages)
+			goto fail;
+		delta = (d->seq != 0);
+		hdr.seq = d->seq + 1;
+		hdr.base_seq = d->seq;
+		if(delta)
+			hdr.flags |= CKPT_FLAG_DELTA;
+	}
+	if(sink(ctx, &hdr, sizeof(hdr)) != 0)
+		goto fail;
+	stat->bytes += sizeof(hdr);
+
+	for(chunk = 0; chunk < npages; chunk += CKPT_CHUNK_PAGES)
+	{
+		end = chunk + CKPT_CHUNK_PAGES;
+		if(end > npages)
+			end = npages;
+
+		//split the chunk into runs of zero / known / other / unchanged pages
+		page = chunk;
+		kind = page_kind(image, page, opts, delta, hashes[0]);
+		while(page < end)
+		{
+			int next = -1;
+
+			for(run = page + 1; run < end; ++run)
+			{
+				next = page_kind(image, run, opts, delta, hashes[run - chunk]);
+				if(next != kind)
+					break;
+			}
+
+			if(kind == PAGE_SAME)
+				stat->same_pages += run - page;
+			else if(kind == PAGE_ZERO)
+			{
+				stat->zero_pages += run - page;
+				ret = put_record(sink, ctx, stat, CKPT_ZERO, page, run - page, NULL, 0);
+			}
+			else if(kind == PAGE_REF)
+			{
+				stat->ref_pages += run - page;
+				ret = put_record(sink, ctx, stat, CKPT_REF, page, run - page,
+						(const char*)hashes[page - chunk], (run - page) * CKPT_HASH_LEN);
+			}
+			else
+				ret = put_data(sink, ctx, stat, scratch, image, page, run - page);
+			if(ret != 0)
+				goto fail;
+			page = run;
+			kind = next;
+		}
+	}
+
+	if(put_record(sink, ctx, stat, CKPT_END, npages, 0, NULL, 0) != 0)
+		goto fail;
+
+	if(d)
+		d->seq = hdr.seq;
+	free(scratch);
+	return (long)stat->bytes;
+
+fail:
+	//the hashes are half updated: next time is a full checkpoint
+	if(d)
+		d->seq = 0;
+	free(scratch);
+	return -1;
+}
+
+//CKPT_REF: payload (the hashes) is in scratch
+static int apply_ref(char *image, const struct ckpt_record *rec,
+		const char *scratch, const struct ckpt_pageset *have)
+{
+	const struct ckpt_page_ent *e;
+	char *dst;
+	unsigned long i;
+
+	if(rec->len != rec->npages * CKPT_HASH_LEN)
+		return -1;
+
+	for(i = 0; i < rec->npages; ++i)
+	{
+		e = ckpt_pageset_find(have, (const unsigned char*)scratch + i * CKPT_HASH_LEN);
+		if(e == NULL || e->page == NULL)
+			return -1;
+		dst = image + (rec->page + i) * PS;
+		//the target may have loaded its ELF right into the image
+		if(e->page != dst)
+			memcpy(dst, e->page, PS);
+	}
+	return 0;
+}
+
+long ckpt_read(char *image, unsigned long npages,
+		ckpt_source_t source, void *ctx, int zeroed)
+{
+	return ckpt_read_opts(image, npages, source, ctx, zeroed, NULL);
+}
+
+long ckpt_read_opts(char *image, unsigned long npages,
+		ckpt_source_t source, void *ctx, int zeroed, const struct ckpt_opts *opts)
+{
+	struct ckpt_header hdr;
+	struct ckpt_record rec;
+	const struct ckpt_pageset *have = opts ? opts->have : NULL;
+	struct ckpt_delta *d = opts ? opts->delta : NULL;
+	char *scratch;
+	unsigned long bytes;
+	int len;
+
+	if(source(ctx, &hdr, sizeof(hdr)) != 0)
+		return -1;
+	if(memcmp(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic)) != 0 ||
+			hdr.version != CKPT_VERSION || hdr.page_size != PS ||
+			hdr.npages != npages || hdr.chunk_pages > CKPT_CHUNK_PAGES)
+	{
+		printf("[ckpt] bad header\n");
+		return -1;
+	}
+	if((hdr.flags & CKPT_FLAG_DELTA) &&
+			(d == NULL || d->npages != npages || d->seq == 0 || d->seq != hdr.base_seq))
+	{
+		printf("[ckpt] delta on top of checkpoint %lu, but we have %lu\n",
+				(unsigned long)hdr.base_seq, d ? (unsigned long)d->seq : 0UL);
+		return -1;
+	}
+	if(d && d->npages != npages)
+		return -1;
+	bytes = sizeof(hdr);
+
+	scratch = malloc(CHUNK_BOUND);
+	if(scratch == NULL)
+		return -1;
+
+	while(1)
+	{
+		if(source(ctx, &rec, sizeof(rec)) != 0)
+			goto fail;
+		bytes += sizeof(rec) + rec.len;
+
+		if(rec.type == CKPT_END)
+			break;
+		//rec.page comes from the wire: no sum that can wrap
+		if(rec.page >= npages || rec.npages > npages - rec.page ||
+				rec.npages > CKPT_CHUNK_PAGES || rec.len > CHUNK_BOUND)
+			goto fail;
+
+		switch(rec.type)
+		{
+			case CKPT_ZERO:
+				//a payload would be parsed as the next record
+				if(rec.len != 0)
+					goto fail;
+				if(!zeroed)
+					memset(image + rec.page * PS, 0, rec.npages * PS);
+				break;
+			case CKPT_RAW:
+				if(rec.len != rec.npages * PS)
+					goto fail;
+				if(source(ctx, image + rec.page * PS, rec.len) != 0)
+					goto fail;
+				break;
+			case CKPT_LZ4:
+				if(source(ctx, scratch, rec.len) != 0)
+					goto fail;
+				len = lz4_decompress(scratch, rec.len, image + rec.page * PS, rec.npages * PS);
+				if(len != (int)(rec.npages * PS))
+					goto fail;
+				break;
+			case CKPT_REF:
+				if(source(ctx, scratch, rec.len) != 0)
+					goto fail;
+				if(apply_ref(image, &rec, scratch, have) != 0)
+					goto fail;
+				break;
+			default:
+				goto fail;
+		}
+		rehash(d, image, rec.page, rec.npages);
+	}
+
+	if(d)
+		d->seq = hdr.seq;
+	free(scratch);
+	return (long)bytes;
+
+fail:
+	printf("[ckpt] corrupted stream\n");
+	if(d)
+		d->seq = 0;
+	free(scratch);
+	return -1;
+}
+
+int ckpt_buf_sink(void *ctx, const void *buf, unsigned long len)
+{
+	struct ckpt_buf *b = ctx;
+
+	if(b->pos + len > b->size)
+		return -1;
+	memcpy(b->buf + b->pos, buf, len);
+	b->pos += len;
+	return 0;
+}
+
+int ckpt_buf_source(void *ctx, void *buf, unsigned long len)
+{
+	struct ckpt_buf *b = ctx;
+
+	if(b->pos + len > b->size)
+		return -1;
+	memcpy(buf, b->buf + b->pos, len);
+	b->pos += len;
+	return 0;
+}
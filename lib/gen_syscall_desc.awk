@@ -0,0 +1,127 @@
+# syscall.table + syscall.annot -> enclave/include/syscall_desc.h
+#
+# awk -f gen_syscall_desc.awk syscall.table syscall.annot > ../enclave/include/syscall_desc.h
+
+function fail(msg)
+{
+	printf("%s:%d: %s\n", FILENAME, FNR, msg) > "/dev/stderr"
+	failed = 1
+	exit 1
+}
+
+function argno(s)
+{
+	if(s !~ /^a[1-6]$/)
+		fail("bad argument " s)
+	return substr(s, 2)
+}
+
+# syscall.table: #define SYS_<name> <nr>
+FNR == NR {
+	if($1 == "#define" && $2 ~ /^SYS_/)
+	{
+		name = substr($2, 5)
+		nr[name] = $3
+		if($3 + 1 > nr_max)
+			nr_max = $3 + 1
+	}
+	next
+}
+
+/^[ \t]*(#|$)/ { next }
+
+{
+	if(!($1 in nr))
+		fail("no syscall " $1)
+	n = nr[$1]
+	if(!(n in known))
+	{
+		known[n] = 1
+		names[n] = $1
+		nbuf[n] = 0
+		flags[n] = "0"
+	}
+	if(NF == 1)
+		next
+	if($2 == "errno")
+	{
+		flags[n] = "SC_ERRNO"
+		next
+	}
+
+	if($2 !~ /^[1-6]$/)
+		fail("bad argument " $2)
+	if(nbuf[n] == 3)
+		fail("more than SC_MAX_BUFS buffers")
+	if($3 == "in") dir = "SC_IN"
+	else if($3 == "out") dir = "SC_OUT"
+	else if($3 == "inout") dir = "SC_INOUT"
+	else if($3 == "str") dir = "SC_STR"
+	else fail("bad direction " $3)
+
+	kind = "SC_CONST"; carg = 0; count = 0; unit = "char"; bflags = ""
+	if(dir != "SC_STR")
+	{
+		if(NF < 4)
+			fail("no count")
+		if($4 ~ /^\*a/)
+		{
+			kind = "SC_DEREF"
+			carg = argno(substr($4, 2))
+		}
+		else if($4 ~ /^a/)
+		{
+			kind = "SC_ARG"
+			carg = argno($4)
+		}
+		else if($4 ~ /^[0-9]+$/)
+			count = $4
+		else
+			fail("bad count " $4)
+		for(i = 5; i <= NF; ++i)
+		{
+			if($i == "ret") bflags = bflags "|SC_RET"
+			else if($i == "always") bflags = bflags "|SC_ALWAYS"
+			else if($i == "clamp") bflags = bflags "|SC_CLAMP"
+			else if(i == 5)
+			{
+				unit = $i
+				gsub(/:/, " ", unit)
+			}
+			else fail("bad flag " $i)
+		}
+		if(bflags ~ /SC_CLAMP/ && kind != "SC_ARG")
+			fail("clamp needs a count argument")
+	}
+	bflags = (bflags == "") ? "0" : substr(bflags, 2)
+
+	buf[n, nbuf[n]] = sprintf("{%d, %s, %s, %d, %s, sizeof(%s), %d}", $2, dir, kind, carg,
+			bflags, unit, count)
+	nbuf[n] += 1
+}
+
+END {
+	if(failed)
+		exit 1
+	print "//generated by lib/gen_syscall_desc.awk from lib/syscall.table and lib/syscall.annot:"
+	print "//edit those and rebuild"
+	print "#ifndef __SYSCALL_DESC_H_"
+	print "#define __SYSCALL_DESC_H_"
+	print ""
+	print "#include \"marshal.h\""
+	print ""
+	printf("#define SC_NR %d\n\n", nr_max)
+	printf("static const struct sc_desc sc_desc[SC_NR] = {\n")
+	for(n = 0; n < nr_max; ++n)
+	{
+		if(!(n in known))
+			continue
+		s = ""
+		for(i = 0; i < nbuf[n]; ++i)
+			s = s ((i > 0) ? ", " : "") buf[n, i]
+		printf("\t[%d] = {1, %s, %d, {%s}}, //%s\n", n, flags[n], nbuf[n], s, names[n])
+	}
+	print "};"
+	print ""
+	print "#endif"
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+
+#include "../include/merkle.h"
+
+static void node(const unsigned char *left, const unsigned char *right, unsigned char *out)
+{
+	unsigned char buf[1 + 2 * MERKLE_HASH_LEN];
+
+	buf[0] = 1;
+	memcpy(buf + 1, left, MERKLE_HASH_LEN);
+	memcpy(buf + 1 + MERKLE_HASH_LEN, right, MERKLE_HASH_LEN);
+	EVP_Digest(buf, sizeof(buf), out, NULL, EVP_sha256(), NULL);
+}
+
+//fold n hashes of in into out; in is clobbered
+static void fold(unsigned char *in, unsigned long n, unsigned char *out)
+{
+	unsigned long j;
+
+	if(n == 0)
+	{
+		memset(out, 0, MERKLE_HASH_LEN);
+		return;
+	}
+	for(; n > 1; n = (n + 1) / 2)
+	{
+		for(j = 0; j + 1 < n; j += 2)
+			node(in + j * MERKLE_HASH_LEN, in + (j + 1) * MERKLE_HASH_LEN,
+					in + j / 2 * MERKLE_HASH_LEN);
+		if(j < n)
+			memcpy(in + j / 2 * MERKLE_HASH_LEN, in + j * MERKLE_HASH_LEN, MERKLE_HASH_LEN);
+	}
+	memcpy(out, in, MERKLE_HASH_LEN);
+}
+
+void merkle_leaf(unsigned long offset, const char *data, unsigned long len, unsigned char *out)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	unsigned char pre[17];
+	int i;
+
+	pre[0] = 0;
+	for(i = 0; i < 8; ++i)
+	{
+		pre[1 + i] = (unsigned char)(offset >> (8 * i));
+		pre[9 + i] = (unsigned char)(len >> (8 * i));
+	}
+	EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	EVP_DigestUpdate(ctx, pre, sizeof(pre));
+	EVP_DigestUpdate(ctx, data, len);
+	EVP_DigestFinal_ex(ctx, out, NULL);
+	EVP_MD_CTX_free(ctx);
+}
+
+int merkle_init(struct merkle *m, const struct dump_extent *ext, int n, unsigned char *leaves)
+{
+	unsigned long off, poff, len;
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	for(i = 0; i < n; ++i)
+	{
+		m->nleaves += (ext[i].len + SEAL_CHUNK - 1) / SEAL_CHUNK;
+		m->npieces += (ext[i].len + DUMP_PIECE_SIZE - 1) / DUMP_PIECE_SIZE;
+	}
+
+	m->chunks = malloc(m->nleaves * sizeof(struct merkle_chunk));
+	m->piece_leaf = malloc((m->npieces + 1) * sizeof(unsigned long));
+	m->pieces = malloc(m->npieces * MERKLE_HASH_LEN + MERKLE_HASH_LEN);
+	m->leaves = leaves;
+	if(leaves == NULL)
+	{
+		m->leaves = malloc(m->nleaves * MERKLE_HASH_LEN + MERKLE_HASH_LEN);
+		m->own_leaves = 1;
+	}
+	if(m->chunks == NULL || m->piece_leaf == NULL || m->pieces == NULL || m->leaves == NULL)
+	{
+		merkle_free(m);
+		return -1;
+	}
+
+	//the cut of dump_out: pieces from the extent start, chunks from the piece start
+	m->nleaves = 0;
+	m->npieces = 0;
+	for(i = 0; i < n; ++i)
+	{
+		for(poff = 0; poff < ext[i].len; poff += DUMP_PIECE_SIZE)
+		{
+			m->piece_leaf[m->npieces] = m->nleaves;
+			for(off = poff; off < ext[i].len && off < poff + DUMP_PIECE_SIZE; off += SEAL_CHUNK)
+			{
+				len = ext[i].len - off;
+				m->chunks[m->nleaves].offset = ext[i].offset + off;
+				m->chunks[m->nleaves].len = len < SEAL_CHUNK ? len : SEAL_CHUNK;
+				m->chunks[m->nleaves].piece = m->npieces;
+				m->nleaves += 1;
+			}
+			m->npieces += 1;
+		}
+	}
+	m->piece_leaf[m->npieces] = m->nleaves;
+	return 0;
+}
+
+void merkle_free(struct merkle *m)
+{
+	free(m->chunks);
+	free(m->piece_leaf);
+	free(m->pieces);
+	if(m->own_leaves)
+		free(m->leaves);
+	memset(m, 0, sizeof(*m));
+}
+
+void merkle_build(struct merkle *m)
+{
+	unsigned char tmp[MERKLE_PIECE_LEAVES * MERKLE_HASH_LEN];
+	unsigned long p, first, n;
+	unsigned char *top;
+
+	for(p = 0; p < m->npieces; ++p)
+	{
+		first = m->piece_leaf[p];
+		n = m->piece_leaf[p + 1] - first;
+		memcpy(tmp, m->leaves + first * MERKLE_HASH_LEN, n * MERKLE_HASH_LEN);
+		fold(tmp, n, m->pieces + p * MERKLE_HASH_LEN);
+	}
+
+	//the piece roots are kept for the proofs
+	top = malloc(m->npieces * MERKLE_HASH_LEN + MERKLE_HASH_LEN);
+	if(top == NULL)
+	{
+		memset(m->root, 0, MERKLE_HASH_LEN);
+		return;
+	}
+	memcpy(top, m->pieces, m->npieces * MERKLE_HASH_LEN);
+	fold(top, m->npieces, m->root);
+	free(top);
+}
+
+int merkle_check(struct merkle *m, const unsigned char *root)
+{
+	merkle_build(m);
+	return memcmp(m->root, root, MERKLE_HASH_LEN) == 0 ? 0 : -1;
+}
+
+int merkle_verify_chunk(const struct merkle *m, unsigned long leaf, const char *data)
+{
+	unsigned char h[MERKLE_HASH_LEN];
+
+	if(leaf >= m->nleaves)
+		return -1;
+	merkle_leaf(m->chunks[leaf].offset, data, m->chunks[leaf].len, h);
+	return memcmp(h, m->leaves + leaf * MERKLE_HASH_LEN, MERKLE_HASH_LEN) == 0 ? 0 : -1;
+}
+
+struct merkle_job {
+	struct merkle *m;
+	const char *image;
+	int hash; //hash the leaves, or verify them
+	int worker;
+	int nworkers;
+	int failed;
+};
+
+static void* merkle_worker(void *arg)
+{
+	struct merkle_job *job = arg;
+	struct merkle *m = job->m;
+	const struct merkle_chunk *c;
+	unsigned long i;
+
+	//interleaved, like the dump workers
+	for(i = job->worker; i < m->nleaves; i += job->nworkers)
+	{
+		c = &m->chunks[i];
+		if(job->hash)
+			merkle_leaf(c->offset, job->image + c->offset, c->len, m->leaves + i * MERKLE_HASH_LEN);
+		else if(merkle_verify_chunk(m, i, job->image + c->offset) != 0)
+		{
+			printf("[merkle] chunk at 0x%lx does not match its leaf\n", c->offset);
+			job->failed = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int run_jobs(struct merkle *m, const char *image, int hash, int nthreads)
+{
+	struct merkle_job jobs[MAX_DUMP_WORKERS];
+	pthread_t tid[MAX_DUMP_WORKERS];
+	int i, ret = 0;
+
+	if(nthreads < 1)
+		nthreads = 1;
+	if(nthreads > MAX_DUMP_WORKERS)
+		nthreads = MAX_DUMP_WORKERS;
+
+	for(i = 0; i < nthreads; ++i)
+	{
+		jobs[i].m = m;
+		jobs[i].image = image;
+		jobs[i].hash = hash;
+		jobs[i].worker = i;
+		jobs[i].nworkers = nthreads;
+		jobs[i].failed = 0;
+		if(i > 0)
+			pthread_create(&tid[i], NULL, merkle_worker, &jobs[i]);
+	}
+	merkle_worker(&jobs[0]);
+	for(i = 1; i < nthreads; ++i)
+		pthread_join(tid[i], NULL);
+
+	for(i = 0; i < nthreads; ++i)
+	{
+		if(jobs[i].failed)
+			ret = -1;
+	}
+	return ret;
+}
+
+int merkle_hash_image(struct merkle *m, const char *image, int nthreads)
+{
+	if(run_jobs(m, image, 1, nthreads) != 0)
+		return -1;
+	merkle_build(m);
+	return 0;
+}
+
+int merkle_verify_image(const struct merkle *m, const char *image, int nthreads)
+{
+	//the leaves are only read
+	return run_jobs((struct merkle*)m, image, 0, nthreads);
+}
+
+//siblings of idx among the n hashes of h, bottom up; h is clobbered
+static int path(unsigned char *h, unsigned long n, unsigned long idx, unsigned char *proof)
+{
+	unsigned long j;
+	int np = 0;
+
+	for(; n > 1; n = (n + 1) / 2, idx /= 2)
+	{
+		if((idx ^ 1) < n)
+			memcpy(proof + np++ * MERKLE_HASH_LEN, h + (idx ^ 1) * MERKLE_HASH_LEN, MERKLE_HASH_LEN);
+		//next level
+		for(j = 0; j + 1 < n; j += 2)
+			node(h + j * MERKLE_HASH_LEN, h + (j + 1) * MERKLE_HASH_LEN, h + j / 2 * MERKLE_HASH_LEN);
+		if(j < n)
+			memcpy(h + j / 2 * MERKLE_HASH_LEN, h + j * MERKLE_HASH_LEN, MERKLE_HASH_LEN);
+	}
+	return np;
+}
+
+int merkle_proof(const struct merkle *m, unsigned long leaf, unsigned char *proof,
+		struct merkle_pos *pos)
+{
+	unsigned char *tmp;
+	unsigned long first;
+	int np;
+
+	if(leaf >= m->nleaves)
+		return -1;
+	tmp = malloc((m->npieces > MERKLE_PIECE_LEAVES ? m->npieces : MERKLE_PIECE_LEAVES) *
+			MERKLE_HASH_LEN);
+	if(tmp == NULL)
+		return -1;
+
+	pos->piece = m->chunks[leaf].piece;
+	pos->npieces = m->npieces;
+	first = m->piece_leaf[pos->piece];
+	pos->idx = leaf - first;
+	pos->n = m->piece_leaf[pos->piece + 1] - first;
+
+	memcpy(tmp, m->leaves + first * MERKLE_HASH_LEN, pos->n * MERKLE_HASH_LEN);
+	np = path(tmp, pos->n, pos->idx, proof);
+	memcpy(tmp, m->pieces, m->npieces * MERKLE_HASH_LEN);
+	np += path(tmp, m->npieces, pos->piece, proof + np * MERKLE_HASH_LEN);
+
+	free(tmp);
+	return np;
+}
+
+//climb from h at idx of n with the siblings in proof; return the hashes used
+static int climb(unsigned char *h, unsigned long n, unsigned long idx, const unsigned char *proof,
+		int nproof)
+{
+	int np = 0;
+
+	for(; n > 1; n = (n + 1) / 2, idx /= 2)
+	{
+		if((idx ^ 1) >= n)
+			continue;
+		if(np == nproof)
+			return -1;
+		if(idx & 1)
+			node(proof + np * MERKLE_HASH_LEN, h, h);
+		else
+			node(h, proof + np * MERKLE_HASH_LEN, h);
+		np += 1;
+	}
+	return np;
+}
+
+int merkle_verify_proof(const unsigned char *root, const unsigned char *leaf,
+		const unsigned char *proof, int nproof, const struct merkle_pos *pos)
+{
+	unsigned char h[MERKLE_HASH_LEN];
+	int np, top;
+
+	memcpy(h, leaf, MERKLE_HASH_LEN);
+	np = climb(h, pos->n, pos->idx, proof, nproof);
+	if(np < 0)
+		return -1;
+	top = climb(h, pos->npieces, pos->piece, proof + np * MERKLE_HASH_LEN, nproof - np);
+	if(top < 0 || np + top != nproof)
+		return -1;
+	return memcmp(h, root, MERKLE_HASH_LEN) == 0 ? 0 : -1;
+}
@@ -48,17 +48,14 @@ int read_config(const char* enclave_filename, struct enclave_config *enclave_con
 	long val = 0;
 	char *enclave_config_file;
 
-	//TODO: each enclave use its own config_file
-	//enclave_config_file = get_path(enclave_filename);
-	//fp = fopen(enclave_config_file, "r");
-	//free(enclave_config_file);
-	//if(fp == NULL) return -1;
-
-
-	
-	//each enclave use the same config_file
-	enclave_config_file = "/home/tmac/workspace/sgx-driver/enclave/linker.lds";
+	//each enclave uses the linker.lds next to it
+	enclave_config_file = get_path(enclave_filename);
 	fp = fopen(enclave_config_file, "r");
+	free(enclave_config_file);
+
+	//else the same config_file for every enclave
+	if(fp == NULL)
+		fp = fopen("/home/tmac/workspace/sgx-driver/enclave/linker.lds", "r");
 	if(fp == NULL) return -1;
 
 	//total pages
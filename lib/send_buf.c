@@ -1,43 +1,21 @@
 #include <stdio.h>
-#include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 
+#include "../include/mysocket.h"
+#include "../include/transport.h"
+
+//one transfer to the receiver at 127.0.0.1:8000, over a single stream
 int send_buf(char* buf, int size)
 {
-	int client_sockfd;
-	int len;
-	struct sockaddr_in remote_addr; //服务器端网络地址结构体
-	//char buf[BUFSIZ];  //数据传送的缓冲区
-	memset(&remote_addr,0,sizeof(remote_addr)); //数据初始化--清零
-	remote_addr.sin_family=AF_INET; //设置为IP通信
-	remote_addr.sin_addr.s_addr=inet_addr("127.0.0.1");//服务器IP地址
-	remote_addr.sin_port=htons(8000); //服务器端口号
-	
-	/*创建客户端套接字--IPv4协议，面向连接通信，TCP协议*/
-	if((client_sockfd=socket(PF_INET,SOCK_STREAM,0))<0)
-	{
-		perror("socket");
-		return 1;
-	}
-	
-	/*将套接字绑定到服务器的网络地址上*/
-	if(connect(client_sockfd,(struct sockaddr *)&remote_addr,sizeof(struct sockaddr))<0)
-	{
-		perror("connect");
+	struct xport *x;
+	int ret;
+
+	x = xport_connect("127.0.0.1", XPORT_PORT, 1, XPORT_CHUNK, XPORT_DEPTH);
+	if(x == NULL)
 		return 1;
-	}
-	//printf("connected to server\n");
-	//len=recv(client_sockfd,buf,BUFSIZ,0);//接收服务器端信息
-    //buf[len]='\0';
-	//printf("%s\n",buf); //打印服务器端信息
 
-	len = send(client_sockfd, buf, size, 0);
-	close(client_sockfd);//关闭套接字
-	if(len == size)
-    	return 0;
-	else
-		return -1;
+	ret = xport_send(x, 0, buf, size);
+	if(xport_end(x) != 0)
+		ret = -1;
+	xport_close(x);
+	return ret == 0 ? 0 : -1;
 }
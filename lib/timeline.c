@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../include/timeline.h"
+
+static const char *phase_name[TL_PHASES] = {
+	"signal", "quiescence", "dump", "rebuild", "rewrite", "einit", "resume",
+};
+static const char *dir_name[2] = { "out", "in" };
+
+static double tsc_per_us = 0;
+
+static struct tl_record ring[TL_RING];
+static unsigned long nrecords = 0; //finished records, ever
+static struct tl_record cur;
+static int active = 0;
+
+//per phase, and the total at TL_PHASES
+static unsigned long hist[2][TL_PHASES + 1][TL_BUCKETS];
+
+static inline unsigned long rdtsc()
+{
+	unsigned int eax, edx;
+
+	__asm__ __volatile__("rdtsc" : "=a"(eax), "=d"(edx));
+	return ((unsigned long)edx << 32) | eax;
+}
+
+static inline unsigned long mono_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void tl_init()
+{
+	struct timespec req = { 0, 20 * 1000 * 1000 };
+	unsigned long t0, t1, c0, c1;
+
+	t0 = mono_ns();
+	c0 = rdtsc();
+	nanosleep(&req, NULL);
+	t1 = mono_ns();
+	c1 = rdtsc();
+
+	tsc_per_us = (double)(c1 - c0) * 1000 / (t1 - t0);
+	printf("[timeline] tsc: %.1f cycles/us\n", tsc_per_us);
+}
+
+static inline unsigned long to_us(unsigned long cycles)
+{
+	if(tsc_per_us == 0)
+		return 0;
+	return (unsigned long)(cycles / tsc_per_us);
+}
+
+unsigned long tl_cycles_us(unsigned long cycles)
+{
+	return to_us(cycles);
+}
+
+static inline int bucket(unsigned long us)
+{
+	int b = 0;
+
+	while(us && b < TL_BUCKETS - 1)
+	{
+		us >>= 1;
+		b += 1;
+	}
+	return b;
+}
+
+void tl_begin(int dir)
+{
+	memset(&cur, 0, sizeof(cur));
+	cur.seq = nrecords;
+	cur.dir = dir;
+	cur.start = rdtsc();
+	cur.last = cur.start;
+	active = 1;
+}
+
+void tl_mark(int phase)
+{
+	unsigned long now = rdtsc();
+
+	if(!active)
+		return;
+	cur.cycles[phase] += now - cur.last;
+	cur.last = now;
+}
+
+void tl_bytes(unsigned long bytes)
+{
+	if(active)
+		cur.bytes = bytes;
+}
+
+void tl_end()
+{
+	int i;
+
+	if(!active)
+		return;
+	tl_mark(TL_RESUME);
+	cur.total = cur.last - cur.start;
+	active = 0;
+
+	for(i = 0; i < TL_PHASES; ++i)
+	{
+		if(cur.cycles[i])
+			hist[cur.dir][i][bucket(to_us(cur.cycles[i]))] += 1;
+	}
+	hist[cur.dir][TL_PHASES][bucket(to_us(cur.total))] += 1;
+
+	ring[nrecords % TL_RING] = cur;
+	nrecords += 1;
+}
+
+//upper bound (us) of the bucket holding the p-th percentile
+static unsigned long percentile(unsigned long *h, double p)
+{
+	unsigned long n = 0, seen = 0;
+	int b;
+
+	for(b = 0; b < TL_BUCKETS; ++b)
+		n += h[b];
+	if(n == 0)
+		return 0;
+
+	for(b = 0; b < TL_BUCKETS; ++b)
+	{
+		seen += h[b];
+		if(seen * 100.0 >= p * n)
+			break;
+	}
+	return 1UL << b;
+}
+
+static void put_hist(FILE *f, unsigned long *h)
+{
+	int b;
+
+	fprintf(f, "{\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"log2_us\": [",
+			percentile(h, 50), percentile(h, 90), percentile(h, 99), percentile(h, 99.9));
+	for(b = 0; b < TL_BUCKETS; ++b)
+		fprintf(f, "%s%lu", b ? ", " : "", h[b]);
+	fprintf(f, "]}");
+}
+
+static void put_json(FILE *f)
+{
+	unsigned long i, first;
+	struct tl_record *r;
+	int d, p;
+
+	fprintf(f, "{\n\"tsc_per_us\": %.3f,\n\"migrations\": %lu,\n\"records\": [\n",
+			tsc_per_us, nrecords);
+
+	first = nrecords > TL_RING ? nrecords - TL_RING : 0;
+	for(i = first; i < nrecords; ++i)
+	{
+		r = &ring[i % TL_RING];
+		fprintf(f, "  {\"seq\": %lu, \"dir\": \"%s\", \"bytes\": %lu, \"total_us\": %lu",
+				r->seq, dir_name[r->dir], r->bytes, to_us(r->total));
+		for(p = 0; p < TL_PHASES; ++p)
+			fprintf(f, ", \"%s_us\": %lu", phase_name[p], to_us(r->cycles[p]));
+		fprintf(f, "}%s\n", i + 1 < nrecords ? "," : "");
+	}
+
+	fprintf(f, "],\n\"histograms\": {\n");
+	for(d = 0; d < 2; ++d)
+	{
+		fprintf(f, "  \"%s\": {\n", dir_name[d]);
+		for(p = 0; p <= TL_PHASES; ++p)
+		{
+			fprintf(f, "    \"%s\": ", p < TL_PHASES ? phase_name[p] : "total");
+			put_hist(f, hist[d][p]);
+			fprintf(f, "%s\n", p < TL_PHASES ? "," : "");
+		}
+		fprintf(f, "  }%s\n", d == 0 ? "," : "");
+	}
+	fprintf(f, "}\n}\n");
+}
+
+static int open_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int tl_export(const char *path)
+{
+	char *buf = NULL;
+	size_t len = 0, off = 0;
+	ssize_t ret;
+	FILE *f;
+	int fd;
+
+	f = open_memstream(&buf, &len);
+	if(f == NULL)
+		return -1;
+	put_json(f);
+	fclose(f);
+
+	if(strncmp(path, "unix:", 5) == 0)
+		fd = open_unix(path + 5);
+	else
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		free(buf);
+		return -1;
+	}
+
+	while(off < len)
+	{
+		ret = write(fd, buf + off, len - off);
+		if(ret <= 0)
+			break;
+		off += ret;
+	}
+
+	close(fd);
+	free(buf);
+	return off == len ? 0 : -1;
+}
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../include/transport.h"
+
+//header, and the payload of a DATA frame, all of it
+static int send_frame(int fd, int type, unsigned long offset, const char *data, unsigned long len)
+{
+	struct xport_frame f;
+	struct iovec iov[2];
+	struct msghdr msg;
+	unsigned long left;
+	ssize_t n;
+
+	f.magic = XPORT_MAGIC;
+	f.type = type;
+	f.offset = offset;
+	f.len = len;
+	if(type != XPORT_DATA)
+		len = 0;
+	iov[0].iov_base = &f;
+	iov[0].iov_len = sizeof(f);
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = len ? 2 : 1;
+
+	left = sizeof(f) + len;
+	while(left > 0)
+	{
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(n <= 0)
+			return -1;
+		left -= n;
+		//skip what went out
+		while(msg.msg_iovlen > 0 && (unsigned long)n >= msg.msg_iov->iov_len)
+		{
+			n -= msg.msg_iov->iov_len;
+			msg.msg_iov += 1;
+			msg.msg_iovlen -= 1;
+		}
+		if(n > 0)
+		{
+			msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+			msg.msg_iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static int recv_full(int fd, void *buf, unsigned long len)
+{
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = recv(fd, buf, len, MSG_WAITALL);
+		if(n <= 0)
+			return -1;
+		buf = (char*)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int recv_frame(int fd, struct xport_frame *f)
+{
+	if(recv_full(fd, f, sizeof(*f)) != 0 || f->magic != XPORT_MAGIC)
+		return -1;
+	return 0;
+}
+
+static void nodelay(int fd)
+{
+	int one = 1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* sender */
+
+static void push(struct xport *x, struct xport_item *item)
+{
+	pthread_mutex_lock(&x->lock);
+	//backpressure
+	while(x->len == x->depth)
+		pthread_cond_wait(&x->cond, &x->lock);
+	x->queue[(x->head + x->len) % x->depth] = *item;
+	x->len += 1;
+	pthread_cond_broadcast(&x->cond);
+	pthread_mutex_unlock(&x->lock);
+}
+
+static void* send_thread(void *arg)
+{
+	struct xport_stream *s = arg;
+	struct xport *x = s->x;
+	struct xport_item item;
+	struct xport_frame ack;
+	int ok;
+
+	while(1)
+	{
+		pthread_mutex_lock(&x->lock);
+		while(x->len == 0)
+			pthread_cond_wait(&x->cond, &x->lock);
+		item = x->queue[x->head];
+		x->head = (x->head + 1) % x->depth;
+		x->len -= 1;
+		pthread_cond_broadcast(&x->cond);
+		ok = !x->failed;
+		pthread_mutex_unlock(&x->lock);
+
+		if(item.type < 0)
+			break;
+
+		//after a failure, drain the queue so that nobody waits forever
+		if(ok)
+			ok = send_frame(s->fd, item.type, item.offset, item.data, item.len) == 0;
+		if(ok && item.type == XPORT_END)
+			ok = recv_frame(s->fd, &ack) == 0 && ack.type == XPORT_ACK && ack.offset == 0;
+
+		pthread_mutex_lock(&x->lock);
+		if(!ok)
+			x->failed = 1;
+		else if(item.type == XPORT_DATA)
+			x->bytes += item.len;
+		if(item.buf != NULL)
+			x->bufs[x->nbufs++] = item.buf;
+		if(item.type == XPORT_END)
+			x->acked += 1;
+		pthread_cond_broadcast(&x->cond);
+		pthread_mutex_unlock(&x->lock);
+	}
+	return NULL;
+}
+
+static void free_xport(struct xport *x)
+{
+	free(x->queue);
+	free(x->bufs);
+	pthread_mutex_destroy(&x->lock);
+	pthread_cond_destroy(&x->cond);
+	free(x);
+}
+
+struct xport* xport_connect(const char *host, int port, int nstreams, unsigned long chunk,
+		int depth)
+{
+	struct sockaddr_in addr;
+	struct xport *x;
+	int i;
+
+	if(nstreams < 1 || nstreams > XPORT_MAX_STREAMS || chunk == 0 || depth < 1)
+		return NULL;
+
+	x = calloc(1, sizeof(*x));
+	if(x == NULL)
+		return NULL;
+	x->nstreams = nstreams;
+	x->chunk = chunk;
+	x->depth = depth;
+	pthread_mutex_init(&x->lock, NULL);
+	pthread_cond_init(&x->cond, NULL);
+	x->queue = malloc(depth * sizeof(struct xport_item));
+	//in the queue, on the wire, and the one being filled
+	x->bufs = calloc(depth + nstreams + 1, sizeof(char*));
+	if(x->queue == NULL || x->bufs == NULL)
+	{
+		free_xport(x);
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(host);
+	addr.sin_port = htons(port);
+
+	for(i = 0; i < nstreams; ++i)
+	{
+		x->s[i].x = x;
+		x->s[i].fd = socket(PF_INET, SOCK_STREAM, 0);
+		if(x->s[i].fd < 0 || connect(x->s[i].fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+				send_frame(x->s[i].fd, XPORT_HELLO, nstreams, NULL, chunk) != 0)
+		{
+			perror("xport_connect");
+			if(x->s[i].fd >= 0)
+				close(x->s[i].fd);
+			while(--i >= 0)
+				close(x->s[i].fd);
+			free_xport(x);
+			return NULL;
+		}
+		nodelay(x->s[i].fd);
+	}
+
+	for(i = 0; i < nstreams; ++i)
+		pthread_create(&x->s[i].tid, NULL, send_thread, &x->s[i]);
+	return x;
+}
+
+int xport_send(struct xport *x, unsigned long offset, const void *data, unsigned long len)
+{
+	struct xport_item item;
+	const char *p = data;
+	unsigned long n;
+
+	item.buf = NULL;
+	item.type = XPORT_DATA;
+	while(len > 0)
+	{
+		if(x->failed)
+			return -1;
+		n = x->chunk - offset % x->chunk;
+		if(n > len)
+			n = len;
+		item.offset = offset;
+		item.data = p;
+		item.len = n;
+		push(x, &item);
+
+		offset += n;
+		p += n;
+		len -= n;
+		if(offset > x->total)
+			x->total = offset;
+	}
+	return 0;
+}
+
+static void flush_cur(struct xport *x)
+{
+	struct xport_item item;
+
+	if(x->cur == NULL || x->cur_len == 0)
+		return;
+	item.offset = x->pos - x->cur_len;
+	item.data = x->cur;
+	item.len = x->cur_len;
+	item.buf = x->cur;
+	item.type = XPORT_DATA;
+	if(x->pos > x->total)
+		x->total = x->pos;
+	x->cur = NULL;
+	x->cur_len = 0;
+	push(x, &item);
+}
+
+int xport_sink(void *ctx, const void *buf, unsigned long len)
+{
+	struct xport *x = ctx;
+	const char *p = buf;
+	unsigned long n;
+	int fresh;
+
+	while(len > 0)
+	{
+		if(x->failed)
+			return -1;
+		if(x->cur == NULL)
+		{
+			//the pool is bounded too: a buffer comes back with every sent frame
+			pthread_mutex_lock(&x->lock);
+			while(x->nbufs == 0 && x->len == x->depth)
+				pthread_cond_wait(&x->cond, &x->lock);
+			fresh = x->nbufs == 0;
+			if(!fresh)
+				x->cur = x->bufs[--x->nbufs];
+			pthread_mutex_unlock(&x->lock);
+			if(fresh)
+				x->cur = malloc(x->chunk);
+			if(x->cur == NULL)
+				return -1;
+		}
+
+		//frames stay chunk-aligned
+		n = x->chunk - x->pos % x->chunk;
+		if(n > len)
+			n = len;
+		memcpy(x->cur + x->cur_len, p, n);
+		x->cur_len += n;
+		x->pos += n;
+		p += n;
+		len -= n;
+		if(x->pos % x->chunk == 0)
+			flush_cur(x);
+	}
+	return 0;
+}
+
+int xport_end(struct xport *x)
+{
+	struct xport_item item;
+	int i, ret;
+
+	flush_cur(x);
+	item.offset = x->total;
+	item.data = NULL;
+	item.len = 0;
+	item.buf = NULL;
+	item.type = XPORT_END;
+	//one per stream: a thread takes no more frames until its END is acked
+	for(i = 0; i < x->nstreams; ++i)
+		push(x, &item);
+
+	pthread_mutex_lock(&x->lock);
+	while(x->acked < x->nstreams)
+		pthread_cond_wait(&x->cond, &x->lock);
+	ret = x->failed ? -1 : 0;
+	x->acked = 0;
+	x->failed = 0;
+	pthread_mutex_unlock(&x->lock);
+
+	x->total = 0;
+	x->pos = 0;
+	return ret;
+}
+
+void xport_close(struct xport *x)
+{
+	struct xport_item item;
+	int i;
+
+	memset(&item, 0, sizeof(item));
+	item.type = -1;
+	for(i = 0; i < x->nstreams; ++i)
+		push(x, &item);
+	for(i = 0; i < x->nstreams; ++i)
+	{
+		pthread_join(x->s[i].tid, NULL);
+		close(x->s[i].fd);
+	}
+
+	free(x->cur);
+	for(i = 0; i < x->nbufs; ++i)
+		free(x->bufs[i]);
+	free_xport(x);
+}
+
+/* receiver */
+
+struct xport_recv* xport_listen(int port)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct xport_recv *r;
+	int one = 1;
+
+	r = calloc(1, sizeof(*r));
+	if(r == NULL)
+		return NULL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(port);
+
+	r->lfd = socket(PF_INET, SOCK_STREAM, 0);
+	if(r->lfd < 0)
+	{
+		perror("socket");
+		free(r);
+		return NULL;
+	}
+	setsockopt(r->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(bind(r->lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+			listen(r->lfd, XPORT_MAX_STREAMS) < 0 ||
+			getsockname(r->lfd, (struct sockaddr*)&addr, &len) < 0)
+	{
+		perror("bind");
+		close(r->lfd);
+		free(r);
+		return NULL;
+	}
+	r->port = ntohs(addr.sin_port);
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	return r;
+}
+
+//the streams of one sender; the first HELLO tells how many
+int xport_accept(struct xport_recv *r)
+{
+	struct xport_frame f;
+	int i;
+
+	r->nstreams = 1;
+	for(i = 0; i < r->nstreams; ++i)
+	{
+		r->s[i].r = r;
+		r->s[i].fd = accept(r->lfd, NULL, NULL);
+		if(r->s[i].fd < 0 || recv_frame(r->s[i].fd, &f) != 0 || f.type != XPORT_HELLO ||
+				f.offset < 1 || f.offset > XPORT_MAX_STREAMS || f.len == 0 ||
+				(i > 0 && (f.offset != (unsigned long)r->nstreams || f.len != r->chunk)))
+		{
+			if(r->s[i].fd >= 0)
+				close(r->s[i].fd);
+			while(--i >= 0)
+				close(r->s[i].fd);
+			return -1;
+		}
+		nodelay(r->s[i].fd);
+		r->nstreams = f.offset;
+		r->chunk = f.len;
+	}
+	return 0;
+}
+
+//[offset, offset + len) of chunk offset / chunk has landed
+static void landed(struct xport_recv *r, unsigned long offset, unsigned long len)
+{
+	unsigned long c, want;
+
+	pthread_mutex_lock(&r->lock);
+	r->done[offset / r->chunk] += len;
+	for(c = r->contig / r->chunk; c < r->nchunks; ++c)
+	{
+		want = r->cap - c * r->chunk < r->chunk ? r->cap - c * r->chunk : r->chunk;
+		if(r->done[c] != want)
+			break;
+	}
+	if(c * r->chunk > r->contig)
+	{
+		r->contig = c * r->chunk < r->cap ? c * r->chunk : r->cap;
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void* recv_thread(void *arg)
+{
+	struct xport_stream *s = arg;
+	struct xport_recv *r = s->r;
+	struct xport_frame f;
+	int ok = 1;
+
+	while(ok)
+	{
+		ok = recv_frame(s->fd, &f) == 0;
+		if(!ok)
+			break;
+		if(f.type == XPORT_END)
+		{
+			pthread_mutex_lock(&r->lock);
+			//the total is the sender's word: past cap, it is no total at all
+			if(f.offset > r->cap || (r->total >= 0 && r->total != (long)f.offset))
+				r->failed = 1;
+			else
+				r->total = f.offset;
+			r->ended += 1;
+			//all there, holes included
+			if(r->ended == r->nstreams && !r->failed && r->total > (long)r->contig)
+				r->contig = r->total;
+			pthread_cond_broadcast(&r->cond);
+			pthread_mutex_unlock(&r->lock);
+			break;
+		}
+
+		//straight into place; a frame never crosses a chunk. offset + len may wrap
+		ok = f.type == XPORT_DATA && f.len > 0 && f.len <= r->cap && f.offset <= r->cap - f.len &&
+			f.offset / r->chunk == (f.offset + f.len - 1) / r->chunk &&
+			recv_full(s->fd, r->dest + f.offset, f.len) == 0;
+		if(!ok)
+			break;
+		landed(r, f.offset, f.len);
+		if(r->on_chunk != NULL)
+			r->on_chunk(r->ctx, f.offset, r->dest + f.offset, f.len);
+	}
+
+	if(!ok)
+	{
+		pthread_mutex_lock(&r->lock);
+		r->failed = 1;
+		r->ended += 1;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return NULL;
+}
+
+int xport_recv_start(struct xport_recv *r, char *dest, unsigned long cap, xport_chunk_t on_chunk,
+		void *ctx)
+{
+	int i;
+
+	r->dest = dest;
+	r->cap = cap;
+	r->on_chunk = on_chunk;
+	r->ctx = ctx;
+	r->nchunks = (cap + r->chunk - 1) / r->chunk;
+	r->done = calloc(r->nchunks + 1, sizeof(unsigned long));
+	if(r->done == NULL)
+		return -1;
+	r->contig = 0;
+	r->total = -1;
+	r->ended = 0;
+	r->failed = 0;
+	r->pos = 0;
+
+	for(i = 0; i < r->nstreams; ++i)
+		pthread_create(&r->s[i].tid, NULL, recv_thread, &r->s[i]);
+	return 0;
+}
+
+long xport_recv_wait(struct xport_recv *r)
+{
+	int i;
+
+	for(i = 0; i < r->nstreams; ++i)
+		pthread_join(r->s[i].tid, NULL);
+
+	//every stream is at its END: the transfer is complete, or it failed
+	if(r->total > (long)r->cap)
+		r->failed = 1;
+	for(i = 0; i < r->nstreams; ++i)
+	{
+		if(send_frame(r->s[i].fd, XPORT_ACK, r->failed, NULL, 0) != 0)
+			r->failed = 1;
+	}
+
+	free(r->done);
+	r->done = NULL;
+	return r->failed ? -1 : r->total;
+}
+
+int xport_source(void *ctx, void *buf, unsigned long len)
+{
+	struct xport_recv *r = ctx;
+
+	pthread_mutex_lock(&r->lock);
+	while(r->pos + len > r->contig && r->ended < r->nstreams && !r->failed)
+		pthread_cond_wait(&r->cond, &r->lock);
+	//the transfer ends short of pos + len, or it failed
+	if(r->pos + len > r->contig)
+	{
+		pthread_mutex_unlock(&r->lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	memcpy(buf, r->dest + r->pos, len);
+	r->pos += len;
+	return 0;
+}
+
+void xport_recv_close(struct xport_recv *r)
+{
+	int i;
+
+	for(i = 0; i < r->nstreams; ++i)
+		close(r->s[i].fd);
+	close(r->lfd);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r);
+}
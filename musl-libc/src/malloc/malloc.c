@@ -18,6 +18,14 @@ int __munmap(void *, size_t);
 void *__mremap(void *, size_t, size_t, int, ...);
 int __madvise(void *, size_t, int);
 
+/* Heap map hooks for the enclave dumper: dead / reused heap ranges.
+ * The enclave runtime overrides these. */
+static void dummy_heap_hook(void *p, size_t n) { }
+weak_alias(dummy_heap_hook, __heap_reclaim);
+weak_alias(dummy_heap_hook, __heap_reuse);
+void __heap_reclaim(void *, size_t);
+void __heap_reuse(void *, size_t);
+
 struct chunk {
 	size_t psize, csize;
 	struct chunk *next, *prev;
@@ -223,6 +231,7 @@ static int adjust_size(size_t *n)
 
 static void unbin(struct chunk *c, int i)
 {
+	__heap_reuse(c, CHUNK_SIZE(c));
 	if (c->prev == c->next)
 		a_and_64(&mal.binmap, ~(1ULL<<i));
 	c->prev->next = c->next;
@@ -296,6 +305,9 @@ static int pretrim(struct chunk *self, size_t n, int i, int j)
 	split->csize = n1-n;
 	next->psize = n1-n;
 	self->csize = n | C_INUSE;
+	/* self stays binned as split: the part handed out, and
+	 * the header of split, must leave any heap hole. */
+	__heap_reuse(self, n + SIZE_ALIGN);
 	return 1;
 }
 
@@ -523,6 +535,7 @@ void free(void *p)
 		uintptr_t b = (uintptr_t)next - SIZE_ALIGN & -PAGE_SIZE;
 #if 1
 		__madvise((void *)a, b-a, MADV_DONTNEED);
+		if (b > a) __heap_reclaim((void *)a, b-a);
 #else
 		__mmap((void *)a, b-a, PROT_READ|PROT_WRITE,
 			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
@@ -0,0 +1,403 @@
+/*
+ * Migration manager: evacuate many enclaves at once.
+ *
+ * usage: manager [options] enclave[@deadline ms] ...
+ *   -u path   the user binary (./user)
+ *   -B GB/s   memory bandwidth the migrations may use (default: memcpy, measured)
+ *   -r GB/s   bandwidth of one migration (default: learned from the first one)
+ *   -d ms     deadline of the enclaves that have none (0: no deadline)
+ *   -w ms     wait between all enclaves up and the evacuation (1000)
+ *   -t s      how long an enclave may take to come up (60)
+ *   -l dir    output of the enclaves, dir/enclave-<n>.log (/tmp)
+ *   -k        kill the enclaves once evacuated, instead of waiting for them
+ *
+ * Every enclave runs in its own user process (one enclave per process, see
+ * manager.h) and is migrated out with SIGUSR1. Deadlines count from the start
+ * of the evacuation. The migrations wait in deadline order (EDF; the smaller
+ * enclave first on a tie) and start while the bandwidth of the running ones
+ * stays within -B. Until a migration has run alone, one runs at a time: its
+ * live bytes over its time is the bandwidth of one migration.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "manager.h"
+#include "mytime.h"
+
+#define MAX_ENCLAVES 256
+#define POLL_MS 100
+
+enum {
+	J_START = 0, //waiting for NOTE_READY
+	J_READY,
+	J_RUNNING,
+	J_DONE,
+	J_FAILED,
+};
+
+static const char *state_name[] = { "start", "ready", "running", "done", "failed" };
+
+struct job {
+	const char *enclave;
+	pid_t pid;
+	int state;
+	unsigned long deadline; //us after the evacuation starts, 0: none
+	unsigned long size; //of the enclave, from NOTE_READY
+	int alone; //no other migration while it ran
+	//us after the evacuation starts
+	unsigned long start;
+	unsigned long end;
+	//NOTE_OUT
+	unsigned long bytes;
+	unsigned long us;
+};
+
+static struct job jobs[MAX_ENCLAVES];
+static int njobs;
+static int notify_rd;
+static unsigned long evac_start;
+
+static double budget = 0; //bytes per us
+static double rate = 0; //of one migration, bytes per us; 0: not known yet
+static int running = 0;
+static int max_running = 0;
+
+//bytes per us (= MB/s) of memcpy over a buffer too large for the caches
+static double measure_bandwidth()
+{
+	unsigned long size = 256UL << 20, start, t;
+	char *a, *b;
+	int i;
+
+	a = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	b = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(a == MAP_FAILED || b == MAP_FAILED)
+		return 1000;
+	memset(a, 1, size);
+	memset(b, 2, size);
+	start = get_time();
+	for(i = 0; i < 4; ++i)
+		memcpy(i % 2 ? a : b, i % 2 ? b : a, size);
+	t = get_time() - start;
+	munmap(a, size);
+	munmap(b, size);
+	return t ? (double)size * 4 / t : 1000;
+}
+
+static void spawn(struct job *j, int n, const char *user, const char *logdir, int notify_wr)
+{
+	char path[4096], fd[16];
+	int log;
+
+	j->pid = fork();
+	if(j->pid < 0)
+	{
+		perror("fork");
+		j->state = J_FAILED;
+		return;
+	}
+	if(j->pid > 0)
+		return;
+
+	snprintf(fd, sizeof(fd), "%d", notify_wr);
+	setenv("MIGRATE_NOTIFY_FD", fd, 1);
+	snprintf(path, sizeof(path), "%s/enclave-%d.log", logdir, n);
+	log = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(log >= 0)
+	{
+		dup2(log, 1);
+		dup2(log, 2);
+		close(log);
+	}
+	execl(user, user, j->enclave, (char*)NULL);
+	perror("exec");
+	_exit(127);
+}
+
+static struct job* find(pid_t pid)
+{
+	int i;
+
+	for(i = 0; i < njobs; ++i)
+	{
+		if(jobs[i].pid == pid)
+			return &jobs[i];
+	}
+	return NULL;
+}
+
+static unsigned long now()
+{
+	return get_time() - evac_start;
+}
+
+static void finish(struct job *j, int state)
+{
+	if(j->state == J_RUNNING)
+	{
+		running -= 1;
+		j->end = now();
+	}
+	j->state = state;
+
+	//the bandwidth of one migration, from those that ran alone
+	if(state == J_DONE && j->alone && j->us > 0)
+	{
+		if(rate == 0)
+			rate = (double)j->bytes / j->us;
+		else
+			rate = rate * 0.75 + (double)j->bytes / j->us * 0.25;
+	}
+}
+
+static void on_note(struct migrate_note *note)
+{
+	struct job *j = find(note->pid);
+
+	if(j == NULL)
+		return;
+	if(note->type == NOTE_READY && j->state == J_START)
+	{
+		j->size = note->bytes;
+		j->state = J_READY;
+	}
+	else if(note->type == NOTE_OUT && j->state == J_RUNNING)
+	{
+		j->bytes = note->bytes;
+		j->us = note->us;
+		finish(j, J_DONE);
+	}
+	else if(note->type == NOTE_FAIL && j->state == J_RUNNING)
+	{
+		printf("[manager] %s cannot migrate out\n", j->enclave);
+		finish(j, J_FAILED);
+	}
+}
+
+//wait up to ms for notes and dead children
+static void poll_notes(int ms)
+{
+	static char buf[64 * sizeof(struct migrate_note)];
+	static int fill = 0;
+	struct pollfd p;
+	struct job *j;
+	pid_t pid;
+	int ret, status, i;
+
+	p.fd = notify_rd;
+	p.events = POLLIN;
+	if(poll(&p, 1, ms) > 0)
+	{
+		ret = read(notify_rd, buf + fill, sizeof(buf) - fill);
+		if(ret > 0)
+		{
+			fill += ret;
+			for(i = 0; i + (int)sizeof(struct migrate_note) <= fill; i += sizeof(struct migrate_note))
+				on_note((struct migrate_note*)(buf + i));
+			memmove(buf, buf + i, fill - i);
+			fill -= i;
+		}
+	}
+
+	while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		j = find(pid);
+		if(j == NULL)
+			continue;
+		j->pid = -1;
+		if(j->state != J_DONE)
+		{
+			printf("[manager] %s exited (status %d) while %s\n", j->enclave, status,
+					state_name[j->state]);
+			finish(j, J_FAILED);
+		}
+	}
+}
+
+//earliest deadline first; no deadline is the latest
+static int before(struct job *a, struct job *b)
+{
+	unsigned long da = a->deadline ? a->deadline : -1UL;
+	unsigned long db = b->deadline ? b->deadline : -1UL;
+
+	if(da != db)
+		return da < db;
+	return a->size < b->size;
+}
+
+static void admit()
+{
+	struct job *next;
+	int i;
+
+	while(1)
+	{
+		next = NULL;
+		for(i = 0; i < njobs; ++i)
+		{
+			if(jobs[i].state == J_READY && (next == NULL || before(&jobs[i], next)))
+				next = &jobs[i];
+		}
+		if(next == NULL)
+			return;
+		//one at a time until the rate is known; always at least one
+		if(running > 0 && (rate == 0 || (running + 1) * rate > budget))
+			return;
+
+		next->state = J_RUNNING;
+		next->start = now();
+		next->alone = (running == 0);
+		for(i = 0; i < njobs; ++i)
+		{
+			if(jobs[i].state == J_RUNNING && &jobs[i] != next)
+				jobs[i].alone = 0;
+		}
+		running += 1;
+		if(running > max_running)
+			max_running = running;
+		if(kill(next->pid, SIGUSR1) != 0)
+			finish(next, J_FAILED);
+	}
+}
+
+static int count(int state)
+{
+	int i, n = 0;
+
+	for(i = 0; i < njobs; ++i)
+		n += (jobs[i].state == state);
+	return n;
+}
+
+static void report()
+{
+	struct job *j;
+	unsigned long last = 0, bytes = 0;
+	int i, missed = 0;
+
+	printf("  #  pid          MiB  live MiB  deadline ms  start ms  end ms  migrate ms  status\n");
+	for(i = 0; i < njobs; ++i)
+	{
+		j = &jobs[i];
+		if(j->state == J_DONE)
+		{
+			bytes += j->bytes;
+			if(j->end > last)
+				last = j->end;
+			if(j->deadline && j->end > j->deadline)
+				missed += 1;
+		}
+		printf("%3d  %-7d  %7.1f  %8.1f  %11lu  %8.1f  %6.1f  %10.1f  %s%s  %s\n", i, j->pid,
+				j->size / 1048576.0, j->bytes / 1048576.0, j->deadline / 1000,
+				j->start / 1000.0, j->end / 1000.0, j->us / 1000.0, state_name[j->state],
+				(j->deadline && j->end > j->deadline) ? " (late)" : "", j->enclave);
+	}
+	printf("evacuated %d of %d enclaves: %.1f MiB live in %.1f ms (%.2f GB/s), "
+			"%d deadlines missed, at most %d at once\n", count(J_DONE), njobs,
+			bytes / 1048576.0, last / 1000.0, last ? (double)bytes / last / 1000 : 0,
+			missed, max_running);
+	printf("bandwidth: %.2f GB/s, one migration: %.2f GB/s\n", budget / 1000, rate / 1000);
+}
+
+int main(int argc, char **argv)
+{
+	const char *user = "./user", *logdir = "/tmp";
+	unsigned long deadline = 0, wait_ms = 1000, up_s = 60, start;
+	int fds[2], opt, kill_after = 0, i;
+	char *at;
+
+	while((opt = getopt(argc, argv, "u:B:r:d:w:t:l:k")) != -1)
+	{
+		switch(opt)
+		{
+		case 'u': user = optarg; break;
+		case 'B': budget = atof(optarg) * 1000; break;
+		case 'r': rate = atof(optarg) * 1000; break;
+		case 'd': deadline = strtoul(optarg, NULL, 0) * 1000; break;
+		case 'w': wait_ms = strtoul(optarg, NULL, 0); break;
+		case 't': up_s = strtoul(optarg, NULL, 0); break;
+		case 'l': logdir = optarg; break;
+		case 'k': kill_after = 1; break;
+		default:
+			printf("usage: %s [-u user] [-B GB/s] [-r GB/s] [-d ms] [-w ms] [-t s] [-l dir] [-k] "
+					"enclave[@deadline ms] ...\n", argv[0]);
+			return 1;
+		}
+	}
+	if(optind >= argc || argc - optind > MAX_ENCLAVES)
+	{
+		printf("%s: 1 to %d enclaves\n", argv[0], MAX_ENCLAVES);
+		return 1;
+	}
+	if(budget <= 0)
+		budget = measure_bandwidth();
+
+	//the children only get the write end
+	if(pipe2(fds, O_CLOEXEC) != 0)
+	{
+		perror("pipe");
+		return 1;
+	}
+	fcntl(fds[1], F_SETFD, 0);
+	notify_rd = fds[0];
+
+	for(i = optind; i < argc; ++i)
+	{
+		struct job *j = &jobs[njobs];
+
+		j->enclave = argv[i];
+		j->deadline = deadline;
+		at = strrchr(argv[i], '@');
+		if(at != NULL)
+		{
+			*at = 0;
+			j->deadline = strtoul(at + 1, NULL, 0) * 1000;
+		}
+		spawn(j, njobs, user, logdir, fds[1]);
+		njobs += 1;
+	}
+	close(fds[1]);
+
+	start = get_time();
+	evac_start = start;
+	while(count(J_START) > 0 && get_time() - start < up_s * 1000000)
+		poll_notes(POLL_MS);
+	for(i = 0; i < njobs; ++i)
+	{
+		if(jobs[i].state == J_START)
+		{
+			printf("[manager] %s did not come up\n", jobs[i].enclave);
+			jobs[i].state = J_FAILED;
+		}
+	}
+	printf("[manager] %d of %d enclaves up in %lu ms\n", count(J_READY), njobs,
+			(get_time() - start) / 1000);
+	usleep(wait_ms * 1000);
+
+	//the evacuation
+	evac_start = get_time();
+	while(count(J_READY) + count(J_RUNNING) > 0)
+	{
+		admit();
+		poll_notes(POLL_MS);
+	}
+	report();
+
+	for(i = 0; i < njobs; ++i)
+	{
+		if(kill_after && jobs[i].pid > 0)
+			kill(jobs[i].pid, SIGTERM);
+	}
+	while(wait(NULL) > 0 || errno == EINTR)
+		;
+	return count(J_DONE) == njobs ? 0 : 1;
+}
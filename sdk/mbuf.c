@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#include "mbuf.h"
+#include "profile.h"
+#include "mytime.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static char *mbuf = NULL;
+static unsigned long mbuf_size;
+static int mbuf_huge = 0;
+
+static pthread_t prefault_tid;
+static volatile int prefaulting = 0;
+
+static void* prefault_thread(void *arg)
+{
+	unsigned long i;
+	unsigned long step;
+	sigset_t sigs;
+#if PROFILE
+	unsigned long start = get_time();
+#endif
+
+	//the migration signals go to the enclave threads
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	//hugetlb pages are already reserved by mmap, but not yet zeroed/mapped
+	if(madvise(mbuf, mbuf_size, MADV_POPULATE_WRITE) != 0)
+	{
+		step = mbuf_huge ? HUGE_PAGE_SIZE : 0x1000;
+		for(i = 0; i < mbuf_size; i += step)
+			((volatile char*)mbuf)[i] = 0;
+	}
+
+#if PROFILE
+	printf("[mbuf] pre-faulted 0x%lx bytes (%s pages): %ld us\n", mbuf_size,
+			mbuf_huge ? "hugetlb" : "thp", get_time() - start);
+#endif
+	return NULL;
+}
+
+static int mbuf_map()
+{
+	void *addr;
+
+	//2 MiB pages from the hugetlb pool, if there are enough
+	addr = mmap((void*)MBUF_ADDR, mbuf_size, PROT_READ|PROT_WRITE|PROT_EXEC,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_HUGETLB, -1, 0);
+	if(addr != MAP_FAILED)
+	{
+		mbuf_huge = 1;
+	}
+	else
+	{
+		addr = mmap((void*)MBUF_ADDR, mbuf_size, PROT_READ|PROT_WRITE|PROT_EXEC,
+				MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+		if(addr == MAP_FAILED)
+		{
+			perror("[mbuf] mmap");
+			return -1;
+		}
+		mbuf_huge = 0;
+		madvise(addr, mbuf_size, MADV_HUGEPAGE);
+	}
+
+	mbuf = addr;
+	prefaulting = 1;
+	assert(pthread_create(&prefault_tid, NULL, prefault_thread, NULL) == 0);
+	return 0;
+}
+
+int mbuf_init(unsigned long size)
+{
+	mbuf_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	return mbuf_map();
+}
+
+char* mbuf_get()
+{
+	//moved into the app by the last migration: reserve another one now
+	if(mbuf == NULL && mbuf_size != 0 && mbuf_map() != 0)
+		return NULL;
+	if(prefaulting)
+	{
+		pthread_join(prefault_tid, NULL);
+		prefaulting = 0;
+	}
+	return mbuf;
+}
+
+char* mbuf_move(void *dst, unsigned long size)
+{
+	char *buf;
+
+	//hugetlb pages cannot be write-protected one 4 KiB page at a time,
+	//which pre-copy needs on the native image
+	if(mbuf_huge || mbuf == NULL)
+		return NULL;
+
+	buf = mremap(mbuf_get(), size, size, MREMAP_MAYMOVE|MREMAP_FIXED, dst);
+	if(buf == MAP_FAILED)
+	{
+		perror("[mbuf] mremap");
+		return NULL;
+	}
+
+	//its pages are the app's now; the next mbuf_get reserves a new buffer,
+	//so a native run does not keep a second image resident meanwhile
+	mbuf = NULL;
+	return buf;
+}
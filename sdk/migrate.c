@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <ucontext.h>
 #include <assert.h>
 #include <pthread.h>
 #include <sys/mman.h>
@@ -10,6 +12,15 @@
 #include <sys/prctl.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/random.h>
+#include <cpuid.h>
+#include <sys/auxv.h>
+#include <setjmp.h>
 
 #include "function_table.h"
 #include "isgx_user.h"
@@ -17,15 +28,24 @@
 #include "vars.h"
 #include "profile.h"
 #include "head.h"
+#include "precopy.h"
+#include "postcopy.h"
+#include "dump.h"
+#include "mbuf.h"
+#include "timeline.h"
+#include "snapshot.h"
+#include "manager.h"
+#include "switchless.h"
+#include "uring.h"
+#include "checkpoint.h"
+#include "path_config.h"
 
 #define EEXIT_OFFSET 0xb1
 
-extern unsigned long mmap_size;
 extern unsigned long code_size;
 extern unsigned long data_size;
 
 int arch_prctl(int code, unsigned long addr);
-extern unsigned is_memcached;
 
 char *dump_addr = NULL;
 volatile int dump_flag = 0; //migrate out flag
@@ -33,18 +53,89 @@ volatile int put_in_flag = 0; //migrate in flag
 
 volatile int *see_flag;
 volatile int *see_flag_in;
+volatile int *thread_state;
+//quiescence barrier: number of threads that have seen the flag (futex word)
+static volatile int arrived = 0;
+//when each thread reached loop_for_dump, and when the flag was raised
+static unsigned long *arrive_time;
+static unsigned long quiesce_start;
+//migrate-out: send the IPI again if a thread is still running in the enclave
+#define IPI_RESEND_US 1000
 struct enclave_config ecfg;
 
 unsigned long main_thread_fsbase;
 
+__thread int migrate_tcs = 0;
+
+//number of enclave threads doing the dump (MIGRATE_WORKERS overrides it)
+#define DUMP_WORKERS 4
+//PROFILE: dump with 1, 2, 4 and 8 workers and report each
+#define DUMP_WORKER_SWEEP 0
+static int dump_workers = DUMP_WORKERS;
+static struct dump_desc dump_desc[MAX_DUMP_WORKERS];
+//live ranges of the last dump
+struct dump_extent dump_extents[MAX_DUMP_EXTENTS];
+int dump_nextents;
+//the dump leaves the enclave encrypted (AES-GCM); only the enclave opens it
+//again (DUMP_OPEN), the keys never leave it in the clear (dump.h)
+#define SEAL_DUMP 1
+//workers done with the dump (dump_desc.done)
+static volatile int dump_done;
+static unsigned seal_seq = 0;
+//the keys of the seal and of root_mac, wrapped by the enclave
+static struct seal_wrap seal_wrap;
+#if SEAL_DUMP
+static unsigned char *seal_tags;
+#endif
+//the enclave also hashes the dump into a Merkle tree, and checks it when it
+//opens the dump. MIGRATE_MERKLE=0: without, for a dump of more than
+//MAX_MERKLE_PIECES pieces
+#define MERKLE_DUMP 1
+#if MERKLE_DUMP
+static int merkle_on = 1;
+static unsigned char *merkle_leaves;
+static unsigned char merkle_root[MERKLE_HASH_LEN];
+static unsigned char merkle_mac[MERKLE_HASH_LEN];
+static int sha_ni = 0;
+#endif
+
+//MIGRATE_NOTIFY_FD: where the manager waits for the notes (manager.h)
+static int notify_fd = -1;
+//signal of the migration under way
+static unsigned long note_start;
+
+//native: the app makes the syscalls it may by itself while [0] is 0 (the TLS
+//word at TLS_SAFEPOINT points here, see ocall_syscall_wrapper.c); 1 sends them
+//back to the ocalls, where a migration finds the threads. [1]: the threads
+//in such a syscall right now
+#define TLS_SAFEPOINT 0x800 //as in enclave/include/vars.h
+static volatile int safepoint[2];
+static int direct_syscall = 1; //MIGRATE_DIRECT=0: always ocalls
+
+//write the dump to a file at each migrate-out (MIGRATE_SNAPSHOT overrides snapshot_path)
+#define SNAPSHOT 1
+//MIGRATE_DELTA=1: migrate-in only moves the pages changed since the last migrate-out
+#define DELTA_CKPT 1
+
+extern __thread unsigned long outside_buffer;
+void outside_trampoline();
+void return_enclave(unsigned long);
+
 //For creating a migrated thread inside enclave: migrate out to temp buffer)
 int SGX_pthread_create(unsigned long, unsigned long, unsigned long*);
 //No need to create a new thread. Directly copy the app into the buffer
 void migrate_app_to_temp_buffer(char*);
 void create_enclave_at_runtime(char *);
 
-#define ENABLE_OPTIMIZATION 1
-#if ENABLE_OPTIMIZATION
+//migrate-out: how the native app is rebuilt from the dump
+#define REBUILD_COPY 0 //map the range again and copy back
+#define REBUILD_KERNEL 1 //memmove_by_kernel: needs our ENCLS_EWB_IOCTL hook
+#define REBUILD_POSTCOPY 2 //resume at once and fetch pages on first touch
+#define REBUILD_REMAP 3 //move the dump mapping onto the enclave range
+#define REBUILD_MODE REBUILD_REMAP
+//migrate-in: copy code/heap while the native app keeps running
+#define ENABLE_PRECOPY 1
+#if REBUILD_MODE == REBUILD_KERNEL
 //invoke new system call
 extern int encls(int sgxfd, int ioctl_num,void* rcx,void* rbx,void* rdx);
 
@@ -103,57 +194,27 @@ static void bin_rewrite_to_enclu(char *buf)
 
 }
 
-static int continue_notify()
+//Safepoint: a thread that is out of the enclave for an ocall does not touch
+//the app until it comes back through loop_for_dump, so it is already quiescent.
+//Set the state, then read the flags (loop_for_dump); the migration thread
+//sets the flag, then reads the states. One of the two sees the other.
+static inline int not_quiescent(volatile int *seen, int i)
 {
-	int i;
-
-	//currently, the migration thread is not created.
-	//0 is the main thread (current thread)
-	//printf("continue_notify: %d threads\n", next_enclave_thread_id - 1);
-	for(i = 2; i < next_enclave_thread_id; ++i)
-	{
-		//printf("see_flag: 2-> %d, 3->%d\n", see_flag[2], see_flag[3]);
-		if(see_flag[i] == 0)
-		{
-			//printf("see_flag[0] is %d, see_flag[1] is %d, see_flag[2] is %d, see_flag[3] is %d\n", 
-			//		see_flag[0], see_flag[1], see_flag[2], see_flag[3]);
-			return 1;
-		}
-	}
-	return 0;
+	return !seen[i] && (thread_state[i] == THREAD_RUNNING);
 }
 
-#if 0
 static int continue_notify()
 {
 	int i;
 
 	//currently, the migration thread is not created.
-	//0 is the main thread (current thread)
-	//printf("continue_notify: %d threads\n", next_enclave_thread_id - 1);
-	for(i = 1; i < next_enclave_thread_id; ++i)
+	for(i = 0; i < next_enclave_thread_id; ++i)
 	{
-		//printf("see_flag: 0-> %d, 1->%d, 2->%d\n", see_flag[0], see_flag[1], see_flag[2]);
-		if(is_memcached)
-		{
-			//TODO: just for memcached with one worker thread
-			/*
-			 * Not change mutex for memcached. see in the set_env.c
-				if(see_flag[2] == 0) return 1;
-			*/
-
-			//Not change mutex for memcached. see in the set_env.c
-			return 0;
-		}
-		else
-		{
-			if(see_flag[i] == 0)
-				return 1;
-		}
+		if(not_quiescent(see_flag, i))
+			return 1;
 	}
 	return 0;
 }
-#endif
 
 static void reset_flag()
 {
@@ -163,9 +224,128 @@ static void reset_flag()
 	{
 			see_flag[i] = 0;
 			see_flag_in[i] = 0;
+			arrive_time[i] = 0;
+	}
+	arrived = 0;
+}
+
+static inline long futex_wait(volatile int *addr, int val, unsigned long us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, us ? &ts : NULL, NULL, 0);
+}
+
+static inline long futex_wake(volatile int *addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+//change dump_flag/put_in_flag and release the threads parked on it
+static void set_flag(volatile int *flag, int val)
+{
+	*flag = val;
+	futex_wake(flag);
+}
+
+//a thread in loop_for_dump: tell the migration thread once per migration
+static void arrive(volatile int *seen, unsigned idx)
+{
+	if(seen[idx])
+		return;
+	arrive_time[idx] = get_time();
+	seen[idx] = 1;
+	__sync_fetch_and_add(&arrived, 1);
+	futex_wake(&arrived);
+}
+
+void migrate_notify(int type, unsigned long bytes, unsigned long us)
+{
+	struct migrate_note note;
+
+	if(notify_fd < 0)
+		return;
+	note.pid = getpid();
+	note.type = type;
+	note.bytes = bytes;
+	note.us = us;
+	//the manager is gone: stop telling it
+	if(write(notify_fd, &note, sizeof(note)) != sizeof(note))
+		notify_fd = -1;
+}
+
+//MIGRATE_TIMELINE overrides timeline_path; empty: do not export
+static void export_timeline()
+{
+	const char *path = timeline_path;
+
+	if(getenv("MIGRATE_TIMELINE"))
+		path = getenv("MIGRATE_TIMELINE");
+	if(path == NULL || path[0] == 0)
+		return;
+	if(tl_export(path) != 0)
+		printf("[timeline] cannot export to %s\n", path);
+}
+
+void set_thread_state(int state)
+{
+	unsigned idx;
+
+	if(migrate_tcs)
+		return;
+	idx = (tcs_p - tcs_addr[0]) / 0x3000;
+	thread_state[idx] = state;
+
+	//one less thread to wait for
+	if((state != THREAD_RUNNING) && ((dump_flag == 1) || (put_in_flag == 1)))
+	{
+		__sync_fetch_and_add(&arrived, 1);
+		futex_wake(&arrived);
 	}
 }
 
+//wait until everyone has seen the flag; ipi: kick the threads out of the enclave
+static void wait_quiescent(int (*pending)(), int ipi)
+{
+	unsigned long last_ipi = 0;
+	unsigned long now;
+	int cnt;
+
+	//the flag is set: order it before reading the thread states
+	__sync_synchronize();
+
+	while(1)
+	{
+		//read the counter before checking: an arrival after it breaks the wait
+		cnt = arrived;
+		if(!pending())
+			break;
+
+		now = get_time();
+		//native: no AEX, the threads stop at their next ocall
+		if(ipi && !native_mode && now - last_ipi >= IPI_RESEND_US)
+		{
+			ioctl(sgxfd, SGX_IOC_ENCLAVE_INT, NULL);
+			last_ipi = now;
+		}
+		futex_wait(&arrived, cnt, IPI_RESEND_US);
+	}
+
+#if PROFILE
+	{
+		int i;
+
+		for(i = 0; i < next_enclave_thread_id; ++i)
+		{
+			if(arrive_time[i])
+				printf("[TIME] thread %d quiescent: %ld us\n", i, arrive_time[i] - quiesce_start);
+		}
+	}
+#endif
+}
+
 struct enclave_tls *self; // point to itself  
 unsigned etid; // enclave thread ID           
 int _errno;                                   
@@ -214,76 +394,604 @@ void check_content()
 
 #if PROFILE
 unsigned long migrate_start, migrate_end; //time
+unsigned long downtime_start;
 #endif
 
 //when receiving a signal inside enclave, the enclave will exit 
 //and the fs will be restored automatically.
-static void migrate_handler(int signum)
+//idle TCSs lie between the app threads and the migrate thread
+static int get_dump_workers(int want)
+{
+	int spare;
+
+	spare = tcs_num - 1 - next_enclave_thread_id;
+	if(want > MAX_DUMP_WORKERS)
+		want = MAX_DUMP_WORKERS;
+	if(want > spare + 1)
+		want = spare + 1;
+	if(want < 1)
+		want = 1;
+	return want;
+}
+
+//one pass of the n dump workers over dump_addr
+static void run_workers(int n, int op)
+{
+	unsigned long tid[MAX_DUMP_WORKERS];
+	int i;
+
+	dump_done = 0;
+	for(i = 0; i < n; ++i)
+	{
+		dump_desc[i].op = op;
+		dump_desc[i].seal_cycles = 0;
+		dump_desc[i].failed = 0;
+		SGX_pthread_create(i == 0 ? MIGRATE : MIGRATE_WORKER,
+				(unsigned long)&dump_desc[i], &tid[i]);
+	}
+	for(i = 0; i < n; ++i)
+		pthread_join(tid[i], NULL);
+}
+
+#if PROFILE
+//GB/s per core of the seal_chunk/seal_open cycles of the workers
+static double seal_rate(int n, unsigned long bytes)
+{
+	unsigned long c = 0, us;
+	int i;
+
+	for(i = 0; i < n; ++i)
+		c += dump_desc[i].seal_cycles;
+	us = tl_cycles_us(c);
+	return us ? (double)bytes / us / 1000 : 0;
+}
+#endif
+
+//dump the enclave into dump_addr with up to want enclave threads
+static void run_dump(int want)
+{
+	int i, n;
+#if PROFILE
+	unsigned long start = get_time();
+	unsigned long live = 0;
+#endif
+
+	n = get_dump_workers(want);
+	if(n < want)
+		printf("[dump] only %d idle TCS: %d workers instead of %d\n", n - 1, n, want);
+
+	//IV prefix, and what tells the workers their keys are there: never 0
+	if(++seal_seq == 0)
+		seal_seq = 1;
+	for(i = 0; i < n; ++i)
+	{
+		dump_desc[i].seq = seal_seq;
+		dump_desc[i].done = &dump_done;
+		dump_desc[i].native = native_mode;
+		dump_desc[i].timed = PROFILE;
+		dump_desc[i].wrap = (i == 0) ? &seal_wrap : NULL;
+#if SEAL_DUMP
+		dump_desc[i].seal = 1;
+		dump_desc[i].tags = seal_tags;
+#endif
+#if MERKLE_DUMP
+		if(merkle_on)
+		{
+			dump_desc[i].leaves = merkle_leaves;
+			dump_desc[i].root = merkle_root;
+			dump_desc[i].root_mac = merkle_mac;
+		}
+		dump_desc[i].sha_ni = sha_ni;
+#endif
+		dump_desc[i].out = dump_addr;
+		dump_desc[i].code_size = code_size;
+		dump_desc[i].data_size = data_size;
+		dump_desc[i].extents = (i == 0) ? dump_extents : NULL;
+		dump_desc[i].nextents = 0;
+		dump_desc[i].worker = i;
+		dump_desc[i].nworkers = n;
+		dump_desc[i].nthreads = next_enclave_thread_id;
+	}
+	run_workers(n, DUMP_SEAL);
+	dump_nextents = dump_desc[0].nextents;
+
+#if PROFILE
+	for(i = 0; i < dump_nextents; ++i)
+		live += dump_extents[i].len;
+	printf("[dump] %d extents, 0x%lx of 0x%lx bytes live\n", dump_nextents, 
+			live, enclave_size);
+	printf("[TIME] dump with %d workers: %ld us\n", n, get_time() - start);
+	#if SEAL_DUMP
+	printf("[TIME] sealed %.2f GB/s per core\n", seal_rate(n, live));
+	#endif
+#endif
+
+	if(dump_desc[0].failed == DUMP_NO_KEYS)
+	{
+		printf("[dump] the enclave cannot draw or wrap its keys\n");
+		exit(-1);
+	}
+	if(dump_desc[0].failed == DUMP_TOO_BIG)
+	{
+		printf("[dump] more than %d pieces for the merkle tree: MIGRATE_MERKLE=0 to dump without\n",
+				MAX_MERKLE_PIECES);
+		exit(-1);
+	}
+
+	//the native app is rebuilt from the dump: the enclave opens it first,
+	//decrypts it and checks it against root_mac
+	if(dump_desc[0].seal || dump_desc[0].root_mac != NULL)
+	{
+#if PROFILE
+		start = get_time();
+#endif
+		run_workers(n, DUMP_OPEN);
+		for(i = 0; i < n; ++i)
+		{
+			if(dump_desc[i].failed)
+			{
+				printf("[dump] the dump does not verify\n");
+				exit(-1);
+			}
+		}
+#if PROFILE
+		printf("[TIME] open with %d workers: %ld us\n", n, get_time() - start);
+	#if SEAL_DUMP
+		printf("[TIME] opened %.2f GB/s per core\n", seal_rate(n, live));
+	#endif
+#endif
+	}
+}
+
+//map the enclave range again and copy the dump back
+static char* copy_back()
+{
+	char *new_addr;
+
+	new_addr = mmap((void*)enclave_mapaddr, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC, 
+				MAP_SHARED|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+
+	//printf("new_addr is 0x%lx\n", (unsigned long)new_addr);
+	assert((unsigned long)new_addr == enclave_mapaddr);
+
+	//memcpy is much faster
+	memcpy(new_addr, dump_addr, enclave_size);
+
+	return new_addr;
+}
+
+#if SNAPSHOT
+//copy_back, with the extents alone: the rest reads as zero, as in the snapshot
+static char* copy_live()
 {
-	//int ret;
-	unsigned long tid;
 	char *new_addr;
+	int i;
+
+	new_addr = mmap((void*)enclave_mapaddr, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC, 
+				MAP_SHARED|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+	assert((unsigned long)new_addr == enclave_mapaddr);
+	for(i = 0; i < dump_nextents; ++i)
+		memcpy(new_addr + dump_extents[i].offset, dump_addr + dump_extents[i].offset,
+				dump_extents[i].len);
+	return new_addr;
+}
+
+/*
+ * The dump is plaintext now: keep it, with what is needed to resume the
+ * threads. The header is taken in the downtime, the file is written after
+ * the resume from the dump the app was rebuilt from, which stays put until
+ * snapshot_wait(): the next migration waits before it reuses the buffer.
+ */
+static pthread_t snapshot_tid;
+static int snapshotting = 0;
+static struct snap_header *snapshot_h;
+static const char *snapshot_image;
+
+//the header of the running migrate-out, or NULL: no snapshot
+static struct snap_header* snapshot_header(unsigned long idx, int old_state)
+{
+	const char *path = snapshot_path;
+	struct snap_header *h;
+	int i;
+
+	if(getenv("MIGRATE_SNAPSHOT"))
+		path = getenv("MIGRATE_SNAPSHOT");
+	if(path == NULL || path[0] == 0)
+		return NULL;
+	if(tcs_num > SNAP_MAX_THREADS)
+	{
+		printf("[snapshot] %d TCS: no snapshot\n", tcs_num);
+		return NULL;
+	}
+
+	h = calloc(1, sizeof(*h));
+	assert(h != NULL);
+	h->cfg = ecfg;
+	h->mapaddr = enclave_mapaddr;
+	h->size = enclave_size;
+	h->code_size = code_size;
+	h->data_size = data_size;
+	h->trampoline = (unsigned long)outside_trampoline;
+	h->tcs_num = tcs_num;
+	h->nthreads = next_enclave_thread_id;
+	for(i = 0; i < tcs_num; ++i)
+	{
+		h->thread_state[i] = thread_state[i];
+		h->tcs_addr[i] = tcs_addr[i];
+	}
+	//the signalled thread is only IN_HOST for the handler
+	h->thread_state[idx] = old_state;
+	h->nextents = dump_nextents;
+	memcpy(h->extents, dump_extents, dump_nextents * sizeof(struct dump_extent));
+	return h;
+}
+
+//write it (path.tmp, fdatasync, then the rename) and free h
+static void snapshot_write(struct snap_header *h, const char *image)
+{
+	const char *path = snapshot_path;
+#if PROFILE
+	unsigned long start = get_time();
+#endif
+
+	if(getenv("MIGRATE_SNAPSHOT"))
+		path = getenv("MIGRATE_SNAPSHOT");
+	if(snapshot_save(path, h, image) != 0)
+		printf("[snapshot] cannot save to %s\n", path);
+#if PROFILE
+	else
+		printf("[TIME] snapshot to %s: %ld us\n", path, get_time() - start);
+#endif
+	free(h);
+}
+
+static void* snapshot_thread(void *arg)
+{
+	sigset_t sigs;
+
+	//the migration signals go to the enclave threads
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	snapshot_write(snapshot_h, snapshot_image);
+	return NULL;
+}
+
+//the snapshot is on disk: its dump may be overwritten
+static void snapshot_wait()
+{
+	if(snapshotting)
+	{
+		pthread_join(snapshot_tid, NULL);
+		snapshotting = 0;
+	}
+}
+
+//write h and image in the background
+static void snapshot_start(struct snap_header *h, const char *image)
+{
+	if(h == NULL)
+		return;
+	snapshot_wait();
+	snapshot_h = h;
+	snapshot_image = image;
+	snapshotting = 1;
+	assert(pthread_create(&snapshot_tid, NULL, snapshot_thread, NULL) == 0);
+}
+#endif
+
+#if DELTA_CKPT
+/*
+ * Delta checkpoints for ping-pong migration (checkpoint.h):
+ *
+ * The migration buffer is the receiver's retained image. A migrate-out leaves
+ * the dump in it (the app is rebuilt by copy, not by moving the buffer), and
+ * both ends of the next migrate-in take it as their base: a thread hashes it
+ * while the app runs. Round 0 of the pre-copy then streams only the pages
+ * whose hash changed and applies them on top of the buffer. A migrate-in
+ * leaves the buffer out of step with the hashes (later rounds, rewriting):
+ * without a migrate-out in between, the next one is a full checkpoint.
+ */
+#define MAX_DELTA_RANGES 2
+static int delta_on = 0;
+static struct delta_range {
+	unsigned long first; //pages of the image
+	unsigned long npages;
+	struct ckpt_delta tx; //the app
+	struct ckpt_delta rx; //the buffer
+} delta_ranges[MAX_DELTA_RANGES];
+static int delta_nranges = 0;
+static uint64_t delta_seq = 0;
+static pthread_t rebase_tid;
+static volatile int rebasing = 0;
+static unsigned long delta_bytes;
+
+static void delta_add_range(unsigned long first, unsigned long npages)
+{
+	struct delta_range *r = &delta_ranges[delta_nranges];
+
+	assert(delta_nranges < MAX_DELTA_RANGES);
+	r->first = first;
+	r->npages = npages;
+	assert(ckpt_delta_init(&r->tx, npages) == 0);
+	assert(ckpt_delta_init(&r->rx, npages) == 0);
+	delta_nranges += 1;
+}
+
+//the ranges round 0 copies
+static void delta_init()
+{
+#if ENABLE_PRECOPY
+	delta_add_range(0, ecfg.code_pages);
+	delta_add_range(ecfg.code_pages + ecfg.data_pages, ecfg.heap_pages);
+#else
+	delta_add_range(0, enclave_size / CKPT_PAGE_SIZE);
+#endif
+}
+
+static void* rebase_thread(void *arg)
+{
+	char *base = arg;
+	struct delta_range *r;
+	sigset_t sigs;
+	int i;
+#if PROFILE
+	unsigned long start = get_time();
+#endif
+
+	//the migration signals go to the enclave threads
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	delta_seq += 1;
+	for(i = 0; i < delta_nranges; ++i)
+	{
+		r = &delta_ranges[i];
+		ckpt_delta_base(&r->tx, base + r->first * CKPT_PAGE_SIZE, delta_seq);
+		memcpy(r->rx.hash, r->tx.hash, r->npages * CKPT_HASH_LEN);
+		r->rx.seq = delta_seq;
+	}
+#if PROFILE
+	printf("[TIME] delta base: %ld us\n", get_time() - start);
+#endif
+	return NULL;
+}
+
+static void delta_wait()
+{
+	if(rebasing)
+	{
+		pthread_join(rebase_tid, NULL);
+		rebasing = 0;
+	}
+}
+
+//migrate-out is done: buf holds the image the app was rebuilt from
+static void delta_rebase(char *buf)
+{
+	if(!delta_on)
+		return;
+	delta_wait();
+	rebasing = 1;
+	assert(pthread_create(&rebase_tid, NULL, rebase_thread, buf) == 0);
+}
+
+//migrate-in is done: the next base comes with the next migrate-out
+static void delta_drop()
+{
+	int i;
+
+	for(i = 0; i < delta_nranges; ++i)
+		delta_ranges[i].tx.seq = delta_ranges[i].rx.seq = 0;
+}
+
+//stream pages [first, first + npages) of image as a delta onto dst
+static void delta_copy(char *dst, const char *image, unsigned long first, unsigned long npages)
+{
+	struct delta_range *r = NULL;
+	struct ckpt_opts tx, rx;
+	struct ckpt_stat stat;
+	struct ckpt_buf b;
+	long len = -1;
+	int i;
+
+	for(i = 0; i < delta_nranges; ++i)
+	{
+		if(delta_ranges[i].first == first && delta_ranges[i].npages == npages)
+			r = &delta_ranges[i];
+	}
+	//worst case: every page raw, one record each
+	b.size = sizeof(struct ckpt_header) + (npages + 2) * sizeof(struct ckpt_record) + npages * CKPT_PAGE_SIZE;
+	b.buf = mmap(NULL, b.size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if(r == NULL || b.buf == MAP_FAILED)
+	{
+		memcpy(dst + first * CKPT_PAGE_SIZE, image + first * CKPT_PAGE_SIZE, npages * CKPT_PAGE_SIZE);
+		if(b.buf != MAP_FAILED)
+			munmap(b.buf, b.size);
+		return;
+	}
+
+	memset(&tx, 0, sizeof(tx));
+	memset(&rx, 0, sizeof(rx));
+	tx.delta = &r->tx;
+	rx.delta = &r->rx;
+	b.pos = 0;
+	len = ckpt_write_opts(image + first * CKPT_PAGE_SIZE, npages, ckpt_buf_sink, &b, &stat, &tx);
+	b.size = b.pos;
+	b.pos = 0;
+	if(len < 0 || ckpt_read_opts(dst + first * CKPT_PAGE_SIZE, npages, ckpt_buf_source, &b, 0, &rx) < 0)
+	{
+		printf("[delta] pages 0x%lx+0x%lx: bad checkpoint, full copy\n", first, npages);
+		memcpy(dst + first * CKPT_PAGE_SIZE, image + first * CKPT_PAGE_SIZE, npages * CKPT_PAGE_SIZE);
+		r->tx.seq = r->rx.seq = 0;
+	}
+	else
+	{
+		delta_bytes += len;
+		printf("[delta] pages 0x%lx+0x%lx: %lu unchanged, %ld bytes\n",
+				first, npages, stat.same_pages, len);
+	}
+	munmap(b.buf, b.size);
+}
+#endif
+
+//native: the signal may stop the app on the fs of its enclave TLS; the TLS holds
+//the host fs (0x40, as in the rewritten EEXIT). Return the fs to put back.
+static unsigned long host_fs()
+{
+	unsigned long fs = read_fs();
+
+	if(native_mode && fs >= enclave_mapaddr && fs < enclave_mapaddr + enclave_size)
+		write_fs(*(unsigned long*)(fs + 0x40));
+	return fs;
+}
+
+//after safepoint[0] = 1: the direct syscalls under way are done, the next
+//ones are ocalls. Not from a handler: it may have stopped one of them
+static void drain_direct()
+{
+	__sync_synchronize();
+	while(safepoint[1] != 0)
+		sched_yield();
+}
+
+//the safepoint word in the TLS of every thread of the image at base
+static void set_safepoint(char *base, int on)
+{
+	int i;
+
+	for(i = 0; i < tcs_num; ++i)
+		*(unsigned long*)(base + (tcs_addr[i] - enclave_mapaddr) + 2 * 0x1000 + TLS_SAFEPOINT) =
+			(on && direct_syscall) ? (unsigned long)safepoint : 0;
+}
+
+#if REBUILD_MODE == REBUILD_POSTCOPY
+//the prefetcher has every page in: the kernel can touch the app again
+static void postcopy_resident()
+{
+	set_safepoint((char*)enclave_mapaddr, 1);
+}
+#endif
+
+//native: the signal stops the app anywhere, with no AEX to save its rsp in the
+//SSA (GPRSGX_RSP of enclave/migration.c); the dump takes the stack from there.
+//Its last ocall is no bound: direct syscalls go deeper.
+#define SSA_RSP (2 * 0x1000 - 184 + 4 * 8)
+static void save_native_rsp(void *ctx)
+{
+	unsigned long rsp = ((ucontext_t*)ctx)->uc_mcontext.gregs[REG_RSP];
+
+	if(native_mode && rsp >= enclave_mapaddr && rsp < enclave_mapaddr + enclave_size)
+		*(unsigned long*)(tcs_p + SSA_RSP) = rsp;
+}
+
+//no migration buffer (no room at MBUF_ADDR): a plain one, kept for the next
+//migration as well. The dump is the same, only not pre-faulted
+static char* dump_buffer()
+{
+	static char *plain = NULL;
+	char *buf = mbuf_get();
+
+	if(buf != NULL)
+		return buf;
+	if(plain == NULL)
+	{
+		printf("[mbuf] no migration buffer: falling back to a plain mmap\n");
+		buf = mmap(NULL, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC,
+				MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		assert(buf != MAP_FAILED);
+		plain = buf;
+	}
+	return plain;
+}
+
+static void migrate_handler(int signum, siginfo_t *si, void *ctx)
+{
+	char *new_addr;
+	int old_state, i;
+	unsigned long fsbase;
+	unsigned long live = 0;
 
 	unsigned long idx;
+#if SNAPSHOT
+	struct snap_header *snap;
+#endif
 
+	if(fs_mode == FS_NONE)
+	{
+		printf("[migrate-out] no FSGSBASE in user mode: the app stays in the enclave\n");
+		migrate_notify(NOTE_FAIL, 0, 0);
+		return;
+	}
+	fsbase = host_fs();
 	idx = (tcs_p - tcs_addr[0]) / 0x3000;
+	save_native_rsp(ctx);
 	printf("***************************************\n");
+	tl_begin(TL_OUT);
+	note_start = get_time();
 	printf("[migrate-out start] thread %ld receive signal: %d\n", idx, signum);
+	//interrupted by AEX (or already out): resumes through loop_for_dump
+	old_state = thread_state[idx];
+	thread_state[idx] = THREAD_IN_HOST;
 
 #if PROFILE
 	migrate_start = get_time();
 #endif
 	
-	if(dump_addr == NULL)
-	{
-		//dump_addr = malloc(0x4000 * 0x1000);
-
-		dump_addr = mmap((void*)0x600000000000, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC, 
-				MAP_SHARED|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
-		//printf("[mediate buffer] mmap return 0x%lx\n", (unsigned long)dump_addr);
-		//assert((long)dump_addr != -1);
-		*(unsigned long*)dump_addr = code_size;	
-		*(((unsigned long*)dump_addr)+1) = data_size;	
-		*(((unsigned long*)dump_addr)+2) = mmap_size;	
-	}
+#if SNAPSHOT
+	//the last snapshot is still written from the buffer
+	snapshot_wait();
+#endif
+	//pre-faulted in the background since create_enclave
+	dump_addr = dump_buffer();
 
+	tl_mark(TL_SIGNAL);
+	quiesce_start = get_time();
+	safepoint[0] = 1;
 	dump_flag = 1;
 
-	while(continue_notify())
-	{
-		ioctl(sgxfd, SGX_IOC_ENCLAVE_INT, NULL);
-		break;
-		//ret = ioctl(sgxfd, SGX_IOC_ENCLAVE_INT, NULL);
-		//printf("[IPI]\n");
-	};
+	wait_quiescent(continue_notify, 1);
+	tl_mark(TL_QUIESCE);
 
 #if PROFILE
 	migrate_end = get_time();
 	printf("[TIME] reach the quiencent point: %ld us\n", (migrate_end - migrate_start));
 #endif
 
-#if ENABLE_OPTIMIZATION
-	{
-		char *touch_addr = (char*)0x600000000000;
-		unsigned long touch_i;
-		for(touch_i = 0; touch_i < enclave_size; touch_i+=0x1000)
-		{
-			touch_addr[touch_i] = 'a';
-		}
-		printf("pre-touching done\n");
-	}
-#endif
-
 	printf("Everyone see the flag.\n");
 
 #if PROFILE
 	migrate_start = get_time();
 #endif
 	
-	SGX_pthread_create(MIGRATE, (unsigned long)dump_addr, &tid);
-	//ret = SGX_pthread_create(MIGRATE, (unsigned long)dump_addr, &tid);
-	//assert(ret == 0);
-	pthread_join(tid, NULL);
+#if PROFILE && DUMP_WORKER_SWEEP
+	{
+		int n;
+		//the app is stopped: every round dumps the same state
+		for(n = 1; n <= MAX_DUMP_WORKERS; n *= 2)
+			run_dump(n);
+	}
+#else
+	run_dump(dump_workers);
+#endif
+	tl_mark(TL_DUMP);
+	for(i = 0; i < dump_nextents; ++i)
+		live += dump_extents[i].len;
+	tl_bytes(live);
+
+#if SNAPSHOT
+	snap = snapshot_header(idx, old_state);
+	#if REBUILD_MODE == REBUILD_KERNEL
+	//the kernel moves the dump away: nothing is left to write after the resume
+	if(snap != NULL)
+		snapshot_write(snap, dump_addr);
+	snap = NULL;
+	#endif
+#endif
 
 #if PROFILE
 	migrate_end = get_time();
@@ -300,7 +1008,7 @@ static void migrate_handler(int signum)
 
 	//copy back to the original enclave range
 	//first step: destroy original enclave
-	#if !ENABLE_OPTIMIZATION
+	#if REBUILD_MODE != REBUILD_KERNEL
 	munmap((void*)enclave_mapaddr, enclave_size); 
 	#endif
 
@@ -308,58 +1016,83 @@ static void migrate_handler(int signum)
 	migrate_start = get_time();
 #endif
 
-	#if ENABLE_OPTIMIZATION
+	#if REBUILD_MODE == REBUILD_POSTCOPY
+	//rewrite the checkpoint so that faulted-in code is already patched
+	bin_rewrite_enclu(dump_addr + EEXIT_OFFSET);
+	new_addr = (void*)enclave_mapaddr;
+	if(postcopy_start(dump_addr, enclave_mapaddr, enclave_size, postcopy_resident) != 0)
+	{
+		//no userfaultfd: eager copy
+		new_addr = copy_back();
+		bin_rewrite_enclu(new_addr + EEXIT_OFFSET);
+	}
+	#elif REBUILD_MODE == REBUILD_KERNEL
 		//printf("**************** invoke memmove_by_kernel\n");
 		new_addr = (void*)enclave_mapaddr;
 		memmove_by_kernel(dump_addr, new_addr, enclave_size);	
-	#else
-	//next step: copy back
-	new_addr = mmap((void*)enclave_mapaddr, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC, 
-				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
-
-	//printf("new_addr is 0x%lx\n", (unsigned long)new_addr);
-	assert((unsigned long)new_addr == enclave_mapaddr);
-
-	//memcpy is much faster
-	#if 0
-	for(i = 0; i < enclave_size; ++i)
-		new_addr[i] = dump_addr[i];
+	#elif REBUILD_MODE == REBUILD_REMAP
+	//the dump becomes the app: no copy back. A delta keeps it as the base
+	new_addr = NULL;
+	#if DELTA_CKPT
+	if(!delta_on)
 	#endif
-	memcpy(new_addr, dump_addr, enclave_size);
-
-	//check_content();
-
-	/*
-	printf("[check] %02x\n", ((unsigned char*)new_addr)[0xa8]);
-	printf("[check] %02x\n", ((unsigned char*)new_addr)[0xa9]);
-	printf("[check] %02x\n", ((unsigned char*)new_addr)[0xaa]);
-
-	printf("[check] %02x\n", ((unsigned char*)new_addr)[0xf6]);
-	printf("[check] %02x\n", ((unsigned char*)new_addr)[0xf7]);
-	printf("[check] %02x\n", ((unsigned char*)new_addr)[0xf8]);
-	*/
+	{
+	#if SNAPSHOT
+		//a snapshot is written from it: only its live bytes are copied
+		if(snap != NULL)
+			new_addr = copy_live();
+		else
+	#endif
+		new_addr = mbuf_move((void*)enclave_mapaddr, enclave_size);
+	}
+	if(new_addr == NULL)
+		new_addr = copy_back();
+	#else
+	new_addr = copy_back();
 	#endif
+	tl_mark(TL_REBUILD);
 
 	//binary rewriting: take place EEXIT with wrfsbase + JMP
+	#if REBUILD_MODE != REBUILD_POSTCOPY
 	bin_rewrite_enclu(new_addr + EEXIT_OFFSET);
+	#endif
+	#if REBUILD_MODE == REBUILD_POSTCOPY
+	//direct syscalls only once the kernel may fault pages in (postcopy_resident)
+	set_safepoint(new_addr, postcopy_kernel_faults());
+	#else
+	set_safepoint(new_addr, 1);
+	#endif
+	tl_mark(TL_REWRITE);
 
 #if PROFILE
 	migrate_end = get_time();
+	#if REBUILD_MODE == REBUILD_POSTCOPY
+	printf("[TIME] post-copy first instruction: %ld us\n", (migrate_end - migrate_start));
+	#else
 	printf("[TIME] rebuild the application: %ld us\n", (migrate_end - migrate_start));
-#endif
-
-	#if !ENABLE_OPTIMIZATION	
-	//delete intermediate buffer
-	munmap(dump_addr, enclave_size);
 	#endif
+#endif
 
+#if DELTA_CKPT && REBUILD_MODE != REBUILD_KERNEL
+	delta_rebase(dump_addr);
+#endif
+#if SNAPSHOT
+	//out of the downtime: the app resumes while it is written
+	snapshot_start(snap, dump_addr);
+#endif
 	dump_addr = NULL;
-	dump_flag = 2; //switch execution from enclave to normal
+	set_flag(&dump_flag, 2); //switch execution from enclave to normal
+	safepoint[0] = 0;
+	tl_end();
 	//for next migration
 	put_in_flag = 0;
 	reset_flag();
+	thread_state[idx] = old_state;
+	export_timeline();
+	migrate_notify(NOTE_OUT, live, get_time() - note_start);
 
 	printf("***************************************\n");
+	write_fs(fsbase);
 }
 
 static int continue_wait()
@@ -371,18 +1104,8 @@ static int continue_wait()
 	//This is different from migrate out due to no AEX.
 	for(i = 0; i < next_enclave_thread_id; ++i)
 	{
-		if(is_memcached)
-		{
-			//TODO: just for memcached with one worker thread
-			//if((see_flag_in[0] == 0) || (see_flag_in[2] == 0))  //mutex is sleeping
-			if((see_flag_in[0] == 0)) 
-				return 1;
-		}
-		else
-		{
-			if(see_flag_in[i] == 0)
-				return 1;
-		}
+		if(not_quiescent(see_flag_in, i))
+			return 1;
 	}
 	return 0;
 }
@@ -481,24 +1204,51 @@ static void* put_in_migrate_thread(void *arg)
 
 	printf("************migrate-in**************\n");
 
-	//allocate temporary buffer
-	if(dump_addr == NULL)
-	{
-		//dump_addr = malloc(0x4000 * 0x1000);
-		dump_addr = mmap(NULL, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC, 
-				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
-		printf("[temp buffer] mmap return 0x%lx\n", (unsigned long)dump_addr);
-		//assert((long)dump_addr != -1);
-	}
+#if REBUILD_MODE == REBUILD_POSTCOPY
+	//the last migrate-out may still be fetching pages
+	postcopy_wait();
+#endif
+
+#if SNAPSHOT
+	//the last migrate-out may still write its snapshot from the buffer
+	snapshot_wait();
+#endif
+	//the same buffer as migrate-out
+	dump_addr = dump_buffer();
+#if DELTA_CKPT
+	delta_wait();
+	delta_bytes = 0;
+#endif
+
+#if ENABLE_PRECOPY
+	//write-protected pages fail the syscalls in the kernel with EFAULT
+	drain_direct();
+	//the app is still running: copy code and heap in rounds
+	assert(precopy_init(enclave_mapaddr, enclave_size) == 0);
+	precopy_track(0, ecfg.code_pages * PS);
+	precopy_track((ecfg.code_pages + ecfg.data_pages) * PS, ecfg.heap_pages * PS);
+#if DELTA_CKPT
+	precopy_rounds(dump_addr, delta_on ? delta_copy : NULL);
+#else
+	precopy_rounds(dump_addr, NULL);
+#endif
+
+	//now stop the threads
+	quiesce_start = get_time();
+	put_in_flag = 1;
+	#if PROFILE
+	downtime_start = get_time();
+	#endif
+#endif
 
 	#if PROFILE
 	migrate_start = get_time();
 	#endif
 
-	while(continue_wait() == 1)
-	{
-		//sleep(1);
-	}
+	tl_mark(TL_SIGNAL);
+	//no AEX in the native app: threads stop at their next ocall
+	wait_quiescent(continue_wait, 0);
+	tl_mark(TL_QUIESCE);
 
 	#if PROFILE
 	migrate_end = get_time();
@@ -511,10 +1261,24 @@ static void* put_in_migrate_thread(void *arg)
 
 	//migrate the app into temp buffer(dump_addr)
 	//migrate_app_to_temp_buffer(dump_addr);
+#if ENABLE_PRECOPY
+	precopy_finish(dump_addr);
+#elif DELTA_CKPT
+	if(delta_on)
+		delta_copy(dump_addr, (char*)enclave_mapaddr, 0, enclave_size / PS);
+	else
+		memcpy(dump_addr, (void*)enclave_mapaddr, enclave_size);
+#else
 	memcpy(dump_addr, (void*)enclave_mapaddr, enclave_size);
+#endif
+	tl_mark(TL_DUMP);
+
+	tl_bytes(enclave_size);
 
 	//binary rewriting: take place EEXIT with wrfsbase + JMP
-	bin_rewrite_to_enclu(dump_addr + EEXIT_OFFSET);
+	if(!native_mode)
+		bin_rewrite_to_enclu(dump_addr + EEXIT_OFFSET);
+	tl_mark(TL_REWRITE);
 
 	#if PROFILE
 	migrate_end = get_time();
@@ -537,8 +1301,19 @@ static void* put_in_migrate_thread(void *arg)
 	//first step: destroy the original app
 	munmap((void*)enclave_mapaddr, enclave_size);
 
-	//next step: create the new enclave
-	create_enclave_at_runtime(dump_addr);
+	if(native_mode)
+	{
+		//no SGX: the image goes back to the same range, as in migrate-out
+		if(mbuf_move((void*)enclave_mapaddr, enclave_size) == NULL)
+			copy_back();
+		tl_mark(TL_REBUILD);
+	}
+	else
+	{
+		//next step: create the new enclave; back to ocalls only
+		set_safepoint(dump_addr, 0);
+		create_enclave_at_runtime(dump_addr);
+	}
 
 	#if PROFILE
 	migrate_end = get_time();
@@ -546,15 +1321,29 @@ static void* put_in_migrate_thread(void *arg)
 	printf("************************end of migrate-in**********************\n");
 	#endif
 
-	//delete intermediate buffer
-	munmap(dump_addr, enclave_size);
+	//keep the intermediate buffer for the next migration
 	dump_addr = NULL;
+#if DELTA_CKPT
+	if(delta_on)
+	{
+		printf("[delta] migrate-in moved %lu bytes\n", delta_bytes);
+		delta_drop();
+	}
+#endif
+
+	set_flag(&put_in_flag, 2); //switch execution into enclave
+	tl_end();
 
-	put_in_flag = 2; //switch execution into enclave
+#if ENABLE_PRECOPY && PROFILE
+	printf("[TIME] migrate-in downtime: %ld us\n", get_time() - downtime_start);
+#endif
 	
-	//for next migration
-	dump_flag = 0;
+	//for next migration; native: still out of the enclave
+	dump_flag = native_mode ? 2 : 0;
+	safepoint[0] = 0;
 	reset_flag();
+	export_timeline();
+	migrate_notify(NOTE_IN, enclave_size, get_time() - note_start);
 
 	return NULL;
 }
@@ -573,11 +1362,18 @@ static void migrate_handler_2(int signum)
 	fsbase = read_fs();
 	write_fs(main_thread_fsbase);
 
+	tl_begin(TL_IN);
+	note_start = get_time();
 	idx = (tcs_p - tcs_addr[0]) / 0x3000;
 	printf("[migrate in] thread %ld receive signal: %d\n", idx, signum);
 	assert(idx == 0);
 
+	//pre-copy too: what the kernel writes into the app is tracked at the ocalls
+	safepoint[0] = 1;
+#if !ENABLE_PRECOPY
+	quiesce_start = get_time();
 	put_in_flag = 1;
+#endif
 
 	printf("create a thread preparing for migrate in\n");
 	ret = pthread_create((pthread_t *)&tid, NULL, put_in_migrate_thread, NULL);
@@ -587,18 +1383,21 @@ static void migrate_handler_2(int signum)
 	write_fs(fsbase);
 }
 
-static char msig_stack[SIGSTKSZ];
+//the whole migrate-out runs on it: SIGSTKSZ (8K) overflows into the globals
+//in front of it
+#define MSIG_STACK_SIZE 0x100000
+static char msig_stack[MSIG_STACK_SIZE];
 
 void install_migrate_handler()
 {
 	stack_t ss = {
-		.ss_size = SIGSTKSZ,
+		.ss_size = MSIG_STACK_SIZE,
 		.ss_sp = msig_stack,
 	};
 
 	struct sigaction sa = {    
-		.sa_handler = migrate_handler, 
-		.sa_flags = SA_ONSTACK 
+		.sa_sigaction = migrate_handler, 
+		.sa_flags = SA_ONSTACK | SA_SIGINFO
 	};
 
 	struct sigaction sa_2 = {    
@@ -623,9 +1422,15 @@ void loop_for_dump()
 
 	idx = (tcs_p - tcs_addr[0]) / 0x3000; 
 
+	//back from the host: read the flags only after this is visible
+	if(!migrate_tcs)
+	{
+		thread_state[idx] = THREAD_RUNNING;
+		__sync_synchronize();
+	}
 
 	//while((dump_flag == 1) && (tcs_p != tcs_addr[tcs_num - 1]))
-	while((dump_flag == 1) && (idx != tcs_num - 1))
+	while((dump_flag == 1) && !migrate_tcs)
 	{
 		/*
 		if(idx == 1)
@@ -636,43 +1441,175 @@ void loop_for_dump()
 		}
 		*/
 
-		see_flag[idx] = 1;
-		printf("loop: tid %d\n", idx);
-		sleep(1);
+		arrive(see_flag, idx);
+		futex_wait(&dump_flag, 1, 0);
 	}
 
 	while(put_in_flag == 1)
 	{
-		see_flag_in[idx] = 1;
-		//printf("loop: tid %d see flag_in\n", idx);
-		//sleep(1);
+		arrive(see_flag_in, idx);
+		futex_wait(&put_in_flag, 1, 0);
+	}
+}
+
+//user --native: the image at base is the app, as after a migrate-out
+void start_native(char *base)
+{
+	if(fs_mode == FS_NONE)
+	{
+		printf("[native] no FSGSBASE in user mode (Linux 5.9+): cannot run natively\n");
+		exit(-1);
 	}
+	bin_rewrite_enclu(base + EEXIT_OFFSET);
+	set_safepoint(base, 1);
+	dump_flag = 2;
 }
 
 void init_migrate()
 {
 	int i;
 
+	//reserve the intermediate buffer now, not during the downtime
+	if(mbuf_init(enclave_size) != 0)
+		printf("[mbuf] cannot reserve the migration buffer\n");
+
+	if(getenv("MIGRATE_WORKERS"))
+		dump_workers = atoi(getenv("MIGRATE_WORKERS"));
+
+	//a restored image holds the seq of the dump it came from (migration.c)
+	if(getrandom(&seal_seq, sizeof(seal_seq), 0) != sizeof(seal_seq))
+		seal_seq = (unsigned)get_time();
+
+#if DELTA_CKPT
+	if(getenv("MIGRATE_DELTA"))
+		delta_on = atoi(getenv("MIGRATE_DELTA"));
+	if(delta_on)
+		delta_init();
+#endif
+
+	tl_init();
+
+	if(getenv("MIGRATE_NOTIFY_FD"))
+		notify_fd = atoi(getenv("MIGRATE_NOTIFY_FD"));
+
+	if(getenv("MIGRATE_DIRECT"))
+		direct_syscall = atoi(getenv("MIGRATE_DIRECT"));
+
+#if SEAL_DUMP
+	seal_tags = malloc(enclave_size / SEAL_TAG_SLOT * SEAL_TAG_LEN);
+	assert(seal_tags != NULL);
+#endif
+
+#if MERKLE_DUMP
+	if(getenv("MIGRATE_MERKLE"))
+		merkle_on = atoi(getenv("MIGRATE_MERKLE"));
+	//one leaf per chunk, plus a partial chunk per extent
+	merkle_leaves = malloc((enclave_size / SEAL_CHUNK + MAX_DUMP_EXTENTS) * MERKLE_HASH_LEN);
+	assert(merkle_leaves != NULL);
+	{
+		//cpuid faults in the enclave: tell it about SHA-NI
+		unsigned int eax, ebx, ecx, edx;
+		if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			sha_ni = (ebx >> 29) & 1;
+	}
+#endif
+
 	see_flag = (int*)malloc(tcs_num * sizeof(int));
 	see_flag_in = (int*)malloc(tcs_num * sizeof(int));
+	arrive_time = (unsigned long*)malloc(tcs_num * sizeof(unsigned long));
+	thread_state = (int*)malloc(tcs_num * sizeof(int));
 
 	for(i = 0; i < tcs_num; ++i)
 	{
 		see_flag[i] = 0;
 		see_flag_in[i] = 0;
+		arrive_time[i] = 0;
+		//not entered yet
+		thread_state[i] = THREAD_IN_HOST;
 	}
 }
 
+//How the host moves FS (see vars.h). The rewritten EEXIT needs wrfsbase in
+//user mode: without it, the app only runs in an enclave.
+int fs_mode = FS_PRCTL;
+
+//HWCAP2_FSGSBASE of <asm/hwcap2.h>: the kernel enabled the instructions
+#define HWCAP_FSGSBASE (1 << 1)
+
+static sigjmp_buf fs_probe_env;
+
+static void fs_probe_sigill(int signum)
+{
+	siglongjmp(fs_probe_env, 1);
+}
+
+//A module (e.g. for the SGX1 driver) may set CR4.FSGSBASE on a kernel that
+//does not say so in HWCAP2: try the instructions, SIGILL if they are off
+static int fs_probe()
+{
+	struct sigaction sa, old;
+	volatile int ok = 0;
+	unsigned long fs;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fs_probe_sigill;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGILL, &sa, &old);
+	if(sigsetjmp(fs_probe_env, 1) == 0)
+	{
+		asm volatile("rdfsbase %0\n\t" : "=r"(fs));
+		asm volatile("wrfsbase %0\n\t" :: "r"(fs) : "memory");
+		ok = 1;
+	}
+	sigaction(SIGILL, &old, NULL);
+	return ok;
+}
+
+void init_fs_mode()
+{
+	char *env = getenv("MIGRATE_FSGSBASE");
+	int mode;
+
+	if(getauxval(AT_HWCAP2) & HWCAP_FSGSBASE)
+		fs_mode = FS_KERNEL;
+	else if(fs_probe())
+		fs_mode = FS_PRCTL;
+	else
+		fs_mode = FS_NONE;
+
+	//e.g. MIGRATE_FSGSBASE=0: arch_prctl only even if the instructions work
+	if(env == NULL)
+		return;
+	mode = atoi(env);
+	if(mode < FS_NONE || mode > FS_PRCTL)
+		printf("[fs] MIGRATE_FSGSBASE=%s: not %d, %d or %d, kept %d\n", env,
+				FS_NONE, FS_KERNEL, FS_PRCTL, fs_mode);
+	else if(mode != FS_NONE && fs_mode == FS_NONE)
+		printf("[fs] MIGRATE_FSGSBASE=%d: rdfsbase faults here, kept %d\n", mode, fs_mode);
+	else
+		fs_mode = mode;
+}
+
 unsigned long read_fs()
 {
-	unsigned long register rax asm("rax");	
-	asm volatile("rdfsbase %rax\n\t");
-	return rax;
+	unsigned long fs;
+
+	if(fs_mode == FS_NONE)
+	{
+		assert(arch_prctl(ARCH_GET_FS, (unsigned long)&fs) == 0);
+		return fs;
+	}
+	asm volatile("rdfsbase %0\n\t" : "=r"(fs));
+	return fs;
 }
 
 void write_fs(unsigned long fs)
 {
-	//asm volatile("wrfsbase %rdi\n\t");
+	if(fs_mode == FS_KERNEL)
+	{
+		asm volatile("wrfsbase %0\n\t" :: "r"(fs) : "memory");
+		return;
+	}
 	assert(arch_prctl(ARCH_SET_FS, fs) == 0);
 }
 
@@ -848,3 +1785,149 @@ void restore_enclave_thread()
 	restore_enclave_thread_ctx(gprsgx);
 }
 
+#if SNAPSHOT
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static unsigned long *restore_buffers;
+
+//the app may hold a pointer into the buffer of a pending ocall: map it where it was
+static unsigned long map_buffer(unsigned long old)
+{
+	unsigned long base = old & ~(PS - 1UL);
+	unsigned long len = old - base + COM_BUFFER_SIZE;
+	void *addr;
+
+	addr = mmap((void*)base, len, PROT_READ|PROT_WRITE, 
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+	if(addr == (void*)base)
+		return old;
+	//a kernel without MAP_FIXED_NOREPLACE takes it as a hint
+	if(addr != MAP_FAILED)
+		munmap(addr, len);
+
+	printf("[snapshot] buffer 0x%lx is taken: a pending ocall result is lost\n", old);
+	addr = malloc(COM_BUFFER_SIZE);
+	assert(addr != NULL);
+	return (unsigned long)addr;
+}
+
+//become enclave thread etid again; does not return
+static void resume_thread(int etid)
+{
+	unsigned long *tls;
+	char top;
+
+	tcs_p = tcs_addr[etid];
+	outside_buffer = restore_buffers[etid];
+
+	//the TLS still points at the host of the saved process
+	tls = (unsigned long*)(tcs_p + 2 * PS);
+	tls[4] = ((unsigned long)&top - PS) & ~0xfUL; //outside stack: ocalls run below this frame
+	tls[5] = outside_buffer;
+	tls[7] = (unsigned long)pthread_self();
+	tls[8] = read_fs(); //loaded by the rewritten EEXIT
+	tls[TLS_SAFEPOINT / 8] = direct_syscall ? (unsigned long)safepoint : 0;
+
+	printf("[snapshot] resume thread %d\n", etid);
+	if(thread_state[etid] == THREAD_IN_HOST)
+	{
+		//parked in an ocall: it is not done again
+		*(long*)outside_buffer = -EINTR;
+		return_enclave(SYSCALL_RET);
+	}
+	restore_enclave_thread();
+}
+
+static void* restore_thread(void *arg)
+{
+	resume_thread((int)(unsigned long)arg);
+	return NULL;
+}
+
+//user --restore: the app runs natively from a snapshot, without an enclave
+void restore_snapshot(const char *path, const char *enclave)
+{
+	struct enclave_config config;
+	struct snap_header *h;
+	pthread_t tid;
+	char *addr;
+	int fd, i;
+	unsigned long start = get_time();
+
+	h = malloc(sizeof(*h));
+	assert(h != NULL);
+	if(read_config(enclave, &config) == -1)
+	{
+		printf("[ERROR] Fail to read configuration.\n");
+		exit(-1);
+	}
+	fd = snapshot_open(path, h);
+	if(fd < 0 || snapshot_check(h, &config) != 0)
+	{
+		printf("[snapshot] cannot restore %s into %s\n", path, enclave);
+		exit(-1);
+	}
+	//the enclave jumps to host code by address
+	if(h->trampoline != (unsigned long)outside_trampoline)
+	{
+		printf("[snapshot] saved by another build of user (trampoline 0x%lx, here 0x%lx)\n",
+				h->trampoline, (unsigned long)outside_trampoline);
+		exit(-1);
+	}
+
+	ecfg = config;
+	enclave_mapaddr = h->mapaddr;
+	enclave_size = h->size;
+	code_size = h->code_size;
+	data_size = h->data_size;
+	tcs_num = h->tcs_num;
+	tcs_addr = malloc(tcs_num * sizeof(unsigned long));
+	memcpy(tcs_addr, h->tcs_addr, tcs_num * sizeof(unsigned long));
+	//no enclave now, but migrate-in needs the driver
+	sgxfd = open("/dev/isgx", O_RDWR);
+	if(sgxfd < 0)
+		printf("[snapshot] no /dev/isgx: cannot migrate in\n");
+	init_migrate();
+	sl_init();
+	ur_init();
+
+	addr = snapshot_map(fd, h);
+	close(fd);
+	if(addr == NULL)
+		exit(-1);
+	bin_rewrite_enclu(addr + EEXIT_OFFSET);
+	dump_flag = 2;
+
+	next_enclave_thread_id = h->nthreads;
+	//before anything else takes the addresses
+	restore_buffers = malloc(h->nthreads * sizeof(unsigned long));
+	for(i = 0; i < h->nthreads; ++i)
+	{
+		thread_state[i] = h->thread_state[i];
+		if(thread_state[i] != THREAD_EXITED)
+			restore_buffers[i] = map_buffer(*(unsigned long*)(tcs_addr[i] + 2 * PS + 40));
+	}
+	main_thread_fsbase = read_fs();
+
+#if PROFILE
+	printf("[TIME] restore %s: %ld us\n", path, get_time() - start);
+#else
+	printf("[snapshot] restored %s in %ld us\n", path, get_time() - start);
+#endif
+	migrate_notify(NOTE_READY, enclave_size, get_time() - start);
+
+	for(i = 1; i < h->nthreads; ++i)
+	{
+		if(thread_state[i] == THREAD_EXITED)
+			continue;
+		assert(pthread_create(&tid, NULL, restore_thread, (void*)(unsigned long)i) == 0);
+	}
+	free(h);
+
+	if(thread_state[0] == THREAD_EXITED)
+		pthread_exit(NULL);
+	resume_thread(0);
+}
+#endif
@@ -11,4 +11,7 @@ const char *modulus_path = "/home/tmac/workspace/sgx-driver/sign/modulus";
 
 const char* default_enclave = "/home/tmac/workspace/sgx-driver/enclave/enclave";
 const char* systable_path = "/home/tmac/workspace/sgx-driver/lib/syscall.table";
-
+//JSON timeline of the migrations; "unix:/path" for a socket, "" to disable
+const char* timeline_path = "/tmp/enclave-migration-timeline.json";
+//snapshot file written at each migrate-out, "" to disable
+const char* snapshot_path = "";
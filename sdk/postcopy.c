@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#include "postcopy.h"
+#include "profile.h"
+#include "mytime.h"
+
+#define PS 0x1000
+
+static int uffd = -1;
+static int stop_pipe[2];
+static char *pc_src;
+static unsigned long pc_dst;
+static unsigned long pc_size;
+
+static pthread_t fault_tid, prefetch_tid;
+static volatile int running = 0;
+static int kernel_faults = 1;
+static void (*on_resident)();
+
+static unsigned long faulted_pages, prefetched_pages;
+#if PROFILE
+static unsigned long pc_start;
+#endif
+
+//copy [offset, offset + len) from the checkpoint; 0 or -errno
+static long fetch(unsigned long offset, unsigned long len)
+{
+	struct uffdio_copy copy;
+
+	while(1)
+	{
+		copy.dst = pc_dst + offset;
+		copy.src = (unsigned long)pc_src + offset;
+		copy.len = len;
+		copy.mode = 0;
+		copy.copy = 0;
+
+		if(ioctl(uffd, UFFDIO_COPY, &copy) == 0)
+			return 0;
+		if(errno != EAGAIN)
+			break;
+		//the mm is changing under us: go on from where it stopped
+		if(copy.copy > 0)
+		{
+			offset += copy.copy;
+			len -= copy.copy;
+		}
+		if(len == 0)
+			return 0;
+	}
+	//somebody else has already fetched it
+	if(errno == EEXIST)
+		return copy.copy > 0 ? copy.copy : -EEXIST;
+	return -errno;
+}
+
+//a page that cannot be fetched: its thread would sleep forever
+static void fetch_failed(unsigned long offset, long err)
+{
+	fprintf(stderr, "[post-copy] cannot fetch page 0x%lx: %s\n", pc_dst + offset,
+			strerror(-err));
+	exit(-1);
+}
+
+static void* fault_thread(void *arg)
+{
+	struct uffd_msg msg;
+	struct pollfd pfd[2];
+	unsigned long offset;
+	long ret;
+
+	pfd[0].fd = uffd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_pipe[0];
+	pfd[1].events = POLLIN;
+
+	while(1)
+	{
+		if(poll(pfd, 2, -1) < 0)
+			continue;
+		if(pfd[1].revents)
+			break;
+		if(read(uffd, &msg, sizeof(msg)) != sizeof(msg))
+			continue;
+		if(msg.event != UFFD_EVENT_PAGEFAULT)
+			continue;
+
+		offset = (msg.arg.pagefault.address - pc_dst) & ~(PS - 1UL);
+		ret = fetch(offset, PS);
+		if(ret == -EEXIST)
+		{
+			//lost the race with the prefetcher: only wake the thread up
+			struct uffdio_range range = {.start = pc_dst + offset, .len = PS};
+			ioctl(uffd, UFFDIO_WAKE, &range);
+		}
+		else if(ret < 0)
+			fetch_failed(offset, ret);
+		else
+			faulted_pages += 1;
+	}
+	return NULL;
+}
+
+static void* prefetch_thread(void *arg)
+{
+	unsigned long offset, len, i;
+	long ret;
+
+	for(offset = 0; offset < pc_size; offset += len)
+	{
+		len = POSTCOPY_PREFETCH_PAGES * PS;
+		if(offset + len > pc_size)
+			len = pc_size - offset;
+
+		ret = fetch(offset, len);
+		if(ret == 0)
+		{
+			prefetched_pages += len / PS;
+			continue;
+		}
+
+		//part of the chunk was faulted in already: go page by page
+		for(i = 0; i < len; i += PS)
+		{
+			ret = fetch(offset + i, PS);
+			if(ret == 0)
+				prefetched_pages += 1;
+			else if(ret != -EEXIST)
+				fetch_failed(offset + i, ret);
+		}
+	}
+
+#if PROFILE
+	printf("[TIME] post-copy fully resident: %ld us (%ld faulted, %ld prefetched)\n",
+			get_time() - pc_start, faulted_pages, prefetched_pages);
+#endif
+
+	if(on_resident != NULL)
+		on_resident();
+
+	//everything is resident: tear down the fault handling
+	assert(write(stop_pipe[1], "x", 1) == 1);
+	pthread_join(fault_tid, NULL);
+
+	close(uffd);
+	close(stop_pipe[0]);
+	close(stop_pipe[1]);
+	uffd = -1;
+	return NULL;
+}
+
+static int open_uffd()
+{
+	int fd;
+
+	//non-blocking: the prefetcher may resolve a fault before we read it
+	fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	kernel_faults = 1;
+	//kernel faults are not allowed for unprivileged users by default
+	if(fd < 0)
+	{
+		fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+		kernel_faults = 0;
+	}
+	return fd;
+}
+
+int postcopy_kernel_faults()
+{
+	return kernel_faults;
+}
+
+int postcopy_start(char *src, unsigned long dst, unsigned long size, void (*resident)())
+{
+	struct uffdio_api api = {.api = UFFD_API, .features = 0};
+	struct uffdio_register reg;
+	void *addr;
+
+#if PROFILE
+	pc_start = get_time();
+#endif
+
+	pc_src = src;
+	pc_dst = dst;
+	pc_size = size;
+	on_resident = resident;
+	faulted_pages = 0;
+	prefetched_pages = 0;
+
+	uffd = open_uffd();
+	if(uffd < 0)
+	{
+		perror("userfaultfd");
+		kernel_faults = 1;
+		return -1;
+	}
+	if(ioctl(uffd, UFFDIO_API, &api) < 0)
+	{
+		perror("UFFDIO_API");
+		close(uffd);
+		kernel_faults = 1;
+		return -1;
+	}
+
+	addr = mmap((void*)dst, size, PROT_READ|PROT_WRITE|PROT_EXEC,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+	assert((unsigned long)addr == dst);
+
+	reg.range.start = dst;
+	reg.range.len = size;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+	if(ioctl(uffd, UFFDIO_REGISTER, &reg) < 0)
+	{
+		perror("UFFDIO_REGISTER");
+		close(uffd);
+		kernel_faults = 1;
+		return -1;
+	}
+
+	assert(pipe(stop_pipe) == 0);
+	assert(pthread_create(&fault_tid, NULL, fault_thread, NULL) == 0);
+	assert(pthread_create(&prefetch_tid, NULL, prefetch_thread, NULL) == 0);
+	running = 1;
+
+	return 0;
+}
+
+void postcopy_wait()
+{
+	if(!running)
+		return;
+	pthread_join(prefetch_tid, NULL);
+	running = 0;
+}
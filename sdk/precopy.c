@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "precopy.h"
+#include "profile.h"
+#include "mytime.h"
+
+#define PS 0x1000
+#define MAX_TRACKED 4
+#define PROT_TRACKED (PROT_READ|PROT_EXEC)
+#define PROT_NORMAL (PROT_READ|PROT_WRITE|PROT_EXEC)
+
+/*
+ * Dirty tracking for the native runtime:
+ *
+ * A tracked page is write-protected before it is copied. The first write to
+ * it faults, the SIGSEGV handler sets its bit and makes it writable again.
+ * A round takes the set bits, protects those pages again and only then
+ * copies them, so a write that lands between taking the bit and protecting
+ * the page is still covered by the copy.
+ *
+ * Stacks are never protected: the fault would be delivered on the same
+ * (read-only) stack.
+ */
+
+static unsigned long image_base;
+static unsigned long image_pages;
+static volatile unsigned long *dirty_map;
+static volatile int tracking = 0;
+
+static struct {
+	unsigned long offset;
+	unsigned long len;
+} tracked[MAX_TRACKED];
+static int tracked_num = 0;
+
+static struct sigaction old_segv;
+
+static inline int is_tracked(unsigned long page)
+{
+	int i;
+	unsigned long off = page * PS;
+
+	for(i = 0; i < tracked_num; ++i)
+	{
+		if(off >= tracked[i].offset && off < tracked[i].offset + tracked[i].len)
+			return 1;
+	}
+	return 0;
+}
+
+//the fs base may still point into the app: no printf here
+static void precopy_segv(int signum, siginfo_t *si, void *uc)
+{
+	unsigned long addr = (unsigned long)si->si_addr;
+	unsigned long page;
+
+	if(tracking && addr >= image_base && addr < image_base + image_pages * PS)
+	{
+		page = (addr - image_base) / PS;
+		if(is_tracked(page))
+		{
+			__sync_fetch_and_or(&dirty_map[page / 64], 1UL << (page % 64));
+			mprotect((void*)(image_base + page * PS), PS, PROT_NORMAL);
+			return;
+		}
+	}
+
+	//not ours: fall back to the previous handler and fault again
+	sigaction(SIGSEGV, &old_segv, NULL);
+}
+
+int precopy_init(unsigned long base, unsigned long size)
+{
+	struct sigaction sa;
+
+	image_base = base;
+	image_pages = size / PS;
+	tracked_num = 0;
+
+	if(dirty_map == NULL)
+	{
+		dirty_map = calloc((image_pages + 63) / 64, sizeof(unsigned long));
+		if(dirty_map == NULL)
+			return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = precopy_segv;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	return sigaction(SIGSEGV, &sa, &old_segv);
+}
+
+void precopy_track(unsigned long offset, unsigned long len)
+{
+	assert(tracked_num < MAX_TRACKED);
+	tracked[tracked_num].offset = offset;
+	tracked[tracked_num].len = len;
+	tracked_num += 1;
+}
+
+//protect and copy one run of pages
+static void copy_run(char *dst, unsigned long first, unsigned long cnt, precopy_copy_t copy)
+{
+	char *src = (char*)(image_base + first * PS);
+
+	mprotect(src, cnt * PS, PROT_TRACKED);
+	if(copy)
+		copy(dst, (char*)image_base, first, cnt);
+	else
+		memcpy(dst + first * PS, src, cnt * PS);
+}
+
+//take the dirty bits and copy those pages; return the number of pages
+static long copy_dirty(char *dst, int protect)
+{
+	unsigned long w, bits;
+	unsigned long page, run_start = 0, run_len = 0;
+	long cnt = 0;
+
+	for(w = 0; w < (image_pages + 63) / 64; ++w)
+	{
+		bits = __sync_lock_test_and_set(&dirty_map[w], 0);
+		while(bits)
+		{
+			page = w * 64 + __builtin_ctzl(bits);
+			bits &= bits - 1;
+			cnt += 1;
+
+			if(run_len && page == run_start + run_len)
+			{
+				run_len += 1;
+				continue;
+			}
+			if(run_len)
+			{
+				if(protect)
+					copy_run(dst, run_start, run_len, NULL);
+				else
+					memcpy(dst + run_start * PS, (char*)(image_base + run_start * PS), run_len * PS);
+			}
+			run_start = page;
+			run_len = 1;
+		}
+	}
+	if(run_len)
+	{
+		if(protect)
+			copy_run(dst, run_start, run_len, NULL);
+		else
+			memcpy(dst + run_start * PS, (char*)(image_base + run_start * PS), run_len * PS);
+	}
+	return cnt;
+}
+
+long precopy_rounds(char *dst, precopy_copy_t copy0)
+{
+	int i;
+	int round;
+	long cnt, last;
+#if PROFILE
+	unsigned long start, end;
+	start = get_time();
+#endif
+
+	//round 0: everything we track
+	tracking = 1;
+	last = 0;
+	for(i = 0; i < tracked_num; ++i)
+	{
+		copy_run(dst, tracked[i].offset / PS, tracked[i].len / PS, copy0);
+		last += tracked[i].len / PS;
+	}
+	printf("[precopy] round 0: %ld pages\n", last);
+
+	for(round = 1; round <= PRECOPY_MAX_ROUNDS; ++round)
+	{
+		cnt = copy_dirty(dst, 1);
+		printf("[precopy] round %d: %ld pages\n", round, cnt);
+
+		//small enough, or the app dirties pages as fast as we copy them
+		if(cnt <= PRECOPY_STOP_PAGES || cnt >= last)
+			break;
+		last = cnt;
+	}
+
+#if PROFILE
+	end = get_time();
+	printf("[TIME] precopy rounds (app running): %ld us\n", end - start);
+#endif
+	return cnt;
+}
+
+//all the threads are stopped
+long precopy_finish(char *dst)
+{
+	int i;
+	long cnt;
+	unsigned long page;
+	unsigned long untracked = 0;
+
+	cnt = copy_dirty(dst, 0);
+	tracking = 0;
+
+	for(i = 0; i < tracked_num; ++i)
+		mprotect((void*)(image_base + tracked[i].offset), tracked[i].len, PROT_NORMAL);
+
+	for(page = 0; page < image_pages; ++page)
+	{
+		if(is_tracked(page))
+			continue;
+		memcpy(dst + page * PS, (char*)(image_base + page * PS), PS);
+		untracked += 1;
+	}
+
+	sigaction(SIGSEGV, &old_segv, NULL);
+
+	printf("[precopy] stop-and-copy: %ld dirty pages + %ld untracked pages\n", cnt, untracked);
+	return cnt;
+}
@@ -11,14 +11,19 @@
 #include "../musl-libc/build/include/bits/syscall.h" // define all the syscall number
 #include "vars.h"
 #include "profile.h"
+#include "dump.h"
+#include "switchless.h"
+#include "batch.h"
+#include "uring.h"
 
 
 #if PROFILE
 unsigned long total_mmap_size = 0;
 unsigned long current_mmap_size = 0;
 unsigned long max_mmap_size = 0;
+unsigned long batch_ocalls = 0;
+unsigned long batch_calls = 0;
 #endif
-unsigned long mmap_size;
 
 //#define DEBUG_INFO 1
 #ifdef DEBUG_INFO
@@ -26,12 +31,6 @@ extern char *table[332];
 void init_systable();
 #endif
 
-//128 pages for communication
-//TODO: 128 is enough for gcc while 64 is not. For 166.i. COPY iteratively.
-//#define COM_BUFFER_SIZE (0x1000 * 128)
-#define COM_BUFFER_SIZE (0x1000 * 4096)
-#define OUTSIDE_STACK_SIZE 0x2000
-
 int next_enclave_thread_id = 0;
 
 __thread unsigned long outside_buffer; //per thread
@@ -93,6 +92,10 @@ void set_env(struct enclave_config config)
 
 	next_enclave_thread_id = 1;
 
+	//before any ocall: the enclave reads the ring
+	sl_init();
+	ur_init();
+
 	printf("[tmac] main thread: invoke INIT_SYSCALL\n");
 	enter_enclave(INIT_SYSCALL, (void*)buf);
 	printf("[tmac] main thread: finish INIT_SYSCALL\n");
@@ -160,7 +163,9 @@ static __inline long syscall6(long n, long a1, long a2, long a3, long a4, long a
 }
 
 
-//invoke system calls for enclave programs
+//invoke system calls for enclave programs.
+//Reached by a jmp (EEXIT) on the stack of the ecall: not aligned as after a call.
+__attribute__((force_align_arg_pointer))
 void outside_trampoline()
 {
 	unsigned long *buf;
@@ -168,13 +173,20 @@ void outside_trampoline()
 	long n; //syscall_num
 	long a1, a2, a3, a4, a5, a6; // args of syscall
 	long ret;
+	struct sgx_batch_call *calls;
+	long i;
 
-	if(dump_flag == 2)
+	//the rewritten EEXIT set FS behind the back of a kernel that does not save it
+	if(dump_flag == 2 && fs_mode == FS_PRCTL)
 	{
 		write_fs(read_fs());
 		//printf("[out tramp] current fs: 0x%lx\n", read_fs());
 	}
 
+	//quiescent until return_enclave
+	set_thread_state(THREAD_IN_HOST);
+	sl_kick();
+
 	buf = (unsigned long*)outside_buffer;
 	syscall_type = *buf;
 	n = *(buf+1);
@@ -215,14 +227,12 @@ void outside_trampoline()
 	{
 		total_mmap_size += *(buf+3);	
 		current_mmap_size += *(buf+3);	
-		mmap_size = current_mmap_size;
 		if(current_mmap_size > max_mmap_size)
 			max_mmap_size = current_mmap_size;
 	}
 	if(n == SYS_munmap)
 	{
 		current_mmap_size -= *(buf+3);	
-		mmap_size = current_mmap_size;
 	}
 	#endif
 
@@ -352,6 +362,21 @@ void outside_trampoline()
 			else
 				printf("[tmac] fatal error: invalid ocall libcall\n");	
 			break;
+		case SGXBATCH:
+			//n calls queued by the enclave, in order (see batch.h)
+			calls = (struct sgx_batch_call*)*(buf+2);
+			for(i = 0; i < n; ++i)
+			{
+				calls[i].ret = syscall6(calls[i].n, calls[i].args[0], calls[i].args[1],
+						calls[i].args[2], calls[i].args[3], calls[i].args[4], calls[i].args[5]);
+			}
+			#if PROFILE
+			__sync_fetch_and_add(&batch_ocalls, 1);
+			__sync_fetch_and_add(&batch_calls, n);
+			#endif
+			ret = n;
+			*buf = ret;
+			break;
 		case SGXDEBUG:
 			a1 = *(buf+1);
 			printf("[tmac debug ocall] val: 0x%lx\n", a1);
@@ -394,6 +419,13 @@ static void* created_enclave_thread(void* arg)
 	{
 		//The migrate thread uses the last TCS.
 		etid = tcs_num - 1;
+		migrate_tcs = 1;
+	}
+	else if(*(unsigned long*)arg == MIGRATE_WORKER)
+	{
+		//Dump helpers take the idle TCSs right below the migrate thread.
+		etid = tcs_num - 1 - ((struct dump_desc*)*((unsigned long*)arg + 1))->worker;
+		migrate_tcs = 1;
 	}
 	else
 	{
@@ -437,6 +469,7 @@ static void* created_enclave_thread(void* arg)
 	n = *(buf+1);
 
 	enter_enclave(func, (void*)n);
+	set_thread_state(THREAD_EXITED);
 
 	//printf("An enclave_thread(%d) finished\n", etid);
 
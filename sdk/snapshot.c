@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "usercall.h"
+
+static int pwrite_full(int fd, const char *buf, unsigned long len, unsigned long off)
+{
+	long ret;
+
+	while(len > 0)
+	{
+		ret = pwrite(fd, buf, len, off);
+		if(ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+		off += ret;
+	}
+	return 0;
+}
+
+int snapshot_save(const char *path, struct snap_header *h, const char *image)
+{
+	char *tmp;
+	int fd, i, ret = -1;
+
+	h->magic = SNAP_MAGIC;
+	h->version = SNAP_VERSION;
+	h->data_off = SNAP_HEADER_SIZE;
+
+	//a crash while writing leaves the previous snapshot in place
+	tmp = malloc(strlen(path) + 5);
+	if(tmp == NULL)
+		return -1;
+	sprintf(tmp, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if(fd < 0)
+	{
+		perror("[snapshot] open");
+		free(tmp);
+		return -1;
+	}
+
+	//holes between the extents read as zero
+	if(ftruncate(fd, h->data_off + h->size) != 0)
+		goto out;
+	for(i = 0; i < h->nextents; ++i)
+	{
+		if(pwrite_full(fd, image + h->extents[i].offset, h->extents[i].len,
+					h->data_off + h->extents[i].offset) != 0)
+			goto out;
+	}
+	//the header last: a file with a valid header is complete
+	if(pwrite_full(fd, (char*)h, sizeof(*h), 0) != 0 || fdatasync(fd) != 0)
+		goto out;
+	ret = 0;
+
+out:
+	close(fd);
+	if(ret == 0 && rename(tmp, path) != 0)
+		ret = -1;
+	if(ret != 0)
+	{
+		perror("[snapshot] write");
+		unlink(tmp);
+	}
+	free(tmp);
+	return ret;
+}
+
+int snapshot_open(const char *path, struct snap_header *h)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		perror("[snapshot] open");
+		return -1;
+	}
+	if(pread(fd, h, sizeof(*h), 0) != sizeof(*h) || h->magic != SNAP_MAGIC)
+	{
+		printf("[snapshot] %s is not a snapshot\n", path);
+		goto fail;
+	}
+	if(h->version != SNAP_VERSION)
+	{
+		printf("[snapshot] version %u, expected %u\n", h->version, SNAP_VERSION);
+		goto fail;
+	}
+	if(fstat(fd, &st) != 0 || h->data_off % 0x1000 != 0 ||
+			(unsigned long)st.st_size < h->data_off + h->size)
+	{
+		printf("[snapshot] %s is truncated\n", path);
+		goto fail;
+	}
+	if(h->tcs_num > SNAP_MAX_THREADS || h->nthreads > h->tcs_num ||
+			h->nextents > MAX_DUMP_EXTENTS)
+	{
+		printf("[snapshot] bad header\n");
+		goto fail;
+	}
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+#define CHECK(field) \
+	if(h->cfg.field != cfg->field) \
+	{ \
+		printf("[snapshot] " #field ": 0x%lx in the snapshot, 0x%lx in the enclave\n", \
+				(unsigned long)h->cfg.field, (unsigned long)cfg->field); \
+		ret = -1; \
+	}
+
+int snapshot_check(const struct snap_header *h, const struct enclave_config *cfg)
+{
+	int ret = 0;
+
+	CHECK(total_pages);
+	CHECK(code_pages);
+	CHECK(data_pages);
+	CHECK(heap_pages);
+	CHECK(stack_pages);
+	CHECK(tcs_ssa);
+	CHECK(start_addr);
+	if(h->size != (unsigned long)cfg->total_pages * 0x1000)
+	{
+		printf("[snapshot] size 0x%lx does not match the pages\n", h->size);
+		ret = -1;
+	}
+	if(h->tcs_num != cfg->tcs_ssa / 3)
+	{
+		printf("[snapshot] %d TCS, the enclave has %u\n", h->tcs_num, cfg->tcs_ssa / 3);
+		ret = -1;
+	}
+	return ret;
+}
+
+char* snapshot_map(int fd, const struct snap_header *h)
+{
+	char *addr;
+
+	//private: the app writes to its own copy, the file stays as saved
+	addr = mmap((void*)h->mapaddr, h->size, PROT_READ|PROT_WRITE|PROT_EXEC,
+			MAP_PRIVATE|MAP_FIXED_NOREPLACE, fd, h->data_off);
+	if(addr == MAP_FAILED && errno == EEXIST)
+		reexec_no_aslr(h->mapaddr);
+	if(addr != (char*)h->mapaddr)
+	{
+		perror("[snapshot] mmap");
+		return NULL;
+	}
+	return addr;
+}
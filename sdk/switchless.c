@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "function_table.h"
+#include "switchless.h"
+
+//idle rounds a worker polls before it sleeps; doubled pauses between them
+#define SL_WORKER_SPIN 4096
+#define SL_MAX_PAUSE 64
+
+static struct sl_ring *ring = NULL;
+
+static inline long sl_syscall6(long n, long a1, long a2, long a3, long a4, long a5, long a6)
+{
+	unsigned long ret;
+	register long r10 __asm__("r10") = a4;
+	register long r8 __asm__("r8") = a5;
+	register long r9 __asm__("r9") = a6;
+	__asm__ __volatile__ ("syscall" : "=a"(ret) : "a"(n), "D"(a1), "S"(a2),
+						  "d"(a3), "r"(r10), "r"(r8), "r"(r9) : "rcx", "r11", "memory");
+	return ret;
+}
+
+static void run(struct sl_req *req)
+{
+	long a[6] = {0};
+	int i;
+
+	//a stale cell of a cancelled request, or of one run already
+	if(!__sync_bool_compare_and_swap(&req->state, SL_POSTED, SL_TAKEN))
+		return;
+	//SYSCALLn: the header words after the n args are stale
+	for(i = 0; i < req->type && i < 6; ++i)
+		a[i] = req->args[i];
+	req->ret = sl_syscall6(req->n, a[0], a[1], a[2], a[3], a[4], a[5]);
+	if(__sync_lock_test_and_set(&req->state, SL_DONE) == SL_SLEEP)
+		syscall(SYS_futex, &req->state, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void* worker(void *arg)
+{
+	unsigned long req;
+	sigset_t all;
+	int idle = 0, pause = 1, i, bell;
+
+	//the migration signals go to the enclave threads
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	while(1)
+	{
+		req = sl_pop(ring);
+		if(req != 0)
+		{
+			run((struct sl_req*)req);
+			idle = 0;
+			pause = 1;
+			continue;
+		}
+		if(++idle < SL_WORKER_SPIN)
+		{
+			for(i = 0; i < pause; ++i)
+				__asm__ __volatile__ ("pause" ::: "memory");
+			if(pause < SL_MAX_PAUSE)
+				pause *= 2;
+			continue;
+		}
+
+		//with all of them asleep, requests take the ocall (sl_kick wakes one)
+		bell = ring->doorbell;
+		__sync_fetch_and_sub(&ring->awake, 1);
+		//posted before the enclave saw it: not left behind
+		if(ring->cells[ring->head & (SL_RING_SIZE - 1)].seq != ring->head + 1)
+			syscall(SYS_futex, &ring->doorbell, FUTEX_WAIT, bell, NULL, NULL, 0);
+		__sync_fetch_and_add(&ring->awake, 1);
+		idle = 0;
+		pause = 1;
+	}
+	return NULL;
+}
+
+//the ring at SL_RING_ADDR, and SWITCHLESS_WORKERS workers (0: off)
+void sl_init()
+{
+	pthread_t tid;
+	int n = 0, cpus, i;
+
+	if(ring != NULL)
+		return;
+	if(getenv("SWITCHLESS_WORKERS"))
+		n = atoi(getenv("SWITCHLESS_WORKERS"));
+	if(n > SL_MAX_WORKERS)
+		n = SL_MAX_WORKERS;
+	//a worker without a core of its own makes every request wait out SL_SPIN
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n > cpus - 1)
+	{
+		printf("[switchless] %d cpus: %d workers instead of %d\n", cpus, cpus - 1, n);
+		n = cpus - 1;
+	}
+
+	//mapped even when off: the enclave reads nworkers and awake
+	ring = mmap((void*)SL_RING_ADDR, sizeof(struct sl_ring), PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+	if(ring != (void*)SL_RING_ADDR)
+	{
+		perror("[switchless] mmap");
+		exit(-1);
+	}
+	sl_ring_init(ring);
+	if(n <= 0)
+		return;
+
+	ring->nworkers = n;
+	ring->awake = n;
+	for(i = 0; i < n; ++i)
+	{
+		if(pthread_create(&tid, NULL, worker, NULL) != 0)
+		{
+			perror("[switchless] pthread_create");
+			__sync_fetch_and_sub(&ring->awake, 1);
+			continue;
+		}
+		pthread_detach(tid);
+	}
+	printf("[switchless] %d workers\n", n);
+}
+
+//an ocall while the workers sleep: wake one for the next requests
+void sl_kick()
+{
+	if(ring == NULL || ring->nworkers == 0 || ring->awake > 0)
+		return;
+	__sync_fetch_and_add(&ring->doorbell, 1);
+	syscall(SYS_futex, &ring->doorbell, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
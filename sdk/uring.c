@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+//SQ entries: one per slot, so the SQ is never full; the CQ is twice that
+#define UR_ENTRIES UR_SLOTS
+
+static struct ur_desc *desc = NULL;
+
+static void* ur_map(int fd, unsigned long size, unsigned long off)
+{
+	void *addr;
+
+	addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, off);
+	return (addr == MAP_FAILED) ? NULL : addr;
+}
+
+//-1 when the kernel has no io_uring (or it is disabled): the ocalls stay
+static int ur_setup(int sqpoll)
+{
+	struct io_uring_params p;
+	unsigned long sq_size, cq_size;
+	char *sq, *cq;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	if(sqpoll)
+	{
+		p.flags = IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = 1000; //ms
+	}
+	fd = syscall(UR_SYS_SETUP, UR_ENTRIES, &p);
+	if(fd < 0)
+		return -1;
+	//the enclave waits with a timeout (see ur_finish)
+	if(!(p.features & IORING_FEAT_EXT_ARG))
+	{
+		close(fd);
+		return -1;
+	}
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+	sq = ur_map(fd, sq_size, IORING_OFF_SQ_RING);
+	cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq : ur_map(fd, cq_size, IORING_OFF_CQ_RING);
+	desc->sqes = ur_map(fd, p.sq_entries * sizeof(struct io_uring_sqe), IORING_OFF_SQES);
+	if(sq == NULL || cq == NULL || desc->sqes == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+
+	desc->fd = fd;
+	desc->sqpoll = sqpoll;
+	desc->sq_head = (unsigned*)(sq + p.sq_off.head);
+	desc->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	desc->sq_flags = (unsigned*)(sq + p.sq_off.flags);
+	desc->sq_array = (unsigned*)(sq + p.sq_off.array);
+	desc->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	desc->cq_head = (unsigned*)(cq + p.cq_off.head);
+	desc->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	desc->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	desc->cqes = (struct ur_cqe*)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+//the descriptor at UR_ADDR; a ring when URING is set (1: submitted by the
+//io_uring_enter ocalls, sqpoll: by a kernel thread, no ocall to submit)
+void ur_init()
+{
+	char *mode = getenv("URING");
+
+	if(desc != NULL)
+		return;
+	//mapped even when off: the enclave reads ok
+	desc = mmap((void*)UR_ADDR, UR_MAP_SIZE, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+	if(desc != (void*)UR_ADDR)
+	{
+		perror("[uring] mmap");
+		exit(-1);
+	}
+	//per process: the slots of a migrated thread are not in this ring
+	desc->gen = getpid();
+	if(mode == NULL || strcmp(mode, "0") == 0)
+		return;
+
+	if(strcmp(mode, "sqpoll") == 0 && ur_setup(1) == 0)
+	{
+		desc->ok = 1;
+		printf("[uring] %d slots, SQPOLL\n", UR_SLOTS);
+		return;
+	}
+	if(ur_setup(0) == 0)
+	{
+		desc->ok = 1;
+		printf("[uring] %d slots\n", UR_SLOTS);
+		return;
+	}
+	printf("[uring] not available: every call is an ocall\n");
+}
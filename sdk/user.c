@@ -16,6 +16,7 @@
 #include "function_table.h"
 #include "path_config.h"
 #include "profile.h"
+#include "manager.h"
 
 extern __thread unsigned long outside_buffer;
 
@@ -29,6 +30,12 @@ unsigned is_memcached = 0;
 int sigignore(int sig);
 //For migration
 void install_migrate_handler();
+void init_fs_mode();
+//For restart: user --restore <snapshot> [enclave]
+void restore_snapshot(const char*, const char*);
+//For the manager
+extern unsigned long enclave_size;
+extern int native_mode;
 
 #if 0
 #define EVAL_ENCLAVE_COPY 1
@@ -55,8 +62,22 @@ int main(int argc,char* argv[])
 		init_debug();
 #endif
 
+	//before anything reads FS
+	init_fs_mode();
 	install_migrate_handler();
 
+	//the app continues from the snapshot: no enclave is created
+	if((argc > 2) && (strcmp(argv[1], "--restore") == 0))
+		restore_snapshot(argv[2], argc > 3 ? argv[3] : default_enclave);
+
+	//user --native <enclave> [args]: no SGX needed (see create_enclave)
+	if((argc > 1) && (strcmp(argv[1], "--native") == 0))
+	{
+		native_mode = 1;
+		argc -= 1;
+		argv += 1;
+	}
+
 	//save info
 	main_argc = (unsigned long)argc;
 	main_argv = (unsigned long)argv;
@@ -87,6 +108,9 @@ int main(int argc,char* argv[])
 		is_memcached = 1;
 	}
 
+	//the manager may migrate it from now on
+	migrate_notify(NOTE_READY, enclave_size, 0);
+
 
 #if 0
 #if EVAL_ENCLAVE_COPY
@@ -123,6 +147,9 @@ int main(int argc,char* argv[])
 	#if PROFILE
 	printf("TOTAL MMAP SIZE: 0x%lx\n", total_mmap_size);
 	printf("MAX MMAP SIZE: 0x%lx\n", max_mmap_size);
+	if(batch_ocalls != 0)
+		printf("BATCH: %lu syscalls in %lu ocalls, %.2f per ocall\n", batch_calls, batch_ocalls,
+				(double)batch_calls / batch_ocalls);
 	exit(0);
 	#endif
 	return 0;
@@ -4,6 +4,10 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/personality.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <assert.h>
 
 #include "userlib.h"
@@ -12,6 +16,8 @@
 #include "config.h"
 #include "vars.h"
 #include "path_config.h"
+#include "timeline.h"
+#include "usercall.h"
 
 //TODO
 unsigned long fake_heap;
@@ -39,6 +45,9 @@ __thread unsigned long tcs_p;
 unsigned long *tcs_addr;
 int tcs_num;
 
+//user --native: no SGX, the app runs from a plain mapping (as after a migrate-out)
+int native_mode = 0;
+
 void write_hash(unsigned char hash[32])
 {
 	FILE *file;
@@ -97,6 +106,82 @@ void destroy_enclave()
 	close(sgxfd);
 }
 
+//the layout of create_enclave, without SGX
+static void* create_enclave_native(const char *filename)
+{
+	struct enclave_config config;
+	unsigned long offset, start_time;
+	char *base;
+	int i;
+
+	start_time = get_time();
+	if(read_config(filename, &config) == -1)
+	{
+		printf("[ERROR] Fail to read configuration.\n");
+		exit(-1);
+	}
+	ecfg = config;
+
+	//where the driver puts it: the image is linked there
+	enclave_size = PAGE_SIZE * config.total_pages;
+	base = mmap((void*)config.start_addr, enclave_size, PROT_READ|PROT_WRITE|PROT_EXEC,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+	if(base == MAP_FAILED && errno == EEXIST)
+		reexec_no_aslr(config.start_addr);
+	if(base != (char*)config.start_addr)
+	{
+		perror("mmap");
+		exit(-1);
+	}
+	enclave_mapaddr = (unsigned long)base;
+	fake_heap = (unsigned long)malloc(128*1024*1024);
+	load_elf64(filename, base, config.start_addr);
+
+	//TCS & SSA & TLS after the stack, as in the enclave; TLS is set up by INIT_SYSCALL
+	offset = PAGE_SIZE * (config.code_pages + config.data_pages + config.heap_pages + 
+			config.stack_pages);
+	tcs_num = config.tcs_ssa / 3;
+	tcs_addr = (unsigned long*)malloc(tcs_num * sizeof(unsigned long));
+	for(i = 0; i < tcs_num; ++i)
+		tcs_addr[i] = enclave_mapaddr + offset + 3 * PAGE_SIZE * i;
+
+	init_migrate();
+	start_native(base);
+
+	printf("[native] create_enclave need: %ld us\n", get_time() - start_time);
+	set_env(config);
+	return base;
+}
+
+//The brk heap of user is randomized over the first GiB, where images are
+//linked (0x18000000): when it already sits in the range, mapping it there
+//would wipe the heap. Run again without ASLR (setarch -R), once.
+void reexec_no_aslr(unsigned long addr)
+{
+	static char cmd[8192];
+	char *argv[256];
+	int fd, len, argc = 0, i;
+
+	if(personality(0xffffffff) & ADDR_NO_RANDOMIZE)
+		return;
+	fd = open("/proc/self/cmdline", O_RDONLY);
+	if(fd < 0)
+		return;
+	len = read(fd, cmd, sizeof(cmd) - 1);
+	close(fd);
+	if(len <= 0)
+		return;
+	for(i = 0; i < len && argc < 255; i += strlen(cmd + i) + 1)
+		argv[argc++] = cmd + i;
+	argv[argc] = NULL;
+
+	printf("[user] 0x%lx is taken (by the heap?): run again without ASLR\n", addr);
+	fflush(stdout);
+	personality(personality(0xffffffff) | ADDR_NO_RANDOMIZE);
+	execv("/proc/self/exe", argv);
+	perror("[user] execv");
+}
+
 void* create_enclave(const char *filename)
 {
 	unsigned page_num;
@@ -117,6 +202,9 @@ void* create_enclave(const char *filename)
 
 	unsigned long start_time, end_time;
 
+	if(native_mode)
+		return create_enclave_native(filename);
+
 	start_time = get_time();
 	//FILE *file;
 	if ((sgxfd = open("/dev/isgx", O_RDWR)) < 0) {
@@ -363,7 +451,9 @@ void create_enclave_at_runtime(char *elf_dst)
 		eadd_addr += 3 * PAGE_SIZE;
 	}
 
+	tl_mark(TL_REBUILD);
 	test_einit_opt(sgxfd, u_base, enclave_hash, (char*)enclave_state);
+	tl_mark(TL_EINIT);
 	//test_einit(sgxfd, u_base, enclave_hash, (char*)enclave_state);
 
 	free((char*)tcs);
@@ -478,7 +568,9 @@ void create_enclave_at_runtime(char *elf_dst)
 	//write the hash to hash.bin
 	write_hash((unsigned char*)enclave_hash);
 
+	tl_mark(TL_REBUILD);
 	test_einit(sgxfd, u_base, enclave_hash, (char*)enclave_state);
+	tl_mark(TL_EINIT);
 
 	free((char*)tcs);
 	//end_time = get_time();
@@ -495,7 +587,7 @@ void handle_aex_0()
 {
 	loop_for_dump();	
 
-	if((dump_flag == 0) || (tcs_p == tcs_addr[tcs_num - 1]) || (put_in_flag == 2))
+	if(!native_mode && ((dump_flag == 0) || migrate_tcs || (put_in_flag == 2)))
 	//if((dump_flag == 0) || (tcs_p == tcs_addr[tcs_num - 1]))
 	{
 		__asm__ __volatile__
@@ -575,7 +667,7 @@ void enter_enclave(long func_choice, void* arg)
 	*/
 
 		
-	if((dump_flag == 0) || (tcs_p == tcs_addr[tcs_num - 1]) || (put_in_flag == 2))
+	if(!native_mode && ((dump_flag == 0) || migrate_tcs || (put_in_flag == 2)))
 	//if((dump_flag == 0) || (tcs_p == tcs_addr[tcs_num - 1]))
 	{
 
@@ -598,19 +690,25 @@ void enter_enclave(long func_choice, void* arg)
 	}
 	else
 	{
-		assert(dump_flag == 2); //may fail due to contention
+		assert(dump_flag == 2 || native_mode); //may fail due to contention
 
-		printf("ENTER enclave\n");
+		//printf("ENTER enclave\n");
 		restore_enclave_thread_fsgs();
+		//the rewritten EEXIT comes back with jmp *%rcx (the IP after EENTER)
 		asm volatile
 		(
+			"pop %%rsi\n\t"
+			"pop %%rdi\n\t"
+
 			"mov %%rdi, %%r9\n\t" //the first argument
 			"mov %%rsi, %%r10\n\t" //the second argument
+			"lea 1f(%%rip), %%rcx\n\t"
 			"mov %0, %%rax\n\t"
 			"jmp *%%rax\n\t"
+			"1:\n\t"
 			:
 			:"m"(enclave_mapaddr)
-			:"%rax", "%r9", "%r10", "%rsi", "%rdi"
+			:"%rax", "%rbx", "%rcx", "%r9", "%r10", "%rsi", "%rdi"
 		);
 	}
 
@@ -644,8 +742,8 @@ void return_enclave(unsigned long arg)
 
 	loop_for_dump();
 
-	// condition (tcs_p == tcs_addr[tcs_num - 1]) is for migrate thread inside enclave
-	if((dump_flag == 0) || (tcs_p == tcs_addr[tcs_num - 1]) || (put_in_flag == 2))
+	// condition migrate_tcs is for migrate threads inside enclave
+	if(!native_mode && ((dump_flag == 0) || migrate_tcs || (put_in_flag == 2)))
 	{
 		//printf("[return to enclave] tcs value: 0x%lx, handler is 0x%lx\n", tcs_p, handler);
 		//transfer control to the enclave 
@@ -663,7 +761,7 @@ void return_enclave(unsigned long arg)
 	}
 	else
 	{
-		assert(dump_flag == 2); //may fail due to contention
+		assert(dump_flag == 2 || native_mode); //may fail due to contention
 
 		//printf("RETURN enclave\n");
 		restore_enclave_thread_fsgs();